@@ -1,7 +1,6 @@
 #version 130
 
 #define PI 3.1415926
-#define GAMMA 2.2
 
 in vec2 Texcoord;
 
@@ -13,7 +12,11 @@ uniform sampler2D GBuffer_Depth;
 uniform samplerCube EnvIrrMap;
 uniform samplerCube EnvPrefilterMap;
 uniform sampler2D EnvBrdfLUT;
+#ifdef SHADOW_EVSM
 uniform sampler2D ShadowMap;
+#else
+uniform sampler2DShadow ShadowMap;
+#endif
 
 uniform vec3 AmbientTerm;
 uniform vec4 MainLightPosition;
@@ -21,11 +24,30 @@ uniform vec3 MainLightColor;
 uniform float MainLightIntensity;
 uniform mat4x4 InvView;
 uniform mat4x4 InvProjection;
+uniform bool ReverseZ;
 uniform mat4x4 LightSpace;
 uniform float Exposure;
 
+#ifdef SHADOW_EVSM
+uniform vec2 EvsmExponents;
+uniform float EvsmLightBleedReduction;
+uniform float EvsmVarianceBias;
+#else
+#define SHADOW_PCF_TAPS_MAX 16
+uniform vec2 ShadowPcfOffsets[SHADOW_PCF_TAPS_MAX];
+uniform int ShadowPcfTaps;
+uniform bool ShadowPcfRotate;
+#endif
+
 out vec4 outColor;
 
+// Lighting complexity view: count units of lighting work instead of shading
+#ifdef LIGHTING_COMPLEXITY
+float Complexity = 0.0;
+#define COUNT_WORK(n) Complexity += (n)
+#else
+#define COUNT_WORK(n)
+#endif
 
 struct Material
 {
@@ -50,7 +72,6 @@ vec3 Uncharted2ToneMapping(vec3 color)
   color = ((color * (A * color + C * B) + D * E) / (color * (A * color + B) + D * F)) - E / F;
   float white = ((W * (A * W + C * B) + D * E) / (W * (A * W + B) + D * F)) - E / F;
   color /= white;
-  color = pow(color, vec3(1. / GAMMA));
   return color;
 }
 
@@ -70,8 +91,8 @@ vec3 FresnelSchlickWithRoughness(vec3 F0, float cosTheta, float roughness)
 // Reconstruct view space position from depth
 vec3 ViewPositionFromDepth(vec2 texcoord, float depth)
 {
-  // Get x/w and y/w from the viewport position
-  vec3 projectedPos = vec3(texcoord, depth) * 2.0f - 1.0f;;
+  // Get x/w and y/w from the viewport position, reverse-z depth is already in [0, 1] ndc
+  vec3 projectedPos = vec3(texcoord * 2.0f - 1.0f, ReverseZ ? depth : depth * 2.0f - 1.0f);
 
   // Transform by the inverse projection matrix
   vec4 positionVS = InvProjection * vec4(projectedPos, 1.0f);
@@ -176,7 +197,7 @@ vec3 IBLAmbientRadiance(vec3 N, vec3 V, Material m, vec3 F0)
 {
   vec3 worldN = (InvView * vec4(N, 0)).xyz;	// World normal
   vec3 worldV = (InvView * vec4(V, 0)).xyz;	// World view
-  vec3 irradiance = pow(texture(EnvIrrMap, worldN).xyz, vec3(GAMMA));
+  vec3 irradiance = texture(EnvIrrMap, worldN).xyz;
 
   // cos(angle) between surface normal and eye
   float NdV = max(0.001, dot(worldN, worldV));
@@ -189,25 +210,77 @@ vec3 IBLAmbientRadiance(vec3 N, vec3 V, Material m, vec3 F0)
   const float MAX_REFLECTION_LOD = 6.0;
   vec3 R = reflect(-worldV, worldN);
   vec2 envBRDF  = texture(EnvBrdfLUT, vec2(NdV, m.Roughness)).rg;
-  vec3 prefilteredColor = pow(textureLod(EnvPrefilterMap, R,  m.Roughness * MAX_REFLECTION_LOD).rgb, vec3(GAMMA));
+  vec3 prefilteredColor = textureLod(EnvPrefilterMap, R,  m.Roughness * MAX_REFLECTION_LOD).rgb;
   vec3 specular = prefilteredColor * (kS * envBRDF.x + envBRDF.y);
 
   return AmbientTerm * (diffuse + specular) * m.Occlusion; // IBL ambient
 }
 
+#ifdef SHADOW_EVSM
+// Upper bound on the fraction of light reaching depth 'mean', with light bleeding
+// cut off below EvsmLightBleedReduction
+float ChebyshevUpperBound(vec2 moments, float mean, float minVariance)
+{
+  float variance = max(moments.y - moments.x * moments.x, minVariance);
+  float d = mean - moments.x;
+  float pMax = variance / (variance + d * d);
+  pMax = clamp((pMax - EvsmLightBleedReduction) / (1.0 - EvsmLightBleedReduction), 0.0, 1.0);
+  return (mean <= moments.x) ? 1.0 : pMax;
+}
+
+// A single trilinear/anisotropic fetch of the prefiltered moments
+float ShadowMapVisibility(vec3 P, vec3 N) {
+  vec4 PLw = (LightSpace * vec4(P, 1.0));
+  vec3 PL = (PLw.xyz / PLw.w) * 0.5 + 0.5;
+  if (PL.z > 1.0 || PL.z < 0.0) return 0.0;
+
+  vec4 moments = texture(ShadowMap, PL.xy);
+  float depth = 2.0 * PL.z - 1.0;
+  vec2 warped = vec2(exp(EvsmExponents.x * depth), -exp(-EvsmExponents.y * depth));
+  vec2 depthScale = EvsmVarianceBias * 0.01 * EvsmExponents * warped;
+  vec2 minVariance = depthScale * depthScale;
+
+  float pos = ChebyshevUpperBound(moments.xy, warped.x, minVariance.x);
+  float neg = ChebyshevUpperBound(moments.zw, warped.y, minVariance.y);
+  COUNT_WORK(1.0);
+  return 1.0 - min(pos, neg);
+}
+#else
+// Per-pixel noise used to rotate the PCF kernel, trading banding for grain
+// See: http://www.iryoku.com/next-generation-post-processing-in-call-of-duty-advanced-warfare
+float InterleavedGradientNoise(vec2 pixel)
+{
+  return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+// Each tap is a hardware depth compare with bilinear 2x2 filtering
 float ShadowMapVisibility(vec3 P, vec3 N) {
   vec4 PLw = (LightSpace * vec4(P, 1.0));
   vec3 PL = (PLw.xyz / PLw.w) * 0.5 + 0.5;
   if (PL.z > 1.0 || PL.z < 0.0) return 0.0;
-  float closestDepth = texture(ShadowMap, PL.xy).r;
   vec3 L = normalize(MainLightPosition.xyz - P * MainLightPosition.w);
   float bias = max(0.005 * (1.0 - dot(N, L)), 0.003);
-  return ((PL.z - bias ) > closestDepth) ? 1.0 : 0.0;
+
+  mat2 rotation = mat2(1.0);
+  if (ShadowPcfRotate) {
+    float angle = 2.0 * PI * InterleavedGradientNoise(gl_FragCoord.xy);
+    float c = cos(angle), s = sin(angle);
+    rotation = mat2(c, s, -s, c);
+  }
+
+  float lit = 0.0;
+  for (int i = 0; i < ShadowPcfTaps; i++) {
+    lit += texture(ShadowMap, vec3(PL.xy + rotation * ShadowPcfOffsets[i], PL.z - bias));
+  }
+  COUNT_WORK(float(ShadowPcfTaps));
+  return 1.0 - lit / float(ShadowPcfTaps);
 }
+#endif
 
 void main()
 {
   // Sample G-Buffer
+  COUNT_WORK(1.0);
   vec4 albedoAO = texture(GBuffer_Albedo, Texcoord);
   vec4 emissiveRough = texture(GBuffer_Roughness, Texcoord);
   vec3 N = normalize(texture(GBuffer_Normal, Texcoord).xyz);
@@ -216,8 +289,8 @@ void main()
 
   // Setup surface material
   Material m;
-  m.Albedo = pow(albedoAO.rgb, vec3(GAMMA)); // Gamma to linear
-  m.Emissive = pow(emissiveRough.xyz, vec3(GAMMA));
+  m.Albedo = albedoAO.rgb;
+  m.Emissive = emissiveRough.xyz;
   m.Roughness = emissiveRough.w;
   m.Metalness = metal;
   m.Occlusion = albedoAO.w;
@@ -236,20 +309,26 @@ void main()
 
   // Lighting
   vec3 result = vec3(0.0);
-  result += (1.0 - Vis) * DirectRadiance(P, N, V, m, F0);
+  if (Vis < 1.0) {
+    COUNT_WORK(1.0);
+    result += (1.0 - Vis) * DirectRadiance(P, N, V, m, F0);
+  }
+  COUNT_WORK(1.0);
   result += IBLAmbientRadiance(N, V, m, F0);
   result += m.Emissive * 4.0;
 
-  // Linear back to gamma space via the selected tonemapping operator
+  // Tonemap; the sRGB output target encodes back to gamma space
 #ifdef TONE_MAPPING_REINHARD
   result = result / (result + vec3(1.0));
-  result = pow(result, vec3(1.0/GAMMA));
 #endif
 #ifdef TONE_MAPPING_UNCHARTED2
   result = Uncharted2ToneMapping(Exposure*result);
 #endif
 
   // Shader output
+#ifdef LIGHTING_COMPLEXITY
+  outColor = vec4(Complexity, 0.0, 0.0, 1.0);
+#else
   outColor = vec4(result, 1.0);
-  gl_FragDepth = D;
+#endif
 }
@@ -1,10 +1,41 @@
 #version 130
 
+#if defined(USE_NORMAL_MAP) || defined(USE_HEIGHT_MAP)
+#define USE_TANGENT_FRAME
+#endif
+
+#ifdef VISIBILITY_RESOLVE
+// Material resolve of the visibility buffer: the interpolants are rebuilt from
+// the triangle stored at this pixel instead of coming from the rasterizer
+uniform usampler2D VisibilityMap;
+uniform sampler2D VertexData;
+uniform usampler2D TriangleData;
+uniform mat4 ModelViewProj;
+
+vec3 Normal;
+#ifdef MESH_VERTEX_UV1
+vec2 Texcoord;
+vec2 TexcoordDx;
+vec2 TexcoordDy;
+#endif
+#ifdef USE_TANGENT_FRAME
+vec3 Tangent;
+vec3 Bitangent;
+#endif
+#ifdef USE_HEIGHT_MAP
+vec3 FragModelPos;
+#endif
+
+// neighbouring pixels may belong to other triangles, so gradients are analytic
+#define SAMPLE_MAP(map, uv) textureGrad(map, uv, TexcoordDx, TexcoordDy)
+#define TEXCOORD_DX(uv) TexcoordDx
+#define TEXCOORD_DY(uv) TexcoordDy
+#else
 in vec3 Normal;
 #ifdef MESH_VERTEX_UV1
 in vec2 Texcoord;
 #endif
-#ifdef USE_NORMAL_MAP
+#ifdef USE_TANGENT_FRAME
 in vec3 Tangent;
 in vec3 Bitangent;
 #endif
@@ -12,6 +43,11 @@ in vec3 Bitangent;
 in vec3 FragModelPos;
 #endif
 
+#define SAMPLE_MAP(map, uv) texture(map, uv)
+#define TEXCOORD_DX(uv) dFdx(uv)
+#define TEXCOORD_DY(uv) dFdy(uv)
+#endif // VISIBILITY_RESOLVE
+
 uniform vec3 ViewPos;
 uniform mat4 ModelView;
 uniform vec3 AlbedoBase;
@@ -28,6 +64,8 @@ uniform sampler2D NormalMap;
 #ifdef USE_HEIGHT_MAP
 uniform sampler2D HeightMap;
 uniform float HeightScale;
+uniform vec2 ParallaxLayers; // min, max
+uniform float ParallaxFadeDistance;
 #endif
 #ifdef USE_ROUGHNESS_MAP
 uniform sampler2D RoughnessMap;
@@ -60,41 +98,84 @@ struct SurfaceOut
 #ifdef USE_HEIGHT_MAP
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 {
-  float height = 1.0 - texture(HeightMap, texCoords).r;
+  float height = 1.0 - SAMPLE_MAP(HeightMap, texCoords).r;
   vec2 p = viewDir.xy / viewDir.z * (height * HeightScale);
   return texCoords - p;
 }
 
-// Adapted from https://learnopengl.com/Advanced-Lighting/Parallax-Mapping
-vec2 MultisampleParallaxMapping(vec2 texCoords, vec3 viewDir)
+// parallax fades out between these height map mip levels
+const float kParallaxLodFadeStart = 3.0;
+const float kParallaxLodFadeEnd = 5.0;
+const int kParallaxRefineSteps = 5;
+
+float HeightMapLod(vec2 texCoords)
+{
+  vec2 texels = vec2(textureSize(HeightMap, 0));
+  vec2 dx = TEXCOORD_DX(texCoords) * texels;
+  vec2 dy = TEXCOORD_DY(texCoords) * texels;
+  return max(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0);
+}
+
+float SampleDepth(vec2 texCoords, float lod)
 {
-  const float minLayers = 8.0;
-  const float maxLayers = 32.0;
-  float numLayers = mix(maxLayers, minLayers, max(dot(vec3(0.0, 0.0, 1.0), viewDir), 0.0));
+  return 1.0 - textureLod(HeightMap, texCoords, lod).r;
+}
+
+// Parallax occlusion mapping, adapted from https://learnopengl.com/Advanced-Lighting/Parallax-Mapping
+// The layer count adapts to the view angle and the height map's mip level, the
+// effect fades out with distance and minification, and the hit is found with a
+// binary search instead of a linear interpolation.
+vec2 ParallaxOcclusionMapping(vec2 texCoords, vec3 viewDir, float viewDistance)
+{
+  // derivatives are taken here, before any divergent control flow
+  float lod = HeightMapLod(texCoords);
+  float fade = (1.0 - smoothstep(0.75 * ParallaxFadeDistance, ParallaxFadeDistance, viewDistance))
+             * (1.0 - smoothstep(kParallaxLodFadeStart, kParallaxLodFadeEnd, lod));
+  if (fade <= 0.0)
+    return texCoords;
+
+  // grazing angles need the most layers, each coarser mip halves the texels crossed
+  float numLayers = mix(ParallaxLayers.y, ParallaxLayers.x, max(viewDir.z, 0.0)) * exp2(-0.5 * lod);
+  numLayers = ceil(clamp(mix(ParallaxLayers.x, numLayers, fade), ParallaxLayers.x, ParallaxLayers.y));
 
   float layerDepth = 1.0 / numLayers;
-  float currentLayerDepth = 0.0;
-  vec2 P = viewDir.xy * HeightScale;
+  vec2 P = viewDir.xy * HeightScale * fade;
   vec2 deltaTexCoords = P / numLayers;
 
-  vec2  currentTexCoords     = texCoords;
-  float currentDepthMapValue = 1.0 - texture(HeightMap, currentTexCoords).r;
-  while(currentLayerDepth < currentDepthMapValue)
+  // march on the mip whose texels match the step length, so features thinner
+  // than a step are averaged in rather than stepped over
+  float marchLod = max(lod, log2(max(length(deltaTexCoords * vec2(textureSize(HeightMap, 0))), 1.0)));
+
+  vec2 currentTexCoords = texCoords;
+  float currentLayerDepth = 0.0;
+  float currentDepthMapValue = SampleDepth(currentTexCoords, marchLod);
+  int maxLayers = int(numLayers);
+  for (int i = 0; i < maxLayers && currentLayerDepth < currentDepthMapValue; i++)
   {
-      currentTexCoords -= deltaTexCoords;
-      currentDepthMapValue = 1.0 - texture(HeightMap, currentTexCoords).r;
-      currentLayerDepth += layerDepth;
+    currentTexCoords -= deltaTexCoords;
+    currentLayerDepth += layerDepth;
+    currentDepthMapValue = SampleDepth(currentTexCoords, marchLod);
   }
 
-  vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
-
-  float afterDepth  = currentDepthMapValue - currentLayerDepth;
-  float beforeDepth = 1.0 - texture(HeightMap, prevTexCoords).r - currentLayerDepth + layerDepth;
-
-  float weight = afterDepth / (afterDepth - beforeDepth);
-  vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
+  // binary refinement between the last layer above the surface and the first below
+  vec2 aboveTexCoords = currentTexCoords + deltaTexCoords;
+  vec2 belowTexCoords = currentTexCoords;
+  float aboveDepth = currentLayerDepth - layerDepth;
+  float belowDepth = currentLayerDepth;
+  for (int i = 0; i < kParallaxRefineSteps; i++)
+  {
+    vec2 midTexCoords = 0.5 * (aboveTexCoords + belowTexCoords);
+    float midDepth = 0.5 * (aboveDepth + belowDepth);
+    if (SampleDepth(midTexCoords, lod) > midDepth) {
+      aboveTexCoords = midTexCoords;
+      aboveDepth = midDepth;
+    } else {
+      belowTexCoords = midTexCoords;
+      belowDepth = midDepth;
+    }
+  }
 
-  return finalTexCoords;
+  return 0.5 * (aboveTexCoords + belowTexCoords);
 }
 #endif
 
@@ -104,13 +185,17 @@ void SurfaceShaderTextured(out SurfaceOut surface)
   vec2 texCoord = Texcoord;
 #endif // MESH_VERTEX_UV1
 
-#ifdef USE_HEIGHT_MAP
+#ifdef USE_TANGENT_FRAME
 	mat3 tbn;
 	tbn[0] = Tangent;
 	tbn[1] = Bitangent;
 	tbn[2] = Normal;
+#endif // USE_TANGENT_FRAME
+
+#ifdef USE_HEIGHT_MAP
   vec3 viewDir = normalize(transpose(tbn) * (ViewPos - FragModelPos)); // tangent space view dir
-  texCoord = MultisampleParallaxMapping(texCoord, viewDir);
+  float viewDistance = length((ModelView * vec4(FragModelPos, 1.0)).xyz);
+  texCoord = ParallaxOcclusionMapping(texCoord, viewDir, viewDistance);
   // if (texCoord.x > 1.0 || texCoord.y > 1.0 || texCoord.x < 0.0 || texCoord.y < 0.0) {
   //   discard;
   // }
@@ -118,7 +203,7 @@ void SurfaceShaderTextured(out SurfaceOut surface)
 
 	vec3 normal;
 #ifdef USE_NORMAL_MAP
-	vec3 normalSample = texture(NormalMap, texCoord).xyz * 2.0f - 1.0f;
+	vec3 normalSample = SAMPLE_MAP(NormalMap, texCoord).xyz * 2.0f - 1.0f;
 	normal = tbn * normalSample;
 #else
 	normal = Normal;
@@ -127,33 +212,117 @@ void SurfaceShaderTextured(out SurfaceOut surface)
 
 	surface.Albedo = AlbedoBase;
 #ifdef USE_ALBEDO_MAP
-	surface.Albedo *= texture(AlbedoMap, texCoord).rgb;
+	surface.Albedo *= SAMPLE_MAP(AlbedoMap, texCoord).rgb;
 #endif // USE_ALBEDO_MAP
 
 	surface.Roughness = RoughnessBase;
 #ifdef USE_ROUGHNESS_MAP
-	surface.Roughness *= texture(RoughnessMap, texCoord).r;
+	surface.Roughness *= SAMPLE_MAP(RoughnessMap, texCoord).r;
 #endif // USE_ROUGHNESS_MAP
 
 	surface.Metalness = MetalnessBase;
 #ifdef USE_METALNESS_MAP
-	surface.Metalness *= texture(MetalnessMap, texCoord).r;
+	surface.Metalness *= SAMPLE_MAP(MetalnessMap, texCoord).r;
 #endif // USE_METALNESS_MAP
 
 	surface.Emissive = EmissiveBase;
 #ifdef USE_EMISSIVE_MAP
-	surface.Emissive *= texture(EmissiveMap, texCoord).rgb;
+	surface.Emissive *= SAMPLE_MAP(EmissiveMap, texCoord).rgb;
 #endif // USE_EMISSIVE_MAP
 
 #ifdef USE_AO_MAP
-	surface.Occlusion = texture(AOMap, texCoord).r;
+	surface.Occlusion = SAMPLE_MAP(AOMap, texCoord).r;
 #else
 	surface.Occlusion = 1.0f;
 #endif//  USE_AO_MAP
 }
 
+#ifdef VISIBILITY_RESOLVE
+const uint kTriangleMask = 0xFFFFFFu;
+const int kVertexTexels = 3;
+const int kVerticesPerRow = 4095 / kVertexTexels;
+const int kTrianglesPerRow = 4096;
+
+vec4 FetchVertex(uint index, int texel)
+{
+  int i = int(index);
+  return texelFetch(VertexData, ivec2((i % kVerticesPerRow) * kVertexTexels + texel, i / kVerticesPerRow), 0);
+}
+
+// Perspective-correct barycentrics of the pixel and their change over one
+// pixel in x and y, from the clip space corners of the triangle
+void Barycentrics(vec4 c0, vec4 c1, vec4 c2, vec2 ndc, vec2 pixelNdc, out vec3 lambda, out vec3 lambdaDx, out vec3 lambdaDy)
+{
+  vec3 invW = 1.0 / vec3(c0.w, c1.w, c2.w);
+  vec2 p0 = c0.xy * invW.x;
+  vec2 p1 = c1.xy * invW.y;
+  vec2 p2 = c2.xy * invW.z;
+
+  // screen-space gradients of lambda/w, which are linear across the triangle
+  vec2 e0 = p2 - p1;
+  vec2 e1 = p0 - p1;
+  float invDet = 1.0 / (e0.x * e1.y - e1.x * e0.y);
+  vec3 ddx = vec3(p1.y - p2.y, p2.y - p0.y, p0.y - p1.y) * invDet * invW;
+  vec3 ddy = vec3(p2.x - p1.x, p0.x - p2.x, p1.x - p0.x) * invDet * invW;
+  float ddxSum = dot(ddx, vec3(1.0));
+  float ddySum = dot(ddy, vec3(1.0));
+
+  vec2 delta = ndc - p0;
+  float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+  lambda = (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy) / interpInvW;
+
+  lambdaDx = (lambda * interpInvW + ddx * pixelNdc.x) / (interpInvW + ddxSum * pixelNdc.x) - lambda;
+  lambdaDy = (lambda * interpInvW + ddy * pixelNdc.y) / (interpInvW + ddySum * pixelNdc.y) - lambda;
+}
+
+void ResolveVisibility()
+{
+  uint id = texelFetch(VisibilityMap, ivec2(gl_FragCoord.xy), 0).r;
+  int triangle = int(id & kTriangleMask);
+  uvec3 indices = texelFetch(TriangleData, ivec2(triangle % kTrianglesPerRow, triangle / kTrianglesPerRow), 0).xyz;
+
+  // texels per vertex: (position, u) (normal, v) (tangent)
+  vec4 v0 = FetchVertex(indices.x, 0);
+  vec4 v1 = FetchVertex(indices.y, 0);
+  vec4 v2 = FetchVertex(indices.z, 0);
+  vec4 n0 = FetchVertex(indices.x, 1);
+  vec4 n1 = FetchVertex(indices.y, 1);
+  vec4 n2 = FetchVertex(indices.z, 1);
+
+  vec2 size = vec2(textureSize(VisibilityMap, 0));
+  vec3 lambda, lambdaDx, lambdaDy;
+  Barycentrics(ModelViewProj * vec4(v0.xyz, 1.0), ModelViewProj * vec4(v1.xyz, 1.0), ModelViewProj * vec4(v2.xyz, 1.0)
+    , gl_FragCoord.xy / size * 2.0 - 1.0, 2.0 / size, lambda, lambdaDx, lambdaDy);
+
+  Normal = mat3(n0.xyz, n1.xyz, n2.xyz) * lambda;
+
+#ifdef MESH_VERTEX_UV1
+  mat3x2 uv = mat3x2(v0.w, n0.w, v1.w, n1.w, v2.w, n2.w);
+  Texcoord = uv * lambda;
+  TexcoordDx = uv * lambdaDx;
+  TexcoordDy = uv * lambdaDy;
+#endif
+
+#ifdef USE_TANGENT_FRAME
+  // same per-vertex bitangent as mesh.vert, then interpolated
+  vec4 t0 = FetchVertex(indices.x, 2);
+  vec4 t1 = FetchVertex(indices.y, 2);
+  vec4 t2 = FetchVertex(indices.z, 2);
+  Tangent = mat3(t0.xyz, t1.xyz, t2.xyz) * lambda;
+  Bitangent = mat3(cross(n0.xyz, t0.xyz) * t0.w, cross(n1.xyz, t1.xyz) * t1.w, cross(n2.xyz, t2.xyz) * t2.w) * lambda;
+#endif
+
+#ifdef USE_HEIGHT_MAP
+  FragModelPos = mat3(v0.xyz, v1.xyz, v2.xyz) * lambda;
+#endif
+}
+#endif // VISIBILITY_RESOLVE
+
 void main()
 {
+#ifdef VISIBILITY_RESOLVE
+	ResolveVisibility();
+#endif
 	SurfaceOut surface;
 	SurfaceShaderTextured(surface);
 	AlbedoOut = vec4(surface.Albedo, surface.Occlusion);
@@ -1,11 +1,15 @@
 #version 130
 
+#if defined(USE_NORMAL_MAP) || defined(USE_HEIGHT_MAP)
+#define USE_TANGENT_FRAME
+#endif
+
 in vec3 position;
 in vec3 normal;
 #ifdef MESH_VERTEX_UV1
 in vec2 texcoord;
 #endif
-#ifdef USE_NORMAL_MAP
+#ifdef USE_TANGENT_FRAME
 in vec4 tangent;
 #endif
 
@@ -15,7 +19,7 @@ out vec3 Normal;
 #ifdef MESH_VERTEX_UV1
 out vec2 Texcoord;
 #endif
-#ifdef USE_NORMAL_MAP
+#ifdef USE_TANGENT_FRAME
 out vec3 Tangent;
 out vec3 Bitangent;
 #endif
@@ -31,10 +35,10 @@ void main()
 	Texcoord = texcoord;
 #endif // USE_UV1
 
-#ifdef USE_NORMAL_MAP
+#ifdef USE_TANGENT_FRAME
 	Tangent = tangent.xyz;
 	Bitangent = cross(normal, tangent.xyz)*tangent.w;
-#endif // USE_NORMAL_MAP
+#endif // USE_TANGENT_FRAME
 
 #ifdef USE_HEIGHT_MAP
   FragModelPos = position;
@@ -0,0 +1,9 @@
+#version 130
+
+out vec4 outColor;
+
+void main()
+{
+	// one fragment, accumulated additively into the counter target
+	outColor = vec4(1.0);
+}
@@ -1,24 +1,67 @@
 #version 130
 
+// mirrors PARTICLE_BATCH_MAX in forward.h
+#define PARTICLE_BATCH_MAX 16
+
+// unit quad corner
 in vec3 vert;
+in vec2 texcoord;
+
+// per instance, x the emitter's slot in the per emitter uniforms, y the
+// texture's layer in the particle atlas
+in vec2 batch;
+
+#ifdef ANALYTIC_PARTICLES
+// per instance, the state at spawn; the rest follows from the age
+in vec4 velocity; // xyz initial velocity, w spawn time
+in vec4 rotation; // xyz euler angles, w life time
+
+uniform float Time; // emitter clock
+uniform float Gravity;
+uniform vec4 StartColor;
+uniform vec4 EndColor;
+uniform vec2 ScaleRamp; // start and end scale
+#else
+// per instance
 in vec3 translation;
 in vec3 rotation;
 in vec3 scale;
-in vec2 texcoord;
 in vec4 color;
+#endif
 
-uniform mat4 ModelViewProj;
+// per emitter of the batch
+uniform mat4 ModelViewProj[PARTICLE_BATCH_MAX];
+uniform bool ScreenAligned[PARTICLE_BATCH_MAX];
+uniform mat4 Billboard[PARTICLE_BATCH_MAX]; // camera facing rotation, used instead of the per-particle rotation when screen aligned
 
 out vec2 Texcoord;
+flat out float Slot;
+flat out float Layer;
 out vec4 Color;
 
+vec3 RotateXYZ(vec3 v, vec3 r)
+{
+	vec3 rotatedX = vec3(v.x, v.y*cos(r.x)+v.z*-sin(r.x), v.y*sin(r.x)+v.z*cos(r.x));
+	vec3 rotatedXY = vec3(rotatedX.x*cos(r.y)+rotatedX.z*sin(r.y), rotatedX.y, rotatedX.x*-sin(r.y)+rotatedX.z*cos(r.y));
+	return vec3(rotatedXY.x*cos(r.z)+rotatedXY.y*-sin(r.z), rotatedXY.x*sin(r.z)+rotatedXY.y*cos(r.z), rotatedXY.z);
+}
+
 void main()
 {
+#ifdef ANALYTIC_PARTICLES
+	// particles that died since the emitter last expired them collapse to a point
+	float age = Time - velocity.w;
+	float t = clamp(age / rotation.w, 0.0, 1.0);
+	vec3 translation = velocity.xyz * age + vec3(0.0, 0.5 * Gravity * age * age, 0.0);
+	vec3 scale = vec3(age < rotation.w ? mix(ScaleRamp.x, ScaleRamp.y, t) : 0.0);
+	vec4 color = mix(StartColor, EndColor, t);
+#endif
+	int slot = int(batch.x);
 	vec3 scaled = scale * vert;
-	vec3 rotatedX = vec3(scaled.x, scaled.y*cos(rotation.x)+scaled.z*-sin(rotation.x), scaled.y*sin(rotation.x)+scaled.z*cos(rotation.x));
-	vec3 rotatedXY = vec3(rotatedX.x*cos(rotation.y)+rotatedX.z*sin(rotation.y), rotatedX.y, rotatedX.x*-sin(rotation.y)+rotatedX.z*cos(rotation.y));
-	vec3 rotatedXYZ = vec3(rotatedXY.x*cos(rotation.z)+rotatedXY.y*-sin(rotation.z), rotatedXY.x*sin(rotation.z)+rotatedXY.y*cos(rotation.z), rotatedXY.z);
-	gl_Position = ModelViewProj * vec4(translation + rotatedXYZ, 1.0);
+	vec3 oriented = ScreenAligned[slot] ? mat3(Billboard[slot]) * scaled : RotateXYZ(scaled, rotation.xyz);
+	gl_Position = ModelViewProj[slot] * vec4(translation + oriented, 1.0);
 	Texcoord = texcoord;
+	Slot = batch.x;
+	Layer = batch.y;
 	Color = color;
 }
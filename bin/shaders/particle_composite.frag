@@ -0,0 +1,54 @@
+#version 130
+
+// keeps taps whose depth range holds the pixel from outweighing the rest
+// infinitely
+#define DEPTH_EPSILON 0.01
+
+in vec2 Texcoord;
+
+uniform sampler2D Particles;
+uniform sampler2D DepthRange;
+uniform sampler2D GBuffer_Depth;
+uniform float ZNear;
+uniform float ZFar;
+uniform bool ReverseZ;
+
+out vec4 outColor;
+
+float linearizeDepth(float depth)
+{
+	if (ReverseZ) {
+		return ZNear / max(depth, 1e-7);
+	}
+	return (2.0 * ZFar * ZNear) / (ZFar + ZNear - (ZFar - ZNear) * (2.0 * depth - 1.0 ) );
+}
+
+// Bilateral upsample of the reduced resolution particles. Each of the four
+// bilinear taps is weighted down by how far this pixel's depth falls outside
+// the range of scene depths the tap was drawn against, so particles don't
+// bleed across silhouettes. Particles holds premultiplied color and the
+// transmittance left over the scene in alpha.
+void main()
+{
+	vec2 size = vec2(textureSize(Particles, 0));
+	vec2 texel = Texcoord * size - 0.5;
+	vec2 frac = fract(texel);
+	ivec2 base = ivec2(floor(texel));
+	ivec2 last = ivec2(size) - 1;
+
+	float depth = linearizeDepth(texelFetch(GBuffer_Depth, ivec2(gl_FragCoord.xy), 0).x);
+
+	vec4 sum = vec4(0.0);
+	float weight_sum = 0.0;
+	for (int i = 0; i < 4; i++) {
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tap = clamp(base + offset, ivec2(0), last);
+		vec2 range = texelFetch(DepthRange, tap, 0).xy;
+		vec2 bilinear = mix(1.0 - frac, frac, vec2(offset));
+		float outside = (max(range.x - depth, 0.0) + max(depth - range.y, 0.0)) / depth;
+		float weight = bilinear.x * bilinear.y / (DEPTH_EPSILON + outside) + 1e-5;
+		sum += texelFetch(Particles, tap, 0) * weight;
+		weight_sum += weight;
+	}
+	outColor = sum / weight_sum;
+}
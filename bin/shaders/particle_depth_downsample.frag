@@ -0,0 +1,43 @@
+#version 130
+
+uniform sampler2D GBuffer_Depth;
+uniform int Divisor;
+uniform float ZNear;
+uniform float ZFar;
+uniform bool ReverseZ;
+
+out vec2 outDepthRange;
+
+float linearizeDepth(float depth)
+{
+	if (ReverseZ) {
+		// the sky sits at 0 with an infinite far plane
+		return ZNear / max(depth, 1e-7);
+	}
+	return (2.0 * ZFar * ZNear) / (ZFar + ZNear - (ZFar - ZNear) * (2.0 * depth - 1.0 ) );
+}
+
+// One texel per Divisor x Divisor block of the scene depth. The depth target
+// keeps the block's farthest depth so particles in front of any of it are
+// drawn; the nearest and farthest linear depths guide the upsample.
+void main()
+{
+	ivec2 base = ivec2(gl_FragCoord.xy) * Divisor;
+	ivec2 last = textureSize(GBuffer_Depth, 0) - 1;
+	float nearest = ReverseZ ? 0.0 : 1.0;
+	float farthest = ReverseZ ? 1.0 : 0.0;
+	for (int y = 0; y < Divisor; y++) {
+		for (int x = 0; x < Divisor; x++) {
+			float depth = texelFetch(GBuffer_Depth, min(base + ivec2(x, y), last), 0).x;
+			if (ReverseZ) {
+				nearest = max(nearest, depth);
+				farthest = min(farthest, depth);
+			} else {
+				nearest = min(nearest, depth);
+				farthest = max(farthest, depth);
+			}
+		}
+	}
+	gl_FragDepth = farthest;
+	outDepthRange = vec2(linearizeDepth(nearest), linearizeDepth(farthest));
+}
@@ -4,8 +4,33 @@ in vec2 Texcoord;
 in vec4 Color;
 
 out vec4 outColor;
+#ifdef WEIGHTED_OIT
+out float outRevealage;
+#endif
+
+#ifdef WEIGHTED_OIT
+// Depth weight of McGuire and Bavoil's weighted blended OIT, falling off
+// with the view depth 1/gl_FragCoord.w. outColor sums the weighted
+// premultiplied color and the weights, outRevealage multiplies alpha into
+// the remaining transmittance.
+float oitWeight(float alpha)
+{
+	float z = 1.0 / gl_FragCoord.w;
+	return alpha * clamp(0.03 / (1e-5 + pow(z / 200.0, 4.0)), 1e-2, 3e3);
+}
+
+void writeOit(vec4 color)
+{
+	outColor = vec4(color.rgb * color.a, color.a) * oitWeight(color.a);
+	outRevealage = color.a;
+}
+#endif
 
 void main()
 {
+#ifdef WEIGHTED_OIT
+	writeOit(Color);
+#else
 	outColor = Color;
+#endif
 }
@@ -0,0 +1,20 @@
+#version 130
+
+uniform sampler2D Accum;
+uniform sampler2D Revealage;
+
+out vec4 outColor;
+
+// Weighted average color of the transparent fragments, with the transmittance
+// they left in alpha, blended over the output as
+// color * (1 - transmittance) + output * transmittance
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float revealage = texelFetch(Revealage, pixel, 0).r;
+	if (revealage >= 1.0) {
+		discard;
+	}
+	vec4 accum = texelFetch(Accum, pixel, 0);
+	outColor = vec4(accum.rgb / clamp(accum.a, 1e-4, 5e4), revealage);
+}
@@ -0,0 +1,80 @@
+#version 150
+
+// One point per particle, captured by transform feedback after the geometry
+// shader drops the dead ones. Attributes mirror GpuParticle.
+
+#define PI 3.14159265359
+#define GRAVITY -9.81
+
+#ifdef PARTICLE_SPAWN
+in uint seed;
+
+uniform uint SpawnSeed; // changes every step
+uniform float Speed;
+uniform float SpeedVariance;
+uniform float LifeTime;
+uniform float LifeTimeVariance;
+#else
+in vec3 position;
+in vec3 rotation;
+in vec3 velocity;
+in float ttl;
+in float life;
+
+uniform float DeltaTime;
+uniform bool Gravity;
+#endif
+
+out vec3 VertPosition;
+out vec3 VertRotation;
+out vec3 VertVelocity;
+out float VertTtl;
+out float VertLife;
+
+#ifdef PARTICLE_SPAWN
+uint Hash(uint x)
+{
+	x ^= x >> 16u;
+	x *= 0x7feb352du;
+	x ^= x >> 15u;
+	x *= 0x846ca68bu;
+	x ^= x >> 16u;
+	return x;
+}
+
+// [-1, 1]
+float Random11(inout uint state)
+{
+	state = Hash(state);
+	return float(state) / 4294967295.0 * 2.0 - 1.0;
+}
+#endif
+
+void main()
+{
+#ifdef PARTICLE_SPAWN
+	uint state = seed ^ Hash(SpawnSeed + uint(gl_VertexID));
+
+	// same distribution as random_direction in particles.cpp
+	float theta = PI * Random11(state);
+	float phi = acos(Random11(state));
+	vec3 direction = vec3(cos(theta)*sin(phi), sin(theta)*sin(phi), -cos(phi));
+
+	float lifeTime = LifeTime + Random11(state) * LifeTimeVariance;
+	VertPosition = vec3(0.0);
+	VertRotation = direction;
+	VertVelocity = direction * (Speed + Random11(state) * SpeedVariance);
+	VertTtl = lifeTime;
+	VertLife = lifeTime;
+#else
+	vec3 v = velocity;
+	if (Gravity) {
+		v.y += GRAVITY * DeltaTime;
+	}
+	VertPosition = position + v * DeltaTime;
+	VertRotation = rotation;
+	VertVelocity = v;
+	VertTtl = ttl - DeltaTime;
+	VertLife = life;
+#endif
+}
@@ -1,37 +1,87 @@
 #version 130
 
 in vec2 Texcoord;
+flat in float Layer;
 in vec4 Color;
 
-uniform sampler2D Texture;
+uniform sampler2DArray Texture; // the particle atlas
+#ifdef SORTED_LIST
+// mirrors PARTICLE_BATCH_MAX in forward.h
+#define PARTICLE_BATCH_MAX 16
+#define SOFT_PARTICLES
+
+// the list mixes emitters, so shading is picked per slot; slot 0 holds
+// the light icon, sampled from its own array
+flat in float Slot;
+uniform sampler2DArray Icon;
+uniform bool Textured[PARTICLE_BATCH_MAX];
+uniform bool Soft[PARTICLE_BATCH_MAX];
+#endif
 #ifdef SOFT_PARTICLES
 uniform sampler2D GBuffer_Depth;
+uniform float ZNear;
+uniform float ZFar;
+uniform bool ReverseZ;
 #endif
 
-const float ZNear = 0.1;
-const float ZFar = 100.0;
-
 out vec4 outColor;
+#ifdef WEIGHTED_OIT
+out float outRevealage;
+#endif
 
 float saturate(float x)
 {
 	return max(0, min(1, x));
 }
 
+#ifdef WEIGHTED_OIT
+// same weighting as particle_flat.frag
+float oitWeight(float alpha)
+{
+	float z = 1.0 / gl_FragCoord.w;
+	return alpha * clamp(0.03 / (1e-5 + pow(z / 200.0, 4.0)), 1e-2, 3e3);
+}
+
+void writeOit(vec4 color)
+{
+	outColor = vec4(color.rgb * color.a, color.a) * oitWeight(color.a);
+	outRevealage = color.a;
+}
+#endif
+
+#ifdef SOFT_PARTICLES
 float linearizeDepth(float depth)
 {
+	if (ReverseZ) {
+		return ZNear / depth;
+	}
 	return (2.0 * ZFar * ZNear) / (ZFar + ZNear - (ZFar - ZNear) * (2.0 * depth - 1.0 ) );
 }
+#endif
 
 void main()
 {
-	vec4 final = texture(Texture, Texcoord) * Color;
+	#ifdef SORTED_LIST
+	int slot = int(Slot);
+	vec4 icon = texture(Icon, vec3(Texcoord, 0.0));
+	vec4 texel = texture(Texture, vec3(Texcoord, Layer));
+	vec4 final = (slot == 0 ? icon : Textured[slot] ? texel : vec4(1.0)) * Color;
+	#else
+	vec4 final = texture(Texture, vec3(Texcoord, Layer)) * Color;
+	#endif
 	#ifdef SOFT_PARTICLES
-	vec2 screenUV = vec2(gl_FragCoord.x / 1024.0, gl_FragCoord.y / 640.0);
+	vec2 screenUV = gl_FragCoord.xy / vec2(textureSize(GBuffer_Depth, 0));
 	float particleDepth = linearizeDepth(gl_FragCoord.z);
 	float sceneDepth = linearizeDepth(texture(GBuffer_Depth, screenUV).x);
 	float softScale = saturate(sceneDepth - particleDepth);
+	#ifdef SORTED_LIST
+	softScale = Soft[slot] ? softScale : 1.0;
+	#endif
 	final.a *= softScale;
 	#endif
+	#ifdef WEIGHTED_OIT
+	writeOit(final);
+	#else
 	outColor = final;
+	#endif
 }
@@ -3,14 +3,29 @@
 in vec2 Texcoord;
 
 uniform sampler2D RenderMap;
-uniform sampler2D DepthMap;
 #ifdef DEBUG_RENDER_LINEARIZE
 uniform float ZNear;
 uniform float ZFar;
+uniform bool ReverseZ;
+#endif
+#ifdef DEBUG_RENDER_HEATMAP
+uniform float HeatmapMax;
 #endif
 
 out vec4 outColor;
 
+#ifdef DEBUG_RENDER_HEATMAP
+// Black -> blue -> green -> yellow -> red, white once past the max
+vec3 Heatmap(float t)
+{
+	const vec3 ramp[5] = vec3[5](vec3(0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0));
+	if (t > 1.0) return vec3(1.0);
+	float x = t * 4.0;
+	int i = min(int(x), 3);
+	return mix(ramp[i], ramp[i + 1], x - float(i));
+}
+#endif
+
 void main()
 {
 	vec3 color = texture(RenderMap, Texcoord).xyz;
@@ -18,10 +33,17 @@ void main()
 	color = color*0.5f + 0.5f;
 #endif
 #ifdef DEBUG_RENDER_LINEARIZE
-	vec3 ndc = color*2.0f - 1.0f;
-	color = 2.0 * ZNear / (ZFar + ZNear - ndc * (ZFar - ZNear));
+	if (ReverseZ) {
+		// depth = ZNear / viewZ with an infinite far plane
+		color = ZNear / (color * ZFar);
+	} else {
+		vec3 ndc = color*2.0f - 1.0f;
+		color = 2.0 * ZNear / (ZFar + ZNear - ndc * (ZFar - ZNear));
+	}
+#endif
+#ifdef DEBUG_RENDER_HEATMAP
+	color = Heatmap(color.r / HeatmapMax);
 #endif
 
 	outColor = vec4(color, 1.0f);
-	gl_FragDepth = texture(DepthMap, Texcoord).x;
 }
@@ -0,0 +1,42 @@
+#version 130
+
+in vec2 Texcoord;
+
+uniform sampler2D SourceMap;
+uniform vec2 BlurStep;
+uniform int BlurRadius;
+#ifdef EVSM_FROM_DEPTH
+uniform vec2 EvsmExponents;
+#endif
+
+out vec4 outColor;
+
+#ifdef EVSM_FROM_DEPTH
+// Warp depth into positive and negative exponential moments
+vec4 Moments(vec2 uv)
+{
+	float depth = 2.0 * texture(SourceMap, uv).x - 1.0;
+	float pos = exp(EvsmExponents.x * depth);
+	float neg = -exp(-EvsmExponents.y * depth);
+	return vec4(pos, pos * pos, neg, neg * neg);
+}
+#else
+vec4 Moments(vec2 uv)
+{
+	return texture(SourceMap, uv);
+}
+#endif
+
+// One axis of a separable gaussian, moments blur linearly
+void main()
+{
+	float sigma = max(float(BlurRadius) * 0.5, 0.5);
+	vec4 sum = vec4(0.0);
+	float weights = 0.0;
+	for (int i = -BlurRadius; i <= BlurRadius; i++) {
+		float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+		sum += w * Moments(Texcoord + float(i) * BlurStep);
+		weights += w;
+	}
+	outColor = sum / weights;
+}
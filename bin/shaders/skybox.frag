@@ -1,7 +1,5 @@
 #version 130
 
-#define GAMMA 2.2
-
 in vec3 TexDir;
 
 uniform samplerCube SkyboxCube;
@@ -23,12 +21,11 @@ vec3 Uncharted2ToneMapping(vec3 color)
   color = ((color * (A * color + C * B) + D * E) / (color * (A * color + B) + D * F)) - E / F;
   float white = ((W * (A * W + C * B) + D * E) / (W * (A * W + B) + D * F)) - E / F;
   color /= white;
-  color = pow(color, vec3(1. / GAMMA));
   return color;
 }
 
 void main()
 {
-  vec3 color = pow(textureLod(SkyboxCube, TexDir, Lod).xyz, vec3(GAMMA));
+  vec3 color = textureLod(SkyboxCube, TexDir, Lod).xyz;
   outColor = vec4(Uncharted2ToneMapping(color), 1);
 }
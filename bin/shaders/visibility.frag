@@ -0,0 +1,12 @@
+#version 150
+
+// Visibility buffer id pass: no material work, only which triangle of which
+// instance covers the pixel. Layout matches VISIBILITY_TRIANGLE_BITS.
+uniform uint InstanceId;
+
+out uint VisibilityOut;
+
+void main()
+{
+	VisibilityOut = (InstanceId << 24u) | uint(gl_PrimitiveID);
+}
@@ -0,0 +1,10 @@
+#version 150
+
+in vec3 position;
+
+uniform mat4 ModelViewProj;
+
+void main()
+{
+	gl_Position = ModelViewProj * vec4(position, 1.0);
+}
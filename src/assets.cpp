@@ -209,7 +209,9 @@ MaterialDesc gMaterials[] = {
     .metalness_base = 1.0f,
     .roughness_base = 1.0f,
     .emissive_base = { 0.0f, 0.0f, 0.0f },
-    .height_map_scale = 0.1f
+    .height_map_scale = 0.1f,
+    .parallax_max_layers = 16,
+    .parallax_fade_distance = 25.0f
   },
   {
     .name = "Harsh Brick",
@@ -223,7 +225,9 @@ MaterialDesc gMaterials[] = {
     .metalness_base = 1.0f,
     .roughness_base = 1.0f,
     .emissive_base = { 0.0f, 0.0f, 0.0f },
-    .height_map_scale = 0.1f
+    .height_map_scale = 0.1f,
+    .parallax_max_layers = 16,
+    .parallax_fade_distance = 25.0f
   },
   {
     .name = "Wrinkled Paper",
@@ -268,6 +272,7 @@ ParticleEmitterTextureDesc gParticleTextures[] = {
   { .name = "UV Debug", .path = "uv_map.png" }
 };
 const int gParticleTexturesCount = STATIC_ELEMENT_COUNT(gParticleTextures);
+GLuint gParticleAtlas;
 
 ParticleEmitterDesc gEmitterDescs[] = {
   {
@@ -315,6 +320,7 @@ ParticleEmitterDesc gEmitterDescs[] = {
     .start_scale = 2.0f, .end_scale = 4.5f,
     .depth_sort_alpha_blend = 1,
     .soft = 0,
+    .resolution = PARTICLE_RESOLUTION_HALF,
     .simulate_gravity = 0,
     .emit_cone_axis = { Axis_Up[0], Axis_Up[1], Axis_Up[2] }
   }
@@ -324,12 +330,22 @@ const int gEmitterDescsCount = STATIC_ELEMENT_COUNT(gEmitterDescs);
 static int initialize_emitters(LoadingCallback update_loading_cb) {
   for (int i = 0; i < gParticleTexturesCount; i++) {
     update_loading_cb("Initializing particle", gParticleTextures[i].name, i, gParticleTexturesCount);
-    gParticleTextures[i].texture = utility_load_texture(GL_TEXTURE_2D, gParticleTextures[i].path);
+    gParticleTextures[i].texture = utility_load_texture(GL_TEXTURE_2D, gParticleTextures[i].path, 0);
+  }
+
+  // the textures stay loaded for the emitter editor
+  GLuint textures[STATIC_ELEMENT_COUNT(gParticleTextures)];
+  for (int i = 0; i < gParticleTexturesCount; i++) {
+    textures[i] = gParticleTextures[i].texture;
   }
+  gParticleAtlas = utility_build_texture_array(textures, gParticleTexturesCount, PARTICLE_ATLAS_SIZE);
 
+  // colors are authored in sRGB, the particle shaders blend in linear
   for (int i = 0; i < gEmitterDescsCount; i++) {
     int idx = (i < gParticleTexturesCount) ? i : 0;
     gEmitterDescs[i].texture = gParticleTextures[idx].texture;
+    vec3_srgb_to_linear(gEmitterDescs[i].start_color, gEmitterDescs[i].start_color);
+    vec3_srgb_to_linear(gEmitterDescs[i].end_color, gEmitterDescs[i].end_color);
   }
   return 0;
 }
@@ -15,8 +15,10 @@ extern const int gMaterialsCount;
 extern ParticleEmitterTextureDesc gParticleTextures[];
 extern const int gParticleTexturesCount;
 
+// gParticleTextures packed into one texture array, a layer per texture
+extern GLuint gParticleAtlas;
+
 extern ParticleEmitterDesc gEmitterDescs[];
 extern const int gEmitterDescsCount;
 
-typedef void(*LoadingCallback)(const char* stage, const char* asset, int index, int total);
 int initialize_assets(LoadingCallback update_loading_cb);
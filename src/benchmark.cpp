@@ -0,0 +1,416 @@
+#include "benchmark.h"
+#include "jobs.h"
+
+// frames rendered before sampling, covers query latency and the profiler average
+#define BENCHMARK_WARMUP_FRAMES 60
+
+// frames sampled per config
+#define BENCHMARK_SAMPLE_FRAMES 120
+
+#define BENCHMARK_PARTICLE_COUNT 100000
+#define BENCHMARK_PARTICLE_STEPS 120
+#define BENCHMARK_PARTICLE_DT (1/60.0f)
+#define BENCHMARK_SPAWN_REPEATS 10
+
+// records sorted per timing, divided by the count to get the repetitions
+#define BENCHMARK_SORT_RECORDS 2000000
+
+#define BENCHMARK_EMITTERS 64
+#define BENCHMARK_EMITTER_PARTICLES 16384
+#define BENCHMARK_EMITTER_STEPS 60
+
+// the recursive quicksort goes n deep on ordered input, past this it's skipped
+#define BENCHMARK_QUICKSORT_ORDERED_MAX 10000
+
+typedef struct
+{
+  const char* name;
+  ShadowTechnique technique;
+  ShadowPcfKernel pcf_kernel;
+  int pcf_taps;
+  float pcf_radius;
+  int evsm_blur_radius;
+} ShadowBenchmarkConfig;
+
+static const ShadowBenchmarkConfig sShadowConfigs[] = {
+  { "PCF 1 tap",                SHADOW_TECHNIQUE_PCF,  SHADOW_PCF_KERNEL_POISSON,      1,  0.0f, 0 },
+  { "PCF 4 tap Poisson",        SHADOW_TECHNIQUE_PCF,  SHADOW_PCF_KERNEL_POISSON,      4,  1.5f, 0 },
+  { "PCF 9 tap Rotated Grid",   SHADOW_TECHNIQUE_PCF,  SHADOW_PCF_KERNEL_ROTATED_GRID, 9,  3.0f, 0 },
+  { "PCF 16 tap Poisson",       SHADOW_TECHNIQUE_PCF,  SHADOW_PCF_KERNEL_POISSON,      16, 4.0f, 0 },
+  { "PCF 16 tap Rotated Grid",  SHADOW_TECHNIQUE_PCF,  SHADOW_PCF_KERNEL_ROTATED_GRID, 16, 4.0f, 0 },
+  { "EVSM blur radius 1",       SHADOW_TECHNIQUE_EVSM, SHADOW_PCF_KERNEL_POISSON,      1,  0.0f, 1 },
+  { "EVSM blur radius 3",       SHADOW_TECHNIQUE_EVSM, SHADOW_PCF_KERNEL_POISSON,      1,  0.0f, 3 },
+  { "EVSM blur radius 8",       SHADOW_TECHNIQUE_EVSM, SHADOW_PCF_KERNEL_POISSON,      1,  0.0f, 8 },
+};
+
+static void apply_shadow_config(Renderer* r, const ShadowBenchmarkConfig* config) {
+  ShadowMap* sm = &r->shadow_map;
+  sm->technique = config->technique;
+  sm->pcf_kernel = config->pcf_kernel;
+  sm->pcf_taps = config->pcf_taps;
+  sm->pcf_radius = config->pcf_radius;
+  sm->evsm_blur_radius = config->evsm_blur_radius;
+}
+
+void benchmark_shadows_begin(Benchmark* b, Renderer* r) {
+  memset(b, 0, sizeof(Benchmark));
+  if (!profiler_has_timer_query()) {
+    printf("Benchmark -- timer queries unavailable, GPU timings will read 0\n");
+  }
+  printf("%-26s %10s %12s %10s\n", "Shadow config", "Shadow ms", "Lighting ms", "Total ms");
+  apply_shadow_config(r, &sShadowConfigs[0]);
+}
+
+int benchmark_shadows_update(Benchmark* b, Renderer* r) {
+  const int config_count = STATIC_ELEMENT_COUNT(sShadowConfigs);
+  if (b->config >= config_count)
+    return 1;
+
+  if (b->frame++ < BENCHMARK_WARMUP_FRAMES)
+    return 0;
+
+  b->shadow_ms += profiler_get_stats(PROFILER_PASS_SHADOW)->gpu_ms;
+  b->lighting_ms += profiler_get_stats(PROFILER_PASS_LIGHTING)->gpu_ms;
+  if (b->frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_SAMPLE_FRAMES)
+    return 0;
+
+  const float shadow_ms = b->shadow_ms / BENCHMARK_SAMPLE_FRAMES;
+  const float lighting_ms = b->lighting_ms / BENCHMARK_SAMPLE_FRAMES;
+  printf("%-26s %10.3f %12.3f %10.3f\n", sShadowConfigs[b->config].name, shadow_ms, lighting_ms, shadow_ms + lighting_ms);
+
+  // advance to the next config
+  b->config++;
+  b->frame = 0;
+  b->shadow_ms = b->lighting_ms = 0.0f;
+  if (b->config >= config_count)
+    return 1;
+  apply_shadow_config(r, &sShadowConfigs[b->config]);
+  return 0;
+}
+
+// Particle layout and update used before ParticleStreams, kept as the baseline
+typedef struct
+{
+  vec3 pos;
+  vec3 rot;
+  vec3 scale;
+  vec3 velocity;
+  float ttl;
+  vec4 color;
+  vec4 delta_color;
+  vec3 delta_scale;
+} AosParticle;
+
+static void aos_particle_update(AosParticle* part, float dt, int simulate_gravity) {
+  if (simulate_gravity) {
+    part->velocity[1] += -9.81f * dt;
+  }
+
+  vec3 deltaPos;
+  vec3_scale(deltaPos, part->velocity, dt);
+  vec3_add(part->pos, part->pos, deltaPos);
+  part->ttl -= dt;
+
+  float min_dt = fminf(part->ttl, dt);
+
+  vec4 dt_color;
+  vec4_scale(dt_color, part->delta_color, min_dt);
+  vec4_add(part->color, part->color, dt_color);
+
+  vec3 dt_scale;
+  vec3_scale(dt_scale, part->delta_scale, min_dt);
+  vec3_add(part->scale, part->scale, dt_scale);
+}
+
+static int aos_particles_update(AosParticle* parts, int count, float dt, int simulate_gravity) {
+  for (int i = 0; i < count; i++) {
+    aos_particle_update(&parts[i], dt, simulate_gravity);
+  }
+  for (int i = 0; i < count; i++) {
+    if (parts[i].ttl <= 0.0f) {
+      parts[i] = parts[--count];
+    }
+  }
+  return count;
+}
+
+// Per particle spawn used before particle_emitter_emit, kept as the baseline
+static void scalar_emit_one(ParticleEmitter* emitter) {
+  const ParticleEmitterDesc* desc = emitter->desc;
+  if (emitter->count >= emitter->budget_max)
+    return;
+  ParticleStreams* s = &emitter->streams;
+  int i = emitter->count++;
+
+  float ttl = desc->life_time + utility_random_real11() * desc->life_time_variance;
+  s->ttl[i] = ttl;
+  s->scale[i] = desc->start_scale;
+  s->delta_scale[i] = (desc->end_scale - desc->start_scale) / ttl;
+
+  float theta = (float)M_PI * utility_random_real11();
+  float phi = acosf(utility_random_real11());
+  vec3 dir = { cosf(theta)*sinf(phi), sinf(theta)*sinf(phi), -cosf(phi) };
+  s->rx[i] = dir[0];
+  s->ry[i] = dir[1];
+  s->rz[i] = dir[2];
+  float speed = desc->speed + utility_random_real11() * desc->speed_variance;
+  s->vx[i] = dir[0] * speed;
+  s->vy[i] = dir[1] * speed;
+  s->vz[i] = dir[2] * speed;
+  s->px[i] = s->py[i] = s->pz[i] = 0.0f;
+
+  s->r[i] = desc->start_color[0];
+  s->g[i] = desc->start_color[1];
+  s->b[i] = desc->start_color[2];
+  s->a[i] = desc->start_color[3];
+  s->dr[i] = (desc->end_color[0] - desc->start_color[0]) / ttl;
+  s->dg[i] = (desc->end_color[1] - desc->start_color[1]) / ttl;
+  s->db[i] = (desc->end_color[2] - desc->start_color[2]) / ttl;
+  s->da[i] = (desc->end_color[3] - desc->start_color[3]) / ttl;
+}
+
+static float ms_since(Uint64 start) {
+  return (float)((double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+}
+
+void benchmark_particles() {
+  ParticleEmitterDesc desc;
+  memset(&desc, 0, sizeof(ParticleEmitterDesc));
+  desc.max = BENCHMARK_PARTICLE_COUNT;
+  vec4_dup(desc.start_color, Yellow);
+  vec4_dup(desc.end_color, Red);
+  desc.speed = 5.0f;
+  desc.speed_variance = 2.0f;
+  desc.life_time = 2.0f;
+  desc.life_time_variance = 1.5f; // roughly half die during the run
+  desc.start_scale = 1.0f;
+  desc.end_scale = 0.1f;
+  desc.simulate_gravity = 1;
+
+  ParticleEmitter emitter;
+  if (particle_emitter_initialize(&emitter, &desc)) {
+    printf("Benchmark -- unable to allocate %i particles\n", BENCHMARK_PARTICLE_COUNT);
+    return;
+  }
+  emitter.muted = 1;
+  particle_emitter_burst(&emitter, BENCHMARK_PARTICLE_COUNT);
+
+  // the baseline starts from the same particles
+  AosParticle* aos = (AosParticle*)calloc(BENCHMARK_PARTICLE_COUNT, sizeof(AosParticle));
+  const ParticleStreams* s = &emitter.streams;
+  for (int i = 0; i < emitter.count; i++) {
+    AosParticle* part = &aos[i];
+    vec3_set(part->pos, s->px[i], s->py[i], s->pz[i]);
+    vec3_set(part->rot, s->rx[i], s->ry[i], s->rz[i]);
+    vec3_swizzle(part->scale, s->scale[i]);
+    vec3_swizzle(part->delta_scale, s->delta_scale[i]);
+    vec3_set(part->velocity, s->vx[i], s->vy[i], s->vz[i]);
+    part->ttl = s->ttl[i];
+    vec4_set(part->color, s->r[i], s->g[i], s->b[i], s->a[i]);
+    vec4_set(part->delta_color, s->dr[i], s->dg[i], s->db[i], s->da[i]);
+  }
+
+  int aos_count = emitter.count;
+  double aos_processed = 0.0;
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (int step = 0; step < BENCHMARK_PARTICLE_STEPS; step++) {
+    aos_processed += aos_count;
+    aos_count = aos_particles_update(aos, aos_count, BENCHMARK_PARTICLE_DT, desc.simulate_gravity);
+  }
+  const float aos_ms = ms_since(start);
+
+  double soa_processed = 0.0;
+  start = SDL_GetPerformanceCounter();
+  for (int step = 0; step < BENCHMARK_PARTICLE_STEPS; step++) {
+    soa_processed += emitter.count;
+    particle_emitter_update(&emitter, BENCHMARK_PARTICLE_DT);
+  }
+  const float soa_ms = ms_since(start);
+
+  printf("Particle update -- %i particles, %i steps\n", BENCHMARK_PARTICLE_COUNT, BENCHMARK_PARTICLE_STEPS);
+  printf("%-26s %10s %12s %10s\n", "Layout", "ms/step", "ns/particle", "Alive");
+  printf("%-26s %10.3f %12.3f %10i\n", "AoS scalar", aos_ms / BENCHMARK_PARTICLE_STEPS, aos_ms * 1e6 / aos_processed, aos_count);
+  printf("%-26s %10.3f %12.3f %10i\n", "SoA SIMD", soa_ms / BENCHMARK_PARTICLE_STEPS, soa_ms * 1e6 / soa_processed, emitter.count);
+  printf("Speedup: %.2fx\n", soa_ms > 0.0f ? aos_ms / soa_ms : 0.0f);
+
+  // refill the emitter in bursts the size the GUI allows
+  const int burst = 1000;
+  float scalar_ms = 0.0f, bulk_ms = 0.0f;
+  for (int rep = 0; rep < BENCHMARK_SPAWN_REPEATS; rep++) {
+    emitter.count = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCHMARK_PARTICLE_COUNT; i += burst) {
+      for (int k = 0; k < burst; k++) {
+        scalar_emit_one(&emitter);
+      }
+    }
+    scalar_ms += ms_since(start);
+
+    emitter.count = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCHMARK_PARTICLE_COUNT; i += burst) {
+      particle_emitter_emit(&emitter, burst);
+    }
+    bulk_ms += ms_since(start);
+  }
+
+  const double spawned = (double)BENCHMARK_PARTICLE_COUNT * BENCHMARK_SPAWN_REPEATS;
+  printf("Particle spawn -- %i particles in bursts of %i, %i times\n", BENCHMARK_PARTICLE_COUNT, burst, BENCHMARK_SPAWN_REPEATS);
+  printf("%-26s %10s %12s\n", "Spawn", "ms/burst", "ns/particle");
+  printf("%-26s %10.4f %12.3f\n", "Scalar", scalar_ms * burst / spawned, scalar_ms * 1e6 / spawned);
+  printf("%-26s %10.4f %12.3f\n", "Bulk SIMD", bulk_ms * burst / spawned, bulk_ms * 1e6 / spawned);
+  printf("Speedup: %.2fx\n", bulk_ms > 0.0f ? scalar_ms / bulk_ms : 0.0f);
+
+  free(aos);
+  particle_emitter_destroy(&emitter);
+}
+
+// Sort used before the radix sort, kept as the baseline
+static int partition(SortRecord* recs, int low, int high) {
+  SortRecord pivot = recs[high];
+  int i = low - 1;
+  for (int j = low; j <= high - 1; j++) {
+    if (recs[j].depth <= pivot.depth) {
+      i++;
+
+      SortRecord tmp = recs[i];
+      recs[i] = recs[j];
+      recs[j] = tmp;
+    }
+  }
+  recs[high] = recs[i + 1];
+  recs[i + 1] = pivot;
+  return i + 1;
+}
+
+static void quicksort(SortRecord* recs, int low, int high) {
+  if (low < high) {
+    int pi = partition(recs, low, high);
+    quicksort(recs, low, pi - 1);
+    quicksort(recs, pi + 1, high);
+  }
+}
+
+typedef enum
+{
+  SORT_QUICKSORT,
+  SORT_RADIX,
+  SORT_ADAPTIVE,
+} SortAlgorithm;
+
+// average ms to sort a copy of input, the copy is part of the timing
+static float time_sort(SortAlgorithm algorithm, const SortRecord* input, SortRecord* recs, SortRecord* scratch, int count) {
+  const int reps = std::max(BENCHMARK_SORT_RECORDS / count, 1);
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (int rep = 0; rep < reps; rep++) {
+    memcpy(recs, input, count * sizeof(SortRecord));
+    switch (algorithm) {
+      case SORT_QUICKSORT: quicksort(recs, 0, count - 1); break;
+      case SORT_RADIX: particle_sort_radix(recs, scratch, count); break;
+      case SORT_ADAPTIVE: particle_sort_adaptive(recs, scratch, count); break;
+    }
+  }
+  return ms_since(start) / reps;
+}
+
+void benchmark_particle_sort() {
+  static const int counts[] = { 1000, 10000, 100000 };
+  const int counts_count = STATIC_ELEMENT_COUNT(counts);
+  const int max_count = counts[counts_count - 1];
+  SortRecord* random = (SortRecord*)malloc(max_count * sizeof(SortRecord));
+  SortRecord* coherent = (SortRecord*)malloc(max_count * sizeof(SortRecord));
+  SortRecord* recs = (SortRecord*)malloc(max_count * sizeof(SortRecord));
+  SortRecord* scratch = (SortRecord*)malloc(max_count * sizeof(SortRecord));
+
+  printf("Particle sort -- ms per sort\n");
+  printf("%-10s %-10s %10s %10s %10s\n", "Count", "Order", "Quicksort", "Radix", "Adaptive");
+  for (int c = 0; c < counts_count; c++) {
+    const int count = counts[c];
+
+    // squared distances of particles within 20 units
+    for (int i = 0; i < count; i++) {
+      float d = 20.0f * utility_random_real01();
+      random[i].depth = d * d;
+      random[i].index = i;
+    }
+
+    // last frame's sorted order after a small camera move
+    memcpy(recs, random, count * sizeof(SortRecord));
+    const SortRecord* sorted = particle_sort_radix(recs, scratch, count);
+    for (int i = 0; i < count; i++) {
+      coherent[i].depth = sorted[i].depth * (1.0f + 0.001f * utility_random_real11());
+      coherent[i].index = sorted[i].index;
+    }
+
+    const SortRecord* inputs[] = { random, coherent };
+    const char* input_names[] = { "Random", "Coherent" };
+    for (int o = 0; o < 2; o++) {
+      printf("%-10i %-10s", count, input_names[o]);
+      if (o == 1 && count > BENCHMARK_QUICKSORT_ORDERED_MAX) {
+        printf(" %10s", "skipped");
+      } else {
+        printf(" %10.4f", time_sort(SORT_QUICKSORT, inputs[o], recs, scratch, count));
+      }
+      printf(" %10.4f", time_sort(SORT_RADIX, inputs[o], recs, scratch, count));
+      printf(" %10.4f\n", time_sort(SORT_ADAPTIVE, inputs[o], recs, scratch, count));
+    }
+  }
+
+  free(random);
+  free(coherent);
+  free(recs);
+  free(scratch);
+}
+
+void benchmark_emitters() {
+  ParticleEmitterDesc desc;
+  memset(&desc, 0, sizeof(ParticleEmitterDesc));
+  desc.max = BENCHMARK_EMITTER_PARTICLES;
+  vec4_dup(desc.start_color, Yellow);
+  vec4_dup(desc.end_color, Red);
+  desc.speed = 5.0f;
+  desc.life_time = 1000.0f; // nothing dies, every step does the same work
+  desc.start_scale = 1.0f;
+  desc.end_scale = 0.1f;
+  desc.simulate_gravity = 1;
+
+  Scene* scene = (Scene*)calloc(1, sizeof(Scene));
+  ParticleEmitter* emitters = (ParticleEmitter*)calloc(BENCHMARK_EMITTERS, sizeof(ParticleEmitter));
+  for (int i = 0; i < BENCHMARK_EMITTERS; i++) {
+    if (particle_emitter_initialize(&emitters[i], &desc)) {
+      printf("Benchmark -- unable to allocate emitter %i\n", i);
+      return;
+    }
+    emitters[i].muted = 1;
+    particle_emitter_burst(&emitters[i], BENCHMARK_EMITTER_PARTICLES);
+    scene->emitters[i] = &emitters[i];
+  }
+
+  const int max_threads = jobs_thread_count();
+  printf("Emitter update -- %i emitters of %i particles, %i steps\n", BENCHMARK_EMITTERS, BENCHMARK_EMITTER_PARTICLES, BENCHMARK_EMITTER_STEPS);
+  printf("%-10s %10s %10s\n", "Threads", "ms/step", "Speedup");
+  float single_ms = 0.0f;
+  for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+    jobs_set_thread_count(threads);
+    scene_update(scene, BENCHMARK_PARTICLE_DT); // warm up
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int step = 0; step < BENCHMARK_EMITTER_STEPS; step++) {
+      scene_update(scene, BENCHMARK_PARTICLE_DT);
+    }
+    const float ms = ms_since(start) / BENCHMARK_EMITTER_STEPS;
+    if (threads == 1) {
+      single_ms = ms;
+    }
+    printf("%-10i %10.3f %9.2fx\n", threads, ms, ms > 0.0f ? single_ms / ms : 0.0f);
+    if (threads == max_threads)
+      break;
+  }
+  jobs_set_thread_count(max_threads);
+
+  for (int i = 0; i < BENCHMARK_EMITTERS; i++) {
+    particle_emitter_destroy(&emitters[i]);
+  }
+  free(emitters);
+  free(scene);
+}
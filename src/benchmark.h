@@ -0,0 +1,32 @@
+#pragma once
+#include "common.h"
+#include "renderer.h"
+#include "scene.h"
+
+// Cycles the renderer through a fixed list of settings, letting each one run
+// for a number of frames before printing its averaged per-pass GPU timings.
+typedef struct
+{
+  int config;
+  int frame;
+  float shadow_ms;
+  float lighting_ms;
+} Benchmark;
+
+void benchmark_shadows_begin(Benchmark* b, Renderer* r);
+
+// call once per rendered frame, returns non-zero once every config was measured
+int benchmark_shadows_update(Benchmark* b, Renderer* r);
+
+// Times the old array-of-structs particle update against the SoA streams
+// kernel over the same particles, then per particle against bulk spawning,
+// and prints both. Needs no GL context.
+void benchmark_particles();
+
+// Times the old quicksort, the radix sort and the adaptive insertion sort on
+// random and frame-coherent depths for a few particle counts. Needs no GL context.
+void benchmark_particle_sort();
+
+// Times scene_update on busy emitters with 1, 2, 4... job threads and
+// prints the scaling. Needs no GL context.
+void benchmark_emitters();
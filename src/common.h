@@ -69,6 +69,14 @@ static inline float vec3_angle(vec3 a, vec3 b) {
   float cosAngle = vec3_mul_inner(a, b);
   return acosf(cosAngle);
 }
+// exact sRGB transfer function, matches the hardware decode of sRGB textures
+static inline float srgb_to_linear(float c) {
+  return (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+static inline void vec3_srgb_to_linear(vec3 r, vec3 const v) {
+  for(int i=0; i<3; ++i)
+    r[i] = srgb_to_linear(v[i]);
+}
 static inline void vec3_print(vec3 const v) {
   printf("<%f, %f, %f>\n", v[0], v[1], v[2]);
 }
@@ -247,6 +255,14 @@ static inline void mat4x4_inf_perspective(mat4x4 m, float y_fov, float aspect, f
   m[3][3] = 0.f;
 }
 
+// Infinite far plane with reversed depth: the near plane maps to 1 and infinity to 0.
+// Expects a [0, 1] clip space depth range, see glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE)
+static inline void mat4x4_inf_reverse_perspective(mat4x4 m, float y_fov, float aspect, float n) {
+  mat4x4_inf_perspective(m, y_fov, aspect, n);
+  m[2][2] = 0.f;
+  m[3][2] = n;
+}
+
 typedef vec3 mat3x3[3];
 static inline void mat3x3_identity(mat3x3 M) {
   int i, j;
@@ -370,6 +386,7 @@ extern const quat Quat_Identity;
 
 #define ENUM_ORD_VALUE(V, S) V,
 #define ENUM_STR_VALUE(V, S) S,
+#define ENUM_COUNT_VALUE(V, S) +1
 #define DECLARE_ENUM(name, strTable, values) 										\
   typedef enum {																								\
     values(ENUM_ORD_VALUE)																			\
@@ -1,4 +1,5 @@
 #include "debug_lines.h"
+#include "profiler.h"
 
 #define DEBUG_LINES_MAX 1024
 
@@ -18,13 +19,19 @@ struct LineShader {
 static DebugLine sDebugLines[DEBUG_LINES_MAX];
 static int sDebugLinesCount;
 static LineShader sLineShader;
+static ProgramRequest sLineShaderReq;
 
 int debug_lines_initialize() {
   sDebugLinesCount = 0;
-  if(!(sLineShader.program = utility_create_program("shaders/line.vert", "shaders/line.frag"))) {
-    return 1;
-  }
-  if (utility_link_program(sLineShader.program)) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/line.vert";
+  desc.frag_filename = "shaders/line.frag";
+  return utility_request_program(&sLineShaderReq, &desc);
+}
+
+int debug_lines_finish() {
+  if (!(sLineShader.program = utility_finish_program(&sLineShaderReq))) {
     return 1;
   }
   GL_WRAP(sLineShader.pos_loc = glGetAttribLocation(sLineShader.program, "position"));
@@ -132,6 +139,7 @@ void debug_lines_render(const Scene *s) {
     }
     glEnd()
   );
+  profiler_count_draw(GL_LINES, sDebugLinesCount * 2);
 
   GL_WRAP(glEnable(GL_DEPTH_TEST));
   GL_WRAP(glDepthMask(GL_TRUE));
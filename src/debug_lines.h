@@ -10,6 +10,9 @@ void debug_lines_submit(float start_x, float start_y, float start_z
   , float end_x, float end_y, float end_z
   , const vec3 rgb);
 
+// Issues the line shader build, which joins the next utility_wait_programs;
+// debug_lines_finish then resolves it
 int debug_lines_initialize();
+int debug_lines_finish();
 void debug_lines_clear();
 void debug_lines_render(const Scene *s);
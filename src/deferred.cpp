@@ -1,26 +1,36 @@
 #include "deferred.h"
+#include "profiler.h"
+#include "visibility.h"
 
 DEFINE_ENUM(RenderMode, render_mode_strings, ENUM_RenderMode);
 DEFINE_ENUM(SkyboxMode, skybox_mode_strings, ENUM_SkyboxMode);
 DEFINE_ENUM(TonemappingOperator, tonemapping_op_strings, ENUM_TonemappingOperator);
+DEFINE_ENUM(SurfaceFeature, surface_feature_defines, ENUM_SurfaceFeature);
+DEFINE_ENUM(LightingFeature, lighting_feature_defines, ENUM_LightingFeature);
+DEFINE_ENUM(DebugFeature, debug_feature_defines, ENUM_DebugFeature);
+
+static const char* const sMeshAttribs[] = { "position", "normal", "tangent", "texcoord" };
+static const char* const sQuadAttribs[] = { "position", "texcoord" };
+static const char* const sGBufferOutputs[] = { "AlbedoOut", "NormalOut", "RoughnessOut", "MetalnessOut" };
+static const char* const sVisibilityOutputs[] = { "VisibilityOut" };
+
+static int request_surface_shader(ProgramRequest* req, const char** defines, int defines_count) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/mesh.vert";
+  desc.frag_filename = "shaders/mesh.frag";
+  desc.defines = defines;
+  desc.defines_count = defines_count;
+  desc.attribs = sMeshAttribs;
+  desc.attribs_count = STATIC_ELEMENT_COUNT(sMeshAttribs);
+  desc.frag_outputs = sGBufferOutputs;
+  desc.frag_outputs_count = STATIC_ELEMENT_COUNT(sGBufferOutputs);
+  return utility_request_program(req, &desc);
+}
 
-static int load_surface_shader(SurfaceShader* shader, const char** defines, int defines_count) {
-  if(!(shader->program = utility_create_program_defines("shaders/mesh.vert", "shaders/mesh.frag",
-                                 defines, defines_count))) {
-    return 1;
-  }
-  GL_WRAP(glBindFragDataLocation(shader->program, 0, "AlbedoOut"));
-  GL_WRAP(glBindFragDataLocation(shader->program, 1, "NormalOut"));
-  GL_WRAP(glBindFragDataLocation(shader->program, 2, "RoughnessOut"));
-  GL_WRAP(glBindFragDataLocation(shader->program, 3, "MetalnessOut"));
-  GL_WRAP(glBindAttribLocation(shader->program, 0, "position"));
-  GL_WRAP(glBindAttribLocation(shader->program, 1, "normal"));
-  GL_WRAP(glBindAttribLocation(shader->program, 2, "tangent"));
-  GL_WRAP(glBindAttribLocation(shader->program, 3, "texcoord"));
-  if (utility_link_program(shader->program)) {
-    return 1;
-  }
-
+static void resolve_surface_shader(void* out_shader, GLuint program) {
+  SurfaceShader* shader = (SurfaceShader*)out_shader;
+  shader->program = program;
   GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
   GL_WRAP(shader->normal_loc = glGetAttribLocation(shader->program, "normal"));
   GL_WRAP(shader->tangent_loc = glGetAttribLocation(shader->program, "tangent"));
@@ -36,22 +46,56 @@ static int load_surface_shader(SurfaceShader* shader, const char** defines, int
   GL_WRAP(shader->normal_map_loc = glGetUniformLocation(shader->program, "NormalMap"));
   GL_WRAP(shader->height_map_loc = glGetUniformLocation(shader->program, "HeightMap"));
   GL_WRAP(shader->height_scale_loc = glGetUniformLocation(shader->program, "HeightScale"));
+  GL_WRAP(shader->parallax_layers_loc = glGetUniformLocation(shader->program, "ParallaxLayers"));
+  GL_WRAP(shader->parallax_fade_distance_loc = glGetUniformLocation(shader->program, "ParallaxFadeDistance"));
   GL_WRAP(shader->metalness_map_loc = glGetUniformLocation(shader->program, "MetalnessMap"));
   GL_WRAP(shader->roughness_map_loc = glGetUniformLocation(shader->program, "RoughnessMap"));
   GL_WRAP(shader->ao_map_loc = glGetUniformLocation(shader->program, "AOMap"));
   GL_WRAP(shader->emissive_map_loc = glGetUniformLocation(shader->program, "EmissiveMap"));
-  return 0;
 }
 
-static int load_lighting_shader(LightingShader* shader, const char* tonemapping_define) {
-  char buf[512];
-  sprintf(buf, "#define %s\n", tonemapping_define);
-  const char* defines[] = { &buf[0] };
-  if(!(shader->program = utility_create_program_defines("shaders/passthrough.vert", "shaders/lighting.frag",
-            defines, 1))) {
-    printf("Unable to load shader\n");
-    return 1;
-  }
+static int request_material_resolve_shader(ProgramRequest* req, const char** defines, int defines_count) {
+  const char* resolve_defines[PERMUTATION_FEATURES_MAX + 1];
+  memcpy(resolve_defines, defines, defines_count * sizeof(const char*));
+  resolve_defines[defines_count] = "#define VISIBILITY_RESOLVE\n";
+
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/passthrough.vert";
+  desc.frag_filename = "shaders/mesh.frag";
+  desc.defines = resolve_defines;
+  desc.defines_count = defines_count + 1;
+  desc.attribs = sQuadAttribs;
+  desc.attribs_count = STATIC_ELEMENT_COUNT(sQuadAttribs);
+  desc.frag_outputs = sGBufferOutputs;
+  desc.frag_outputs_count = STATIC_ELEMENT_COUNT(sGBufferOutputs);
+  return utility_request_program(req, &desc);
+}
+
+static void resolve_material_resolve_shader(void* out_shader, GLuint program) {
+  MaterialResolveShader* shader = (MaterialResolveShader*)out_shader;
+  // the quad's position + texcoord take the place of the mesh attributes
+  resolve_surface_shader(&shader->surface, program);
+  GL_WRAP(shader->visibility_map_loc = glGetUniformLocation(program, "VisibilityMap"));
+  GL_WRAP(shader->vertex_data_loc = glGetUniformLocation(program, "VertexData"));
+  GL_WRAP(shader->triangle_data_loc = glGetUniformLocation(program, "TriangleData"));
+}
+
+static int request_lighting_shader(ProgramRequest* req, const char** defines, int defines_count) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/passthrough.vert";
+  desc.frag_filename = "shaders/lighting.frag";
+  desc.defines = defines;
+  desc.defines_count = defines_count;
+  desc.attribs = sQuadAttribs;
+  desc.attribs_count = STATIC_ELEMENT_COUNT(sQuadAttribs);
+  return utility_request_program(req, &desc);
+}
+
+static void resolve_lighting_shader(void* out_shader, GLuint program) {
+  LightingShader* shader = (LightingShader*)out_shader;
+  shader->program = program;
   GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
   GL_WRAP(shader->texcoord_loc = glGetAttribLocation(shader->program, "texcoord"));
   GL_WRAP(shader->ambient_term_loc = glGetUniformLocation(shader->program, "AmbientTerm"));
@@ -69,121 +113,268 @@ static int load_lighting_shader(LightingShader* shader, const char* tonemapping_
   GL_WRAP(shader->env_prefilter_map_loc = glGetUniformLocation(shader->program, "EnvPrefilterMap"));
   GL_WRAP(shader->env_brdf_lut_loc = glGetUniformLocation(shader->program, "EnvBrdfLUT"));
   GL_WRAP(shader->shadow_map_loc = glGetUniformLocation(shader->program, "ShadowMap"));
+  GL_WRAP(shader->shadow_pcf_offsets_loc = glGetUniformLocation(shader->program, "ShadowPcfOffsets"));
+  GL_WRAP(shader->shadow_pcf_taps_loc = glGetUniformLocation(shader->program, "ShadowPcfTaps"));
+  GL_WRAP(shader->shadow_pcf_rotate_loc = glGetUniformLocation(shader->program, "ShadowPcfRotate"));
+  GL_WRAP(shader->evsm_exponents_loc = glGetUniformLocation(shader->program, "EvsmExponents"));
+  GL_WRAP(shader->evsm_light_bleed_reduction_loc = glGetUniformLocation(shader->program, "EvsmLightBleedReduction"));
+  GL_WRAP(shader->evsm_variance_bias_loc = glGetUniformLocation(shader->program, "EvsmVarianceBias"));
   GL_WRAP(shader->inv_view_loc = glGetUniformLocation(shader->program, "InvView"));
   GL_WRAP(shader->inv_proj_loc = glGetUniformLocation(shader->program, "InvProjection"));
   GL_WRAP(shader->light_space_loc = glGetUniformLocation(shader->program, "LightSpace"));
   GL_WRAP(shader->exposure_loc = glGetUniformLocation(shader->program, "Exposure"));
   GL_WRAP(shader->ao_strength_loc = glGetUniformLocation(shader->program, "AOStrength"));
+  GL_WRAP(shader->reverse_z_loc = glGetUniformLocation(shader->program, "ReverseZ"));
+}
 
-  return 0;
+static int request_debug_shader(ProgramRequest* req, const char** defines, int defines_count) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/passthrough.vert";
+  desc.frag_filename = "shaders/passthrough.frag";
+  desc.defines = defines;
+  desc.defines_count = defines_count;
+  desc.attribs = sQuadAttribs;
+  desc.attribs_count = STATIC_ELEMENT_COUNT(sQuadAttribs);
+  return utility_request_program(req, &desc);
 }
 
-static int load_debug_shader(DebugShader* shader, const char** defines, int defines_count) {
-  if (!(shader->program = utility_create_program_defines("shaders/passthrough.vert", "shaders/passthrough.frag"
-        , defines, defines_count))) {
-    return 1;
-  }
+static void resolve_debug_shader(void* out_shader, GLuint program) {
+  DebugShader* shader = (DebugShader*)out_shader;
+  shader->program = program;
   GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
   GL_WRAP(shader->texcoord_loc = glGetAttribLocation(shader->program, "texcoord"));
   GL_WRAP(shader->gbuffer_render_loc = glGetUniformLocation(shader->program, "RenderMap"));
-  GL_WRAP(shader->gbuffer_depth_loc = glGetUniformLocation(shader->program, "DepthMap"));
   GL_WRAP(shader->z_near_loc = glGetUniformLocation(shader->program, "ZNear"));
   GL_WRAP(shader->z_far_loc = glGetUniformLocation(shader->program, "ZFar"));
+  GL_WRAP(shader->heatmap_max_loc = glGetUniformLocation(shader->program, "HeatmapMax"));
+  GL_WRAP(shader->reverse_z_loc = glGetUniformLocation(shader->program, "ReverseZ"));
+}
+
+static int request_overdraw_shader(ProgramRequest* req) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/mesh.vert";
+  desc.frag_filename = "shaders/overdraw.frag";
+  desc.attribs = sMeshAttribs;
+  desc.attribs_count = 1;
+  return utility_request_program(req, &desc);
+}
+
+static int resolve_overdraw_shader(OverdrawShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
+    return 1;
+  }
+  GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
+  GL_WRAP(shader->model_view_proj_loc = glGetUniformLocation(shader->program, "ModelViewProj"));
+  return 0;
+}
+
+static int request_visibility_shader(ProgramRequest* req) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/visibility.vert";
+  desc.frag_filename = "shaders/visibility.frag";
+  desc.attribs = sMeshAttribs;
+  desc.attribs_count = 1;
+  desc.frag_outputs = sVisibilityOutputs;
+  desc.frag_outputs_count = STATIC_ELEMENT_COUNT(sVisibilityOutputs);
+  return utility_request_program(req, &desc);
+}
+
+static int resolve_visibility_shader(VisibilityShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
+    return 1;
+  }
+  GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
+  GL_WRAP(shader->model_view_proj_loc = glGetUniformLocation(shader->program, "ModelViewProj"));
+  GL_WRAP(shader->instance_id_loc = glGetUniformLocation(shader->program, "InstanceId"));
+  return 0;
+}
+
+static int request_skybox_shader(ProgramRequest* req) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/skybox.vert";
+  desc.frag_filename = "shaders/skybox.frag";
+  desc.attribs = sQuadAttribs;
+  desc.attribs_count = 1;
+  return utility_request_program(req, &desc);
+}
+
+static int resolve_skybox_shader(SkyboxShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
+    return 1;
+  }
+  GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
+  GL_WRAP(shader->texcoord_loc = glGetAttribLocation(shader->program, "texcoord"));
+  GL_WRAP(shader->env_map_loc = glGetUniformLocation(shader->program, "SkyboxCube"));
+  GL_WRAP(shader->lod_loc = glGetUniformLocation(shader->program, "Lod"));
+  GL_WRAP(shader->inv_vp_loc = glGetUniformLocation(shader->program, "InvViewProj"));
   return 0;
 }
 
-int deferred_initialize(Deferred* d) {
+int deferred_initialize(Deferred* d, LoadingCallback update_loading_cb) {
   memset(d, 0, sizeof(Deferred));
   d->render_mode = RENDER_MODE_SHADED;
   d->skybox_mode = SKYBOX_MODE_ENV_MAP;
   d->prefilter_lod = 0.0f;
   d->tonemapping_op = TONEMAPPING_OP_UNCHARTED2;
   d->ao_strength = 1.0f;
-
-  // Initialize default material
-  if (material_initialize_default(&d->default_mat)) {
-    printf("Unable to load default material\n");
-    return 1;
-  }
+  d->heatmap_max = 8.0f;
+  d->has_visibility_buffer = GLEW_VERSION_3_2;
 
   // initialize the BRDF look-up table
-  if (!(d->brdf_lut_tex = utility_load_texture(GL_TEXTURE_2D, "./environments/ibl_brdf_lut.png"))) {
+  if (!(d->brdf_lut_tex = utility_load_texture(GL_TEXTURE_2D, "./environments/ibl_brdf_lut.png", TEXTURE_FLAG_LINEAR))) {
     printf("Unable to load ibl_brdf_lut.png\n");
     return 1;
   }
 
-  // Initialize the skybox shader
-  if (!(d->skybox_shader.program = utility_create_program("shaders/skybox.vert", "shaders/skybox.frag"))) {
+  // Issue every program build up front so the driver can compile them in
+  // parallel, then wait on the whole batch once
+  ProgramRequest skybox_req, overdraw_req;
+  if (request_skybox_shader(&skybox_req) || request_overdraw_shader(&overdraw_req)) {
     printf("Unable to load shader\n");
+    utility_cancel_program(&skybox_req);
     return 1;
   }
-  GL_WRAP(glBindAttribLocation(d->skybox_shader.program, 0, "position" ));
-  GL_WRAP(glBindAttribLocation(d->skybox_shader.program, 0, "texcoord" ));
-  if (utility_link_program(d->skybox_shader.program)) {
-    printf( "Unable to load shader\n" );
-    return 1;
+
+  ProgramRequest visibility_req;
+  if (d->has_visibility_buffer && request_visibility_shader(&visibility_req)) {
+    printf("Unable to load visibility shader, the visibility buffer is disabled\n");
+    d->has_visibility_buffer = 0;
+  }
+
+  // Shader permutations; the variants every scene needs are built up front
+  permutation_cache_initialize(&d->surface_shaders, "surface", surface_feature_defines, surface_feature_defines_count
+    , sizeof(SurfaceShader), &request_surface_shader, &resolve_surface_shader);
+  permutation_cache_initialize(&d->lighting_shaders, "lighting", lighting_feature_defines, lighting_feature_defines_count
+    , sizeof(LightingShader), &request_lighting_shader, &resolve_lighting_shader);
+  permutation_cache_initialize(&d->debug_shaders, "debug", debug_feature_defines, debug_feature_defines_count
+    , sizeof(DebugShader), &request_debug_shader, &resolve_debug_shader);
+  permutation_cache_initialize(&d->material_resolve_shaders, "material resolve", surface_feature_defines, surface_feature_defines_count
+    , sizeof(MaterialResolveShader), &request_material_resolve_shader, &resolve_material_resolve_shader);
+
+  const uint32_t uv_surface_key = PERMUTATION_BIT(SURFACE_FEATURE_UV) | PERMUTATION_BIT(SURFACE_FEATURE_ALBEDO_MAP)
+    | PERMUTATION_BIT(SURFACE_FEATURE_NORMAL_MAP) | PERMUTATION_BIT(SURFACE_FEATURE_HEIGHT_MAP)
+    | PERMUTATION_BIT(SURFACE_FEATURE_ROUGHNESS_MAP) | PERMUTATION_BIT(SURFACE_FEATURE_METALNESS_MAP)
+    | PERMUTATION_BIT(SURFACE_FEATURE_AO_MAP) | PERMUTATION_BIT(SURFACE_FEATURE_EMISSIVE_MAP);
+  permutation_cache_prefetch(&d->surface_shaders, 0);
+  permutation_cache_prefetch(&d->surface_shaders, uv_surface_key);
+  if (d->has_visibility_buffer) {
+    permutation_cache_prefetch(&d->material_resolve_shaders, 0);
+    permutation_cache_prefetch(&d->material_resolve_shaders, uv_surface_key);
   }
-  GL_WRAP(d->skybox_shader.pos_loc = glGetAttribLocation(d->skybox_shader.program, "position"));
-  GL_WRAP(d->skybox_shader.texcoord_loc = glGetAttribLocation(d->skybox_shader.program, "texcoord"));
-  GL_WRAP(d->skybox_shader.env_map_loc = glGetUniformLocation(d->skybox_shader.program, "SkyboxCube"));
-  GL_WRAP(d->skybox_shader.lod_loc = glGetUniformLocation(d->skybox_shader.program, "Lod"));
-  GL_WRAP(d->skybox_shader.inv_vp_loc = glGetUniformLocation(d->skybox_shader.program, "InvViewProj"));
-
-  // Initialize box shader
-  const char* uv_surf_shader_defines[] ={
-    "#define MESH_VERTEX_UV1\n",
-    "#define USE_NORMAL_MAP\n",
-    "#define USE_HEIGHT_MAP\n",
-    "#define USE_ALBEDO_MAP\n",
-    "#define USE_ROUGHNESS_MAP\n",
-    "#define USE_METALNESS_MAP\n",
-    "#define USE_AO_MAP\n",
-    "#define USE_EMISSIVE_MAP\n",
+
+  const uint32_t tonemap_keys[] = {
+    PERMUTATION_BIT(LIGHTING_FEATURE_TONEMAP_REINHARD),
+    PERMUTATION_BIT(LIGHTING_FEATURE_TONEMAP_UNCHARTED2),
+    PERMUTATION_BIT(LIGHTING_FEATURE_COMPLEXITY)
   };
-  if(load_surface_shader(&d->surf_shader[0], uv_surf_shader_defines, STATIC_ELEMENT_COUNT(uv_surf_shader_defines))
-      || load_surface_shader(&d->surf_shader[1], NULL, 0)) {
-    printf("Unable to load shader\n");
-    return 1;
+  for (unsigned i = 0; i < STATIC_ELEMENT_COUNT(tonemap_keys); i++) {
+    permutation_cache_prefetch(&d->lighting_shaders, tonemap_keys[i]);
+    permutation_cache_prefetch(&d->lighting_shaders, tonemap_keys[i] | PERMUTATION_BIT(LIGHTING_FEATURE_SHADOW_EVSM));
   }
 
-  if(load_lighting_shader(&d->lighting_shader[0], "TONE_MAPPING_REINHARD")
-      || load_lighting_shader(&d->lighting_shader[1], "TONE_MAPPING_UNCHARTED2")) {
+  const uint32_t debug_keys[] = {
+    0,
+    PERMUTATION_BIT(DEBUG_FEATURE_NORMALIZE),
+    PERMUTATION_BIT(DEBUG_FEATURE_LINEARIZE),
+    PERMUTATION_BIT(DEBUG_FEATURE_HEATMAP)
+  };
+  for (unsigned i = 0; i < STATIC_ELEMENT_COUNT(debug_keys); i++) {
+    permutation_cache_prefetch(&d->debug_shaders, debug_keys[i]);
+  }
+
+  utility_wait_programs("Initializing renderer...", update_loading_cb);
+
+  if (resolve_skybox_shader(&d->skybox_shader, &skybox_req)
+      || resolve_overdraw_shader(&d->overdraw_shader, &overdraw_req)
+      || permutation_cache_finish(&d->surface_shaders)
+      || permutation_cache_finish(&d->lighting_shaders)
+      || permutation_cache_finish(&d->debug_shaders)) {
     printf("Unable to load shader\n");
+    utility_cancel_program(&skybox_req);
+    utility_cancel_program(&overdraw_req);
+    utility_cancel_program(&visibility_req);
     return 1;
   }
 
-  if(gbuffer_initialize(&d->g_buffer, VIEWPORT_WIDTH, VIEWPORT_HEIGHT)) {
-    printf("Unable to create g-buffer.\n");
-    return 1;
+  if (d->has_visibility_buffer
+      && (resolve_visibility_shader(&d->visibility_shader, &visibility_req)
+        || permutation_cache_finish(&d->material_resolve_shaders))) {
+    printf("Unable to load visibility shader, the visibility buffer is disabled\n");
+    d->has_visibility_buffer = 0;
   }
 
-  // Initialize passthrough
-  const char* debug_ndc_defines[] ={
-    "#define DEBUG_RENDER_NORMALIZE\n"
-  };
-  const char* debug_linearize_defines[] ={
-    "#define DEBUG_RENDER_LINEARIZE\n"
-  };
-  if(load_debug_shader(&d->debug_shader[0], NULL, 0)
-     || load_debug_shader(&d->debug_shader[1], debug_ndc_defines, STATIC_ELEMENT_COUNT(debug_ndc_defines))
-     || load_debug_shader(&d->debug_shader[2], debug_linearize_defines, STATIC_ELEMENT_COUNT(debug_linearize_defines))) {
-    printf("Unable to load debug shader\n");
+  if(gbuffer_initialize(&d->g_buffer, VIEWPORT_WIDTH, VIEWPORT_HEIGHT)) {
+    printf("Unable to create g-buffer.\n");
     return 1;
   }
 
   return 0;
 }
 
-static void render_geometry(const Model* model, Deferred* d, const Scene *s) {
-  if (!model->mesh->vertices)
+static void model_matrix(mat4x4 m, const Model* model) {
+  mat4x4_identity(m);
+  mat4x4_rotate_Z(m, m, DEG_TO_RAD(model->rot[2]));
+  mat4x4_rotate_Y(m, m, DEG_TO_RAD(model->rot[1]));
+  mat4x4_rotate_X(m, m, DEG_TO_RAD(model->rot[0]));
+  float scale = model->scale * model->mesh->base_scale;
+  mat4x4_scale_aniso(m, m, scale, scale, scale);
+  vec3_add(m[3], m[3], model->position);
+  mat4x4_translate_in_place(m, -model->mesh->bounds.center[0], -model->mesh->bounds.center[1], -model->mesh->bounds.center[2]);
+}
+
+// Picks the leanest surface permutation: maps the material doesn't have, or
+// the mesh can't address, are left out and cost no texture fetches
+static uint32_t surface_key(const Model* model) {
+  const Material* mat = &model->material;
+  const Mesh* mesh = model->mesh;
+  if (!mesh->texcoords)
+    return 0;
+
+  uint32_t key = PERMUTATION_BIT(SURFACE_FEATURE_UV);
+  if (mat->albedo_map) key |= PERMUTATION_BIT(SURFACE_FEATURE_ALBEDO_MAP);
+  if (mat->normal_map && mesh->tangents) key |= PERMUTATION_BIT(SURFACE_FEATURE_NORMAL_MAP);
+  if (mat->height_map && mesh->tangents && mat->height_map_scale > 0.0f) key |= PERMUTATION_BIT(SURFACE_FEATURE_HEIGHT_MAP);
+  if (mat->roughness_map) key |= PERMUTATION_BIT(SURFACE_FEATURE_ROUGHNESS_MAP);
+  if (mat->metalness_map) key |= PERMUTATION_BIT(SURFACE_FEATURE_METALNESS_MAP);
+  if (mat->ao_map) key |= PERMUTATION_BIT(SURFACE_FEATURE_AO_MAP);
+  if (mat->emissive_map) key |= PERMUTATION_BIT(SURFACE_FEATURE_EMISSIVE_MAP);
+  return key;
+}
+
+static uint32_t lighting_key(const Deferred* d, const ShadowMap* sm, int complexity) {
+  uint32_t key = 0;
+  if (complexity) {
+    key |= PERMUTATION_BIT(LIGHTING_FEATURE_COMPLEXITY);
+  } else if (d->tonemapping_op == TONEMAPPING_OP_REINHARD) {
+    key |= PERMUTATION_BIT(LIGHTING_FEATURE_TONEMAP_REINHARD);
+  } else {
+    key |= PERMUTATION_BIT(LIGHTING_FEATURE_TONEMAP_UNCHARTED2);
+  }
+  if (sm->technique == SHADOW_TECHNIQUE_EVSM) {
+    key |= PERMUTATION_BIT(LIGHTING_FEATURE_SHADOW_EVSM);
+  }
+  return key;
+}
+
+static void bind_surface_map(uint32_t key, SurfaceFeature feature, GLuint map, GLint loc, int unit) {
+  if (!(key & PERMUTATION_BIT(feature)))
     return;
+  GL_WRAP(glActiveTexture(GL_TEXTURE0 + unit));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, map));
+  GL_WRAP(glUniform1i(loc, unit));
+}
 
-  int shader_idx = (model->mesh->texcoords) ? 0:1;
-  const SurfaceShader* shader = &d->surf_shader[shader_idx];
+static void bind_surface(const SurfaceShader* shader, uint32_t key, const Model* model, const Scene *s) {
   GL_WRAP(glUseProgram(shader->program));
 
-  // bind albedo base color
-  GL_WRAP(glUniform3fv(shader->albedo_base_loc, 1, model->material.albedo_base));
+  // bind albedo base color, picked in sRGB and shaded in linear space
+  vec3 albedo_base;
+  vec3_srgb_to_linear(albedo_base, model->material.albedo_base);
+  GL_WRAP(glUniform3fv(shader->albedo_base_loc, 1, albedo_base));
 
   // bind metalness base color
   GL_WRAP(glUniform1f(shader->metalness_base_loc, model->material.metalness_base));
@@ -192,81 +383,23 @@ static void render_geometry(const Model* model, Deferred* d, const Scene *s) {
   GL_WRAP(glUniform1f(shader->roughness_base_loc, model->material.roughness_base));
 
   // bind emissive base color
-  GL_WRAP(glUniform3fv(shader->emissive_base_loc, 1, model->material.emissive_base));
-
-  // bind albedo map
-  GL_WRAP(glActiveTexture(GL_TEXTURE0));
-  if (model->material.albedo_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.albedo_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.albedo_map));
-  }
-  GL_WRAP(glUniform1i(shader->albedo_map_loc, 0));
-
-  // bind normal map
-  GL_WRAP(glActiveTexture(GL_TEXTURE1));
-  if (model->material.normal_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.normal_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.normal_map));
-  }
-  GL_WRAP(glUniform1i(shader->normal_map_loc, 1));
-
-  // bind height map
-  GL_WRAP(glActiveTexture(GL_TEXTURE2));
-  if (model->material.height_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.height_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.height_map));
-  }
-  GL_WRAP(glUniform1i(shader->height_map_loc, 2));
-
-  // bind metalness map
-  GL_WRAP(glActiveTexture(GL_TEXTURE3));
-  if (model->material.metalness_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.metalness_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.metalness_map));
-  }
-  GL_WRAP(glUniform1i(shader->metalness_map_loc, 3));
-
-  // bind roughness map
-  GL_WRAP(glActiveTexture(GL_TEXTURE4));
-  if (model->material.roughness_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.roughness_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.roughness_map));
-  }
-  GL_WRAP(glUniform1i(shader->roughness_map_loc, 4));
-
-  // bind ao map
-  GL_WRAP(glActiveTexture(GL_TEXTURE5));
-  if (model->material.ao_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.ao_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.ao_map));
-  }
-  GL_WRAP(glUniform1i(shader->ao_map_loc, 5));
-
-  // bind emissive map
-  GL_WRAP(glActiveTexture(GL_TEXTURE6));
-  if (model->material.emissive_map) {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, model->material.emissive_map));
-  } else {
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->default_mat.emissive_map));
-  }
-  GL_WRAP(glUniform1i(shader->emissive_map_loc, 6));
+  vec3 emissive_base;
+  vec3_srgb_to_linear(emissive_base, model->material.emissive_base);
+  GL_WRAP(glUniform3fv(shader->emissive_base_loc, 1, emissive_base));
+
+  // bind only the maps sampled by this permutation
+  const Material* mat = &model->material;
+  bind_surface_map(key, SURFACE_FEATURE_ALBEDO_MAP, mat->albedo_map, shader->albedo_map_loc, 0);
+  bind_surface_map(key, SURFACE_FEATURE_NORMAL_MAP, mat->normal_map, shader->normal_map_loc, 1);
+  bind_surface_map(key, SURFACE_FEATURE_HEIGHT_MAP, mat->height_map, shader->height_map_loc, 2);
+  bind_surface_map(key, SURFACE_FEATURE_METALNESS_MAP, mat->metalness_map, shader->metalness_map_loc, 3);
+  bind_surface_map(key, SURFACE_FEATURE_ROUGHNESS_MAP, mat->roughness_map, shader->roughness_map_loc, 4);
+  bind_surface_map(key, SURFACE_FEATURE_AO_MAP, mat->ao_map, shader->ao_map_loc, 5);
+  bind_surface_map(key, SURFACE_FEATURE_EMISSIVE_MAP, mat->emissive_map, shader->emissive_map_loc, 6);
 
   // calc model matrix
   mat4x4 m;
-  mat4x4_identity(m);
-  mat4x4_rotate_Z(m, m, DEG_TO_RAD(model->rot[2]));
-  mat4x4_rotate_Y(m, m, DEG_TO_RAD(model->rot[1]));
-  mat4x4_rotate_X(m, m, DEG_TO_RAD(model->rot[0]));
-  float scale = model->scale * model->mesh->base_scale;
-  mat4x4_scale_aniso(m, m, scale, scale, scale);
-  vec3_add(m[3], m[3], model->position);
-  mat4x4_translate_in_place(m, -model->mesh->bounds.center[0], -model->mesh->bounds.center[1], -model->mesh->bounds.center[2]);
+  model_matrix(m, model);
 
   // bind model-view matrix
   mat4x4 mv;
@@ -286,9 +419,23 @@ static void render_geometry(const Model* model, Deferred* d, const Scene *s) {
   mat4x4_mul(mvp, s->camera.viewProj, m);
   GL_WRAP(glUniformMatrix4fv(shader->model_view_proj_loc, 1, GL_FALSE, (const GLfloat*)mvp));
 
-  // bind the height map scale factor
-  float height_scale = (model->material.height_map) ? model->material.height_map_scale : 0.0f;
-  GL_WRAP(glUniform1fv(shader->height_scale_loc, 1, (const GLfloat*)&height_scale));
+  // bind the height map scale factor and parallax quality caps
+  if (key & PERMUTATION_BIT(SURFACE_FEATURE_HEIGHT_MAP)) {
+    GL_WRAP(glUniform1f(shader->height_scale_loc, mat->height_map_scale));
+    GL_WRAP(glUniform2f(shader->parallax_layers_loc, (float)mat->parallax_min_layers, (float)mat->parallax_max_layers));
+    GL_WRAP(glUniform1f(shader->parallax_fade_distance_loc, mat->parallax_fade_distance));
+  }
+}
+
+static void render_geometry(const Model* model, Deferred* d, const Scene *s) {
+  if (!model->mesh->vertices)
+    return;
+
+  uint32_t key = surface_key(model);
+  const SurfaceShader* shader = (const SurfaceShader*)permutation_cache_get(&d->surface_shaders, key);
+  if (!shader)
+    return;
+  bind_surface(shader, key, model, s);
 
   mesh_draw(model->mesh,
         shader->texcoord_loc,
@@ -297,13 +444,77 @@ static void render_geometry(const Model* model, Deferred* d, const Scene *s) {
         shader->pos_loc);
 }
 
-static void render_shading(Deferred* d, const Scene *s, const ShadowMap* sm) {
-  LightingShader* shader = &d->lighting_shader[(int)d->tonemapping_op];
+static void render_visibility_geometry(const Model* model, int instance, Deferred* d, const Scene *s) {
+  if (!model->mesh->vertices)
+    return;
+
+  const VisibilityMesh* vm = visibility_get_mesh(model->mesh);
+  if (!vm)
+    return;
+
+  const VisibilityShader* shader = &d->visibility_shader;
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glUniform1ui(shader->instance_id_loc, (GLuint)instance));
+  GL_WRAP(glStencilFunc(GL_ALWAYS, instance, 0xFF));
+
+  mat4x4 m, mvp;
+  model_matrix(m, model);
+  mat4x4_mul(mvp, s->camera.viewProj, m);
+  GL_WRAP(glUniformMatrix4fv(shader->model_view_proj_loc, 1, GL_FALSE, (const GLfloat*)mvp));
+
+  visibility_mesh_draw(vm, shader->pos_loc);
+}
+
+// Evaluates the material of one instance for every pixel it won in the
+// visibility pass; the stencil rejects all other pixels before shading
+static void render_material_resolve(const Model* model, int instance, Deferred* d, const Scene *s) {
+  if (!model->mesh->vertices)
+    return;
+
+  const VisibilityMesh* vm = visibility_get_mesh(model->mesh);
+  if (!vm)
+    return;
 
+  uint32_t key = surface_key(model);
+  const MaterialResolveShader* shader = (const MaterialResolveShader*)permutation_cache_get(&d->material_resolve_shaders, key);
+  if (!shader)
+    return;
+  bind_surface(&shader->surface, key, model, s);
+
+  // units 0-6 hold the material maps
+  GL_WRAP(glActiveTexture(GL_TEXTURE7));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->g_buffer.visibility_render_buffer));
+  GL_WRAP(glUniform1i(shader->visibility_map_loc, 7));
+  GL_WRAP(glActiveTexture(GL_TEXTURE8));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, vm->vertex_data_tex));
+  GL_WRAP(glUniform1i(shader->vertex_data_loc, 8));
+  GL_WRAP(glActiveTexture(GL_TEXTURE9));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, vm->triangle_data_tex));
+  GL_WRAP(glUniform1i(shader->triangle_data_loc, 9));
+
+  GL_WRAP(glStencilFunc(GL_EQUAL, instance, 0xFF));
+  utility_draw_fullscreen_quad(shader->surface.texcoord_loc, shader->surface.pos_loc);
+}
+
+static void render_overdraw_geometry(const Model* model, Deferred* d, const Scene *s) {
+  if (!model->mesh->vertices)
+    return;
+
+  const OverdrawShader* shader = &d->overdraw_shader;
   GL_WRAP(glUseProgram(shader->program));
 
-  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-  GL_WRAP(glViewport(VIEWPORT_X_OFFSET, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT));
+  mat4x4 m, mvp;
+  model_matrix(m, model);
+  mat4x4_mul(mvp, s->camera.viewProj, m);
+  GL_WRAP(glUniformMatrix4fv(shader->model_view_proj_loc, 1, GL_FALSE, (const GLfloat*)mvp));
+
+  mesh_draw(model->mesh, -1, -1, -1, shader->pos_loc);
+}
+
+static void render_shading(Deferred* d, const LightingShader* shader, const Scene *s, const ShadowMap* sm) {
+  if (!shader)
+    return;
+  GL_WRAP(glUseProgram(shader->program));
 
   GL_WRAP(glEnable(GL_BLEND));
   GL_WRAP(glBlendEquation(GL_FUNC_ADD));
@@ -334,9 +545,17 @@ static void render_shading(Deferred* d, const Scene *s, const ShadowMap* sm) {
 
   // bind the shadow map
   GL_WRAP(glActiveTexture(GL_TEXTURE0+i+3));
-  GL_WRAP(glBindTexture(GL_TEXTURE_2D, sm->depth_buffer));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, shadow_map_get_texture(sm)));
   GL_WRAP(glUniform1i(shader->shadow_map_loc, i+3));
 
+  // shadow filter kernel
+  GL_WRAP(glUniform2fv(shader->shadow_pcf_offsets_loc, sm->pcf_taps, (const GLfloat*)sm->pcf_offsets));
+  GL_WRAP(glUniform1i(shader->shadow_pcf_taps_loc, sm->pcf_taps));
+  GL_WRAP(glUniform1i(shader->shadow_pcf_rotate_loc, sm->pcf_rotate));
+  GL_WRAP(glUniform2fv(shader->evsm_exponents_loc, 1, sm->evsm_exponents));
+  GL_WRAP(glUniform1f(shader->evsm_light_bleed_reduction_loc, sm->evsm_light_bleed_reduction));
+  GL_WRAP(glUniform1f(shader->evsm_variance_bias_loc, sm->evsm_variance_bias));
+
   // light setup
   vec4 view_light_pos_in;
   if (s->light->type == LIGHT_TYPE_POINT) {
@@ -371,6 +590,7 @@ static void render_shading(Deferred* d, const Scene *s, const ShadowMap* sm) {
   mat4x4 inv_proj;
   mat4x4_invert(inv_proj, s->camera.proj);
   GL_WRAP(glUniformMatrix4fv(shader->inv_proj_loc, 1, GL_FALSE, (const GLfloat*)inv_proj));
+  GL_WRAP(glUniform1i(shader->reverse_z_loc, s->camera.reverse_z));
 
   // Light-space matrix for shadowmap
   mat4x4 light;
@@ -390,9 +610,6 @@ static void render_shading(Deferred* d, const Scene *s, const ShadowMap* sm) {
 static void render_skybox(Deferred *d, const Scene *s) {
   GL_WRAP(glUseProgram(d->skybox_shader.program));
 
-  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-  GL_WRAP(glViewport(VIEWPORT_X_OFFSET, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT));
-
   GL_WRAP(glDisable(GL_BLEND));
 
   // Bind environment map
@@ -425,60 +642,243 @@ static void render_skybox(Deferred *d, const Scene *s) {
   utility_draw_fullscreen_quad2(d->skybox_shader.texcoord_loc, d->skybox_shader.pos_loc);
 }
 
-static void render_debug(Deferred *d) {
-  int program_idx = 0;
+static void render_debug(Deferred *d, const Scene *s) {
+  uint32_t key = 0;
   GLuint render_buffer = 0;
   switch(d->render_mode) {
     case RENDER_MODE_ALBEDO: 	render_buffer = d->g_buffer.albedo_render_buffer; break;
-    case RENDER_MODE_NORMAL: 	render_buffer = d->g_buffer.normal_render_buffer; program_idx = 1; break;
+    case RENDER_MODE_NORMAL: 	render_buffer = d->g_buffer.normal_render_buffer; key = PERMUTATION_BIT(DEBUG_FEATURE_NORMALIZE); break;
     case RENDER_MODE_ROUGHNESS: 	render_buffer = d->g_buffer.roughness_render_buffer; break;
     case RENDER_MODE_METALNESS: 	render_buffer = d->g_buffer.metalness_render_buffer; break;
-    case RENDER_MODE_DEPTH: 	render_buffer = d->g_buffer.depth_render_buffer; program_idx = 2; break;
+    case RENDER_MODE_DEPTH: 	render_buffer = d->g_buffer.depth_render_buffer; key = PERMUTATION_BIT(DEBUG_FEATURE_LINEARIZE); break;
     default: return;
   }
 
-  GL_WRAP(glUseProgram(d->debug_shader[program_idx].program));
-  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-  GL_WRAP(glViewport(VIEWPORT_X_OFFSET, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT));
+  const DebugShader* shader = (const DebugShader*)permutation_cache_get(&d->debug_shaders, key);
+  if (!shader)
+    return;
+
+  GL_WRAP(glUseProgram(shader->program));
+  gbuffer_bind_output(&d->g_buffer);
   GL_WRAP(glDisable(GL_BLEND));
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
 
   GL_WRAP(glActiveTexture(GL_TEXTURE0));
   GL_WRAP(glBindTexture(GL_TEXTURE_2D, render_buffer));
-  GL_WRAP(glUniform1i(d->debug_shader[program_idx].gbuffer_render_loc, 0));
+  GL_WRAP(glUniform1i(shader->gbuffer_render_loc, 0));
 
-  GL_WRAP(glActiveTexture(GL_TEXTURE1));
-  GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->g_buffer.depth_render_buffer));
-  GL_WRAP(glUniform1i(d->debug_shader[program_idx].gbuffer_depth_loc, 1));
+  GL_WRAP(glUniform1f(shader->z_near_loc, Z_NEAR));
+  GL_WRAP(glUniform1f(shader->z_far_loc, Z_FAR));
+  GL_WRAP(glUniform1i(shader->reverse_z_loc, s->camera.reverse_z));
 
-  GL_WRAP(glUniform1f(d->debug_shader[program_idx].z_near_loc, Z_NEAR));
-  GL_WRAP(glUniform1f(d->debug_shader[program_idx].z_far_loc, Z_FAR));
+  // albedo is stored linear and gets encoded like the lit output, the data
+  // views are written as-is
+  if (d->render_mode != RENDER_MODE_ALBEDO) {
+    GL_WRAP(glDisable(GL_FRAMEBUFFER_SRGB));
+  }
+  utility_draw_fullscreen_quad(shader->texcoord_loc, shader->pos_loc);
+  GL_WRAP(glEnable(GL_FRAMEBUFFER_SRGB));
 
-  utility_draw_fullscreen_quad(d->debug_shader[program_idx].texcoord_loc, d->debug_shader[program_idx].pos_loc);
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
 }
 
-void deferred_render(Deferred *d, const Scene *s, const ShadowMap* sm) {
+void deferred_render_heatmap(Deferred *d) {
+  const DebugShader* shader = (const DebugShader*)permutation_cache_get(&d->debug_shaders, PERMUTATION_BIT(DEBUG_FEATURE_HEATMAP));
+  if (!shader)
+    return;
+
+  profiler_begin_pass(PROFILER_PASS_HEATMAP);
+
+  GL_WRAP(glUseProgram(shader->program));
+  gbuffer_bind_output(&d->g_buffer);
+  GL_WRAP(glDisable(GL_BLEND));
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+
+  GL_WRAP(glActiveTexture(GL_TEXTURE0));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, d->g_buffer.overdraw_render_buffer));
+  GL_WRAP(glUniform1i(shader->gbuffer_render_loc, 0));
+
+  GL_WRAP(glUniform1f(shader->heatmap_max_loc, d->heatmap_max));
+
+  GL_WRAP(glDisable(GL_FRAMEBUFFER_SRGB));
+  utility_draw_fullscreen_quad(shader->texcoord_loc, shader->pos_loc);
+  GL_WRAP(glEnable(GL_FRAMEBUFFER_SRGB));
+
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
+
+  profiler_end_pass();
+}
+
+static void clear_overdraw(Deferred *d) {
+  gbuffer_bind_overdraw(&d->g_buffer);
+  utility_set_clear_color(0, 0, 0);
+  GL_WRAP(glClear(GL_COLOR_BUFFER_BIT));
+}
+
+static void render_overdraw(Deferred *d, const Scene *s) {
+  profiler_begin_pass(PROFILER_PASS_GBUFFER);
+
+  // Count every rasterized fragment: no depth rejection, no culling
+  clear_overdraw(d);
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+  GL_WRAP(glDisable(GL_CULL_FACE));
+  GL_WRAP(glEnable(GL_BLEND));
+  GL_WRAP(glBlendEquation(GL_FUNC_ADD));
+  GL_WRAP(glBlendFunc(GL_ONE, GL_ONE));
+
+  for (int i = 0; i < SCENE_MODELS_MAX; i++) {
+    if (s->models[i] && !s->models[i]->hidden)
+      render_overdraw_geometry(s->models[i], d, s);
+  }
+
   GL_WRAP(glEnable(GL_CULL_FACE));
-  GL_WRAP(glEnable(GL_TEXTURE_2D));
-  GL_WRAP(glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS));
   GL_WRAP(glEnable(GL_DEPTH_TEST));
-  GL_WRAP(glDepthFunc(GL_LEQUAL));
+
+  profiler_end_pass();
+}
+
+static void clear_depth_stencil(const Scene *s) {
+  GL_WRAP(glClearDepth(s->camera.reverse_z ? 0.0f : 1.0f));
+  GL_WRAP(glClearStencil(0));
+  GL_WRAP(glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
+}
+
+static void render_gbuffer(Deferred *d, const Scene *s) {
+  profiler_begin_pass(PROFILER_PASS_GBUFFER);
 
   gbuffer_bind(&d->g_buffer);
 
   utility_set_clear_color(0, 0, 0);
-  GL_WRAP(glClearDepth(1.0f));
   GL_WRAP(glDisable(GL_BLEND));
-  GL_WRAP(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  GL_WRAP(glClear(GL_COLOR_BUFFER_BIT));
+  clear_depth_stencil(s);
+
+  // mark every pixel covered by geometry in stencil
+  GL_WRAP(glEnable(GL_STENCIL_TEST));
+  GL_WRAP(glStencilFunc(GL_ALWAYS, 1, 0xFF));
+  GL_WRAP(glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE));
 
   for (int i = 0; i < SCENE_MODELS_MAX; i++) {
     if (s->models[i] && !s->models[i]->hidden)
       render_geometry(s->models[i], d, s);
   }
 
-  if (d->render_mode == RENDER_MODE_SHADED) {
-    render_shading(d, s, sm);
-    render_skybox(d, s);
+  GL_WRAP(glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP));
+
+  profiler_end_pass();
+}
+
+// The geometry pass writes 4 bytes of triangle id + depth per pixel and tags
+// each pixel with its instance in stencil. Materials are then evaluated once
+// per covered pixel, whatever the overdraw, and written to the g-buffer for
+// the lighting pass. Only the first VISIBILITY_INSTANCES_MAX models are drawn.
+static void render_visibility(Deferred *d, const Scene *s) {
+  profiler_begin_pass(PROFILER_PASS_GBUFFER);
+
+  gbuffer_bind_visibility(&d->g_buffer);
+
+  const GLuint clear_id[] = { 0xFFFFFFFF, 0, 0, 0 };
+  GL_WRAP(glDisable(GL_BLEND));
+  GL_WRAP(glClearBufferuiv(GL_COLOR, 0, clear_id));
+  clear_depth_stencil(s);
+
+  GL_WRAP(glEnable(GL_STENCIL_TEST));
+  GL_WRAP(glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE));
+
+  int instance = 0;
+  for (int i = 0; i < SCENE_MODELS_MAX && instance < VISIBILITY_INSTANCES_MAX; i++) {
+    if (s->models[i] && !s->models[i]->hidden)
+      render_visibility_geometry(s->models[i], ++instance, d, s);
+  }
+
+  GL_WRAP(glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP));
+
+  profiler_end_pass();
+
+  profiler_begin_pass(PROFILER_PASS_RESOLVE);
+
+  // lighting only reads pixels with a non-zero stencil, the debug views
+  // read everything and expect the cleared g-buffer
+  gbuffer_bind(&d->g_buffer);
+  if (d->render_mode != RENDER_MODE_SHADED && d->render_mode != RENDER_MODE_LIGHTING_COMPLEXITY) {
+    utility_set_clear_color(0, 0, 0);
+    GL_WRAP(glClear(GL_COLOR_BUFFER_BIT));
+  }
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+
+  instance = 0;
+  for (int i = 0; i < SCENE_MODELS_MAX && instance < VISIBILITY_INSTANCES_MAX; i++) {
+    if (s->models[i] && !s->models[i]->hidden)
+      render_material_resolve(s->models[i], ++instance, d, s);
+  }
+
+  GL_WRAP(glStencilFunc(GL_ALWAYS, 1, 0xFF));
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
+
+  profiler_end_pass();
+}
+
+void deferred_render(Deferred *d, const Scene *s, const ShadowMap* sm) {
+  GL_WRAP(glEnable(GL_CULL_FACE));
+  GL_WRAP(glEnable(GL_TEXTURE_2D));
+  GL_WRAP(glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS));
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
+  GL_WRAP(glDepthFunc(s->camera.reverse_z ? GL_GEQUAL : GL_LEQUAL));
+
+  // The overdraw view accumulates into the counter target and is resolved
+  // once the forward passes have added to it
+  if (d->render_mode == RENDER_MODE_OVERDRAW) {
+    render_overdraw(d, s);
+    return;
+  }
+
+  if (d->visibility_buffer && d->has_visibility_buffer) {
+    render_visibility(d, s);
   } else {
-    render_debug(d);
+    render_gbuffer(d, s);
   }
+
+  // The lighting and skybox passes are fullscreen, so depth testing is replaced
+  // by the stencil: lighting runs on geometry pixels only, the skybox on the rest
+  switch (d->render_mode) {
+    case RENDER_MODE_SHADED: {
+      gbuffer_bind_output(&d->g_buffer);
+      GL_WRAP(glClear(GL_COLOR_BUFFER_BIT));
+      GL_WRAP(glDisable(GL_DEPTH_TEST));
+
+      profiler_begin_pass(PROFILER_PASS_LIGHTING);
+      GL_WRAP(glStencilFunc(GL_NOTEQUAL, 0, 0xFF));
+      render_shading(d, (const LightingShader*)permutation_cache_get(&d->lighting_shaders, lighting_key(d, sm, 0)), s, sm);
+      profiler_end_pass();
+
+      profiler_begin_pass(PROFILER_PASS_SKYBOX);
+      GL_WRAP(glStencilFunc(GL_EQUAL, 0, 0xFF));
+      render_skybox(d, s);
+      profiler_end_pass();
+
+      GL_WRAP(glEnable(GL_DEPTH_TEST));
+      break;
+    }
+    case RENDER_MODE_LIGHTING_COMPLEXITY: {
+      profiler_begin_pass(PROFILER_PASS_LIGHTING);
+      clear_overdraw(d);
+      GL_WRAP(glDisable(GL_DEPTH_TEST));
+      GL_WRAP(glStencilFunc(GL_NOTEQUAL, 0, 0xFF));
+      render_shading(d, (const LightingShader*)permutation_cache_get(&d->lighting_shaders, lighting_key(d, sm, 1)), s, sm);
+      GL_WRAP(glDisable(GL_STENCIL_TEST));
+      GL_WRAP(glEnable(GL_DEPTH_TEST));
+      profiler_end_pass();
+
+      deferred_render_heatmap(d);
+      break;
+    }
+    default: {
+      profiler_begin_pass(PROFILER_PASS_DEBUG);
+      render_debug(d, s);
+      profiler_end_pass();
+      break;
+    }
+  }
+
+  GL_WRAP(glDisable(GL_STENCIL_TEST));
 }
@@ -4,6 +4,7 @@
 #include "gbuffer.h"
 #include "shadowmap.h"
 #include "scene.h"
+#include "permutation.h"
 
 #define ENUM_RenderMode(D)								\
   D(RENDER_MODE_SHADED, 		"Shaded")			\
@@ -11,7 +12,9 @@
   D(RENDER_MODE_NORMAL, 		"Normal")			\
   D(RENDER_MODE_ROUGHNESS, 	"Roughness")	\
   D(RENDER_MODE_METALNESS, 	"Metalness")	\
-  D(RENDER_MODE_DEPTH, 			"Depth")
+  D(RENDER_MODE_DEPTH, 			"Depth")			\
+  D(RENDER_MODE_OVERDRAW, 	"Overdraw")		\
+  D(RENDER_MODE_LIGHTING_COMPLEXITY, "Lighting Complexity")
 
 DECLARE_ENUM(RenderMode, render_mode_strings, ENUM_RenderMode);
 
@@ -28,6 +31,34 @@ DECLARE_ENUM(SkyboxMode, skybox_mode_strings, ENUM_SkyboxMode);
 
 DECLARE_ENUM(TonemappingOperator, tonemapping_op_strings, ENUM_TonemappingOperator);
 
+// Permutation feature bits; the string tables hold the define each bit enables
+#define ENUM_SurfaceFeature(D)                                    \
+  D(SURFACE_FEATURE_UV,             "#define MESH_VERTEX_UV1\n")   \
+  D(SURFACE_FEATURE_ALBEDO_MAP,     "#define USE_ALBEDO_MAP\n")    \
+  D(SURFACE_FEATURE_NORMAL_MAP,     "#define USE_NORMAL_MAP\n")    \
+  D(SURFACE_FEATURE_HEIGHT_MAP,     "#define USE_HEIGHT_MAP\n")    \
+  D(SURFACE_FEATURE_ROUGHNESS_MAP,  "#define USE_ROUGHNESS_MAP\n") \
+  D(SURFACE_FEATURE_METALNESS_MAP,  "#define USE_METALNESS_MAP\n") \
+  D(SURFACE_FEATURE_AO_MAP,         "#define USE_AO_MAP\n")        \
+  D(SURFACE_FEATURE_EMISSIVE_MAP,   "#define USE_EMISSIVE_MAP\n")
+
+DECLARE_ENUM(SurfaceFeature, surface_feature_defines, ENUM_SurfaceFeature);
+
+#define ENUM_LightingFeature(D)                                           \
+  D(LIGHTING_FEATURE_TONEMAP_REINHARD,    "#define TONE_MAPPING_REINHARD\n")   \
+  D(LIGHTING_FEATURE_TONEMAP_UNCHARTED2,  "#define TONE_MAPPING_UNCHARTED2\n") \
+  D(LIGHTING_FEATURE_SHADOW_EVSM,         "#define SHADOW_EVSM\n")             \
+  D(LIGHTING_FEATURE_COMPLEXITY,          "#define LIGHTING_COMPLEXITY\n")
+
+DECLARE_ENUM(LightingFeature, lighting_feature_defines, ENUM_LightingFeature);
+
+#define ENUM_DebugFeature(D)                                        \
+  D(DEBUG_FEATURE_NORMALIZE,  "#define DEBUG_RENDER_NORMALIZE\n")   \
+  D(DEBUG_FEATURE_LINEARIZE,  "#define DEBUG_RENDER_LINEARIZE\n")   \
+  D(DEBUG_FEATURE_HEATMAP,    "#define DEBUG_RENDER_HEATMAP\n")
+
+DECLARE_ENUM(DebugFeature, debug_feature_defines, ENUM_DebugFeature);
+
 typedef struct
 {
   GLuint program;
@@ -68,8 +99,30 @@ typedef struct
   GLint metalness_base_loc;
   GLint emissive_base_loc;
   GLint height_scale_loc;
+  GLint parallax_layers_loc;
+  GLint parallax_fade_distance_loc;
 } SurfaceShader;
 
+// mesh.frag built with VISIBILITY_RESOLVE, drawn as a fullscreen quad
+typedef struct
+{
+  SurfaceShader surface;
+
+  GLint visibility_map_loc;
+  GLint vertex_data_loc;
+  GLint triangle_data_loc;
+} MaterialResolveShader;
+
+typedef struct
+{
+  GLuint program;
+
+  // shader vars
+  GLint pos_loc;
+  GLint model_view_proj_loc;
+  GLint instance_id_loc;
+} VisibilityShader;
+
 typedef struct
 {
   GLuint program;
@@ -94,6 +147,12 @@ typedef struct
   GLint env_prefilter_map_loc;
   GLint env_brdf_lut_loc;
   GLint shadow_map_loc;
+  GLint shadow_pcf_offsets_loc;
+  GLint shadow_pcf_taps_loc;
+  GLint shadow_pcf_rotate_loc;
+  GLint evsm_exponents_loc;
+  GLint evsm_light_bleed_reduction_loc;
+  GLint evsm_variance_bias_loc;
 
   // shader vars
   GLint ambient_term_loc;
@@ -106,6 +165,7 @@ typedef struct
   GLint light_space_loc;
   GLint exposure_loc;
   GLint ao_strength_loc;
+  GLint reverse_z_loc;
 } LightingShader;
 
 typedef struct
@@ -116,12 +176,21 @@ typedef struct
   GLint pos_loc;
   GLint texcoord_loc;
   GLint gbuffer_render_loc;
-  GLint gbuffer_depth_loc;
   GLint z_near_loc;
   GLint z_far_loc;
-
+  GLint heatmap_max_loc;
+  GLint reverse_z_loc;
 } DebugShader;
 
+typedef struct
+{
+  GLuint program;
+
+  // shader vars
+  GLint pos_loc;
+  GLint model_view_proj_loc;
+} OverdrawShader;
+
 typedef struct
 {
   RenderMode render_mode;
@@ -129,14 +198,25 @@ typedef struct
   TonemappingOperator tonemapping_op;
   float prefilter_lod;
   SkyboxShader skybox_shader;
-  SurfaceShader surf_shader[2];
-  LightingShader lighting_shader[2];
-  DebugShader debug_shader[3];
-  Material default_mat;
+  PermutationCache surface_shaders;   // SurfaceShader, keyed by SurfaceFeature bits
+  PermutationCache lighting_shaders;  // LightingShader, keyed by LightingFeature bits
+  PermutationCache debug_shaders;     // DebugShader, keyed by DebugFeature bits
+  OverdrawShader overdraw_shader;
+  VisibilityShader visibility_shader;
+  PermutationCache material_resolve_shaders; // MaterialResolveShader, keyed by SurfaceFeature bits
   GBuffer g_buffer;
   GLuint brdf_lut_tex;
   float ao_strength;
+  float heatmap_max;
+
+  // if set, the geometry pass writes triangle ids and materials are
+  // evaluated once per pixel in a resolve pass
+  int visibility_buffer;
+
+  // gl_PrimitiveID needs GLSL 1.50
+  int has_visibility_buffer;
 } Deferred;
 
-int deferred_initialize(Deferred* d);
+int deferred_initialize(Deferred* d, LoadingCallback update_loading_cb);
 void deferred_render(Deferred* d, const Scene *s, const ShadowMap* sm);
+void deferred_render_heatmap(Deferred* d);
@@ -1,25 +1,417 @@
 #include "forward.h"
+#include "assets.h"
+#include "particles_gpu.h"
+#include "profiler.h"
 
-static void draw_quad(const ParticleShader* shader, const vec3 translation, const vec3 rot, const vec3 scale, const vec4 color) {
-  GL_WRAP(
-    glBegin(GL_QUADS);
-      if (shader->trans_loc >= 0) glVertexAttrib3f(shader->trans_loc, translation[0], translation[1], translation[2]);
-      if (shader->rot_loc >= 0) glVertexAttrib3f(shader->rot_loc, rot[0], rot[1], rot[2]);
-      if (shader->scale_loc >= 0) glVertexAttrib3f(shader->scale_loc, scale[0], scale[1], scale[2]);
-      if (shader->color_loc >= 0) glVertexAttrib4f(shader->color_loc, color[0], color[1], color[2], color[3]);
-      if (shader->uv_loc >= 0) glVertexAttrib2f(shader->uv_loc, 1, 0);
-      glVertexAttrib3f(shader->vert_loc, 0.5f, -0.5f, 0.0f);
-      if (shader->uv_loc >= 0) glVertexAttrib2f(shader->uv_loc, 1, 1.0f);
-      glVertexAttrib3f(shader->vert_loc, 0.5f, 0.5f, 0.0f);
-      if (shader->uv_loc >= 0) glVertexAttrib2f(shader->uv_loc, 0, 1.0f);
-      glVertexAttrib3f(shader->vert_loc, -0.5f, 0.5f, 0.0f);
-      if (shader->uv_loc >= 0) glVertexAttrib2f(shader->uv_loc, 0, 0);
-      glVertexAttrib3f(shader->vert_loc, -0.5f, -0.5f, 0.0f);
-    glEnd();
-  );
-}
-
-static void calculate_billboard_euler(vec3 euler, mat4x4 model, const Scene *s) {
+#define LIGHT_ICON_SCALE 2.0f
+#define LIGHT_ICON_SIZE 128
+
+static_assert(SCENE_SORTED_LIST_MAX < PARTICLE_BATCH_MAX, "the sorted list needs a slot for the light icon");
+
+DEFINE_ENUM(ParticleShaderFeature, particle_shader_feature_defines, ENUM_ParticleShaderFeature);
+
+// triangle strip: vert xyz + texcoord uv
+static const float sQuadVertices[] = {
+  -0.5f, -0.5f, 0.0f,   0.0f, 0.0f,
+   0.5f, -0.5f, 0.0f,   1.0f, 0.0f,
+  -0.5f,  0.5f, 0.0f,   0.0f, 1.0f,
+   0.5f,  0.5f, 0.0f,   1.0f, 1.0f,
+};
+
+static void bind_instance_attrib(GLint loc, int size, GLsizei stride, size_t offset) {
+  if (loc < 0)
+    return;
+  GL_WRAP(glEnableVertexAttribArray(loc));
+  GL_WRAP(glVertexAttribPointer(loc, size, GL_FLOAT, GL_FALSE, stride, (const void*)offset));
+  GL_WRAP(glVertexAttribDivisor(loc, 1));
+}
+
+static void unbind_instance_attrib(GLint loc) {
+  if (loc < 0)
+    return;
+  // divisors live in the shared vertex array state, so leave them reset
+  GL_WRAP(glVertexAttribDivisor(loc, 0));
+  GL_WRAP(glDisableVertexAttribArray(loc));
+}
+
+// Binds the unit quad and the instance attributes, which start at base in
+// vbo and are laid out like ParticleInstance
+static void bind_instances(const Forward* f, const ParticleShader* shader, GLuint vbo, GLsizei stride, size_t base) {
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, f->quad_vbo));
+  GL_WRAP(glEnableVertexAttribArray(shader->vert_loc));
+  GL_WRAP(glVertexAttribPointer(shader->vert_loc, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*)0));
+  if (shader->uv_loc >= 0) {
+    GL_WRAP(glEnableVertexAttribArray(shader->uv_loc));
+    GL_WRAP(glVertexAttribPointer(shader->uv_loc, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*)(3 * sizeof(float))));
+  }
+
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+  bind_instance_attrib(shader->trans_loc, 3, stride, base + offsetof(ParticleInstance, pos));
+  bind_instance_attrib(shader->rot_loc, 3, stride, base + offsetof(ParticleInstance, rot));
+  bind_instance_attrib(shader->scale_loc, 3, stride, base + offsetof(ParticleInstance, scale));
+  bind_instance_attrib(shader->color_loc, 4, stride, base + offsetof(ParticleInstance, color));
+}
+
+static void unbind_instances(const ParticleShader* shader) {
+  GL_WRAP(glDisableVertexAttribArray(shader->vert_loc));
+  if (shader->uv_loc >= 0) GL_WRAP(glDisableVertexAttribArray(shader->uv_loc));
+  unbind_instance_attrib(shader->trans_loc);
+  unbind_instance_attrib(shader->rot_loc);
+  unbind_instance_attrib(shader->scale_loc);
+  unbind_instance_attrib(shader->color_loc);
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+// Binds the unit quad and analytic instances starting at base in vbo
+static void bind_analytic_instances(const Forward* f, const ParticleShader* shader, GLuint vbo, size_t base) {
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, f->quad_vbo));
+  GL_WRAP(glEnableVertexAttribArray(shader->vert_loc));
+  GL_WRAP(glVertexAttribPointer(shader->vert_loc, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*)0));
+  if (shader->uv_loc >= 0) {
+    GL_WRAP(glEnableVertexAttribArray(shader->uv_loc));
+    GL_WRAP(glVertexAttribPointer(shader->uv_loc, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*)(3 * sizeof(float))));
+  }
+
+  const GLsizei stride = sizeof(AnalyticParticleInstance);
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+  bind_instance_attrib(shader->velocity_loc, 4, stride, base + offsetof(AnalyticParticleInstance, velocity));
+  bind_instance_attrib(shader->rot_loc, 4, stride, base + offsetof(AnalyticParticleInstance, rot));
+}
+
+static void unbind_analytic_instances(const ParticleShader* shader) {
+  GL_WRAP(glDisableVertexAttribArray(shader->vert_loc));
+  if (shader->uv_loc >= 0) GL_WRAP(glDisableVertexAttribArray(shader->uv_loc));
+  unbind_instance_attrib(shader->velocity_loc);
+  unbind_instance_attrib(shader->rot_loc);
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+// Draws count instances of the uploaded instance buffer starting at first in
+// a single call; the vertex shader expands and orients each quad
+static void draw_instances(const Forward* f, const ParticleShader* shader, int first, int count) {
+  if (count <= 0)
+    return;
+
+  size_t base = (size_t)first * sizeof(ParticleInstance);
+  bind_instances(f, shader, f->instance_vbo, sizeof(ParticleInstance), base);
+  // only the instance buffer has batch slots, see draw_emitter
+  bind_instance_attrib(shader->batch_loc, 2, sizeof(ParticleInstance), base + offsetof(ParticleInstance, batch));
+  GL_WRAP(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count));
+  profiler_count_draw(GL_TRIANGLES, count * 6);
+  unbind_instance_attrib(shader->batch_loc);
+  unbind_instances(shader);
+}
+
+// Draws a GPU simulated emitter straight from its state buffer. The instance
+// count was written by the last simulation step, so it's unknown here.
+static void draw_gpu_instances(const Forward* f, const ParticleShader* shader, const ParticleEmitter* emitter) {
+  const ParticleEmitterGpu* gpu = &emitter->gpu;
+  if (!gpu->capacity)
+    return;
+
+  bind_instances(f, shader, gpu->state_vbo[gpu->current], sizeof(GpuParticle), 0);
+  GL_WRAP(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu->command_buffer));
+  GL_WRAP(glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)offsetof(GpuParticleCommands, draw)));
+  GL_WRAP(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+  profiler_count_draw(GL_TRIANGLES, 0);
+  unbind_instances(shader);
+}
+
+// Analytic instances are evaluated in the vertex shader at the emitter's
+// clock, which runs ahead of its last step while it catches up
+static void draw_analytic_instances(const Forward* f, const ParticleShader* shader, const ParticleEmitter* emitter, int first, int count) {
+  if (count <= 0)
+    return;
+
+  const ParticleEmitterDesc* desc = emitter->desc;
+  GL_WRAP(glUniform1f(shader->time_loc, emitter->time + emitter->catch_up_dt));
+  GL_WRAP(glUniform1f(shader->gravity_loc, desc->simulate_gravity ? PARTICLE_GRAVITY : 0.0f));
+  GL_WRAP(glUniform4fv(shader->start_color_loc, 1, desc->start_color));
+  GL_WRAP(glUniform4fv(shader->end_color_loc, 1, desc->end_color));
+  GL_WRAP(glUniform2f(shader->scale_ramp_loc, desc->start_scale, desc->end_scale));
+
+  bind_analytic_instances(f, shader, f->analytic_vbo, (size_t)first * sizeof(AnalyticParticleInstance));
+  GL_WRAP(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count));
+  profiler_count_draw(GL_TRIANGLES, count * 6);
+  unbind_analytic_instances(shader);
+}
+
+// Grows an instance array to fit count more, returns the first new element
+static void* grow_instances(void** instances, int* instances_count, int* instances_max, int count, size_t size) {
+  if (*instances_count + count > *instances_max) {
+    int new_max = *instances_max ? *instances_max : 1024;
+    while (new_max < *instances_count + count)
+      new_max *= 2;
+    *instances = realloc(*instances, new_max * size);
+    *instances_max = new_max;
+  }
+  void* out = (char*)*instances + *instances_count * size;
+  *instances_count += count;
+  return out;
+}
+
+static ParticleInstance* push_instances(Forward* f, int count) {
+  return (ParticleInstance*)grow_instances((void**)&f->instances, &f->instances_count, &f->instances_max, count, sizeof(ParticleInstance));
+}
+
+static int push_analytic_emitter(Forward* f, const ParticleEmitter* emitter) {
+  int first = f->analytic_count;
+  AnalyticParticleInstance* out = (AnalyticParticleInstance*)grow_instances((void**)&f->analytic_instances
+    , &f->analytic_count, &f->analytic_max, emitter->count, sizeof(AnalyticParticleInstance));
+  const ParticleStreams* s = &emitter->streams;
+  for (int i = 0; i < emitter->count; i++) {
+    vec3_set(out[i].velocity, s->vx[i], s->vy[i], s->vz[i]);
+    out[i].born = s->born[i];
+    vec3_set(out[i].rot, s->rx[i], s->ry[i], s->rz[i]);
+    out[i].life_time = s->ttl[i];
+  }
+  return first;
+}
+
+// One instantiation per combination of PARTICLE_FEATURE_COLOR_RAMP, _SCALE_RAMP
+// and _ROTATION. Without a ramp every particle has the descriptor's start
+// value, and screen aligned instances leave rot unwritten as the shader
+// ignores it.
+typedef void (*ParticleFillKernel)(ParticleInstance* out, const ParticleStreams* s, int count, const ParticleEmitterDesc* desc, const vec2 batch);
+
+template <int Features>
+static void fill_kernel(ParticleInstance* out, const ParticleStreams* s, int count, const ParticleEmitterDesc* desc, const vec2 batch) {
+  for (int i = 0; i < count; i++) {
+    vec3_set(out[i].pos, s->px[i], s->py[i], s->pz[i]);
+    vec2_dup(out[i].batch, batch);
+    if (Features & PARTICLE_FEATURE_ROTATION) {
+      vec3_set(out[i].rot, s->rx[i], s->ry[i], s->rz[i]);
+    }
+    if (Features & PARTICLE_FEATURE_SCALE_RAMP) {
+      vec3_swizzle(out[i].scale, s->scale[i]);
+    } else {
+      vec3_swizzle(out[i].scale, desc->start_scale);
+    }
+    if (Features & PARTICLE_FEATURE_COLOR_RAMP) {
+      vec4_set(out[i].color, s->r[i], s->g[i], s->b[i], s->a[i]);
+    } else {
+      vec4_dup(out[i].color, desc->start_color);
+    }
+  }
+}
+
+static const ParticleFillKernel sFillKernels[] = {
+  fill_kernel<0 << 1>, fill_kernel<1 << 1>, fill_kernel<2 << 1>, fill_kernel<3 << 1>,
+  fill_kernel<4 << 1>, fill_kernel<5 << 1>, fill_kernel<6 << 1>, fill_kernel<7 << 1>,
+};
+static_assert(STATIC_ELEMENT_COUNT(sFillKernels) == PARTICLE_FILL_FEATURES(PARTICLE_FEATURE_ALL) + 1, "one fill kernel per feature set");
+
+// layer of a particle texture in gParticleAtlas, 0 for unknown textures
+static int atlas_layer(GLuint texture) {
+  for (int i = 0; i < gParticleTexturesCount; i++) {
+    if (gParticleTextures[i].texture == texture)
+      return i;
+  }
+  return 0;
+}
+
+static int push_emitter(Forward* f, const ParticleEmitter* emitter, int slot) {
+  int first = f->instances_count;
+  ParticleInstance* out = push_instances(f, emitter->count);
+  const vec2 batch = { (float)slot, (float)atlas_layer(emitter->desc->texture) };
+  sFillKernels[PARTICLE_FILL_FEATURES(emitter->features)](out, &emitter->streams, emitter->count, emitter->desc, batch);
+  return first;
+}
+
+// NULL if the variant failed to build
+static const ParticleShader* particle_shader(Forward* f, uint32_t key) {
+  return (const ParticleShader*)permutation_cache_get(&f->particle_shaders, key);
+}
+
+// only textured particles are soft
+static uint32_t particle_shader_key(const ParticleEmitter* emitter, int oit) {
+  const ParticleEmitterDesc* desc = emitter->desc;
+  uint32_t key = 0;
+  if (desc->shading_mode == PARTICLE_SHADING_TEXTURED) {
+    key |= PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_TEXTURED);
+    if (desc->soft) key |= PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_SOFT);
+  }
+  if (particle_emitter_analytic(emitter)) key |= PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_ANALYTIC);
+  if (oit) key |= PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_OIT);
+  return key;
+}
+
+static const ParticleShader* select_particle_shader(Forward* f, const ParticleEmitter* emitter, int oit) {
+  return particle_shader(f, particle_shader_key(emitter, oit));
+}
+
+// additive blending is order independent, so CPU emitters using it can share draws
+static int batchable(const Forward* f, const ParticleEmitter* emitter) {
+  return f->batch_emitters && emitter && emitter->visible && !emitter->desc->depth_sort_alpha_blend
+    && !particles_gpu_enabled(emitter) && !particle_emitter_analytic(emitter);
+}
+
+// Pushes the batchable emitters, up to PARTICLE_BATCH_MAX of them sharing a
+// shader and a resolution per batch
+static void push_batches(Forward* f, const Scene *s) {
+  f->batches_count = 0;
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    if (!batchable(f, s->emitters[i]) || f->emitter_batch[i] >= 0)
+      continue;
+
+    ParticleBatch* batch = &f->batches[f->batches_count];
+    batch->shader = select_particle_shader(f, s->emitters[i], 0);
+    batch->resolution = s->emitters[i]->desc->resolution;
+    batch->first = f->instances_count;
+    batch->emitters_count = 0;
+    for (int j = i; j < SCENE_EMITTERS_MAX && batch->emitters_count < PARTICLE_BATCH_MAX; j++) {
+      const ParticleEmitter* emitter = s->emitters[j];
+      if (!batchable(f, emitter) || f->emitter_batch[j] >= 0
+          || emitter->desc->resolution != batch->resolution
+          || select_particle_shader(f, emitter, 0) != batch->shader)
+        continue;
+      f->emitter_batch[j] = f->batches_count;
+      f->emitter_first[j] = push_emitter(f, emitter, batch->emitters_count);
+      batch->emitters[batch->emitters_count++] = j;
+    }
+    batch->count = f->instances_count - batch->first;
+    f->batches_count++;
+  }
+}
+
+// model matrix of a scene emitter, or of the light icon for -1
+static void emitter_model(mat4x4 model, int index, const Scene *s) {
+  if (index < 0) {
+    mat4x4_identity(model);
+    vec3_dup(model[3], s->light->position);
+    return;
+  }
+  const ParticleEmitter* emitter = s->emitters[index];
+  mat4x4_make_transform_uscale(model, emitter->scale, emitter->rot, emitter->pos);
+}
+
+// Picks the emitters the scene listed for this frame's sorted transparency
+// list, it already left their sorting to us. Leaves the list empty when
+// there's nothing to sort the light icon against.
+static void select_sorted_list(Forward* f, const Scene *s) {
+  ParticleBatch* list = &f->sorted_list;
+  list->shader = particle_shader(f, PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_SORTED_LIST));
+  list->resolution = PARTICLE_RESOLUTION_FULL;
+  list->emitters_count = 0;
+  if (!list->shader)
+    return;
+
+  list->emitters[0] = -1;
+  list->emitters_count = 1;
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    if (!s->emitters[i] || !s->emitters[i]->listed)
+      continue;
+    f->emitter_batch[i] = PARTICLE_BATCH_SORTED_LIST;
+    list->emitters[list->emitters_count++] = i;
+  }
+  if (list->emitters_count == 1) {
+    list->emitters_count = 0;
+  }
+}
+
+void forward_sort_list(Forward* f, const Scene *s) {
+  ParticleBatch* list = &f->sorted_list;
+  if (list->count > f->list_max) {
+    f->list_max = list->count;
+    f->list_records = (SortRecord*)realloc(f->list_records, f->list_max * sizeof(SortRecord));
+    f->list_scratch = (SortRecord*)realloc(f->list_scratch, f->list_max * sizeof(SortRecord));
+    f->list_instances = (ParticleInstance*)realloc(f->list_instances, f->list_max * sizeof(ParticleInstance));
+  }
+
+  mat4x4 models[PARTICLE_BATCH_MAX];
+  for (int slot = 0; slot < list->emitters_count; slot++) {
+    emitter_model(models[slot], list->emitters[slot], s);
+  }
+
+  // the radix sort is ascending, so key on the negated distance
+  vec3 eye;
+  camera_eye(&s->camera, eye);
+  ParticleInstance* instances = f->instances + list->first;
+  for (int i = 0; i < list->count; i++) {
+    vec4 local = { instances[i].pos[0], instances[i].pos[1], instances[i].pos[2], 1.0f };
+    vec4 world;
+    mat4x4_mul_vec4(world, models[(int)instances[i].batch[0]], local);
+    vec3 diff;
+    vec3_sub(diff, world, eye);
+    f->list_records[i].depth = -vec3_len2(diff);
+    f->list_records[i].index = i;
+  }
+  const SortRecord* sorted = particle_sort_radix(f->list_records, f->list_scratch, list->count);
+  for (int i = 0; i < list->count; i++) {
+    f->list_instances[i] = instances[sorted[i].index];
+  }
+  memcpy(instances, f->list_instances, list->count * sizeof(ParticleInstance));
+}
+
+// Pushes the listed emitters and a copy of the light icon, then sorts the
+// merged instances
+static void push_sorted_list(Forward* f, const Scene *s) {
+  ParticleBatch* list = &f->sorted_list;
+  list->first = f->instances_count;
+  list->count = 0;
+  if (!list->emitters_count)
+    return;
+
+  for (int slot = 1; slot < list->emitters_count; slot++) {
+    int index = list->emitters[slot];
+    f->emitter_first[index] = push_emitter(f, s->emitters[index], slot);
+  }
+  ParticleInstance* icon = push_instances(f, 1);
+  *icon = f->instances[f->icon_first];
+  list->count = f->instances_count - list->first;
+  forward_sort_list(f, s);
+}
+
+// Gathers this frame's particles (and the light icon) into the instance
+// buffer with a single upload, orphaning last frame's storage. Batched
+// emitters follow the ones drawn alone, and the sorted list comes last.
+static void stream_instances(Forward* f, const Scene *s, int sort) {
+  f->instances_count = 0;
+  f->analytic_count = 0;
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    f->emitter_batch[i] = -1;
+  }
+  f->sorted_list.emitters_count = 0;
+  if (sort) {
+    select_sorted_list(f, s);
+  }
+
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    ParticleEmitter* emitter = s->emitters[i];
+    if (!emitter || !emitter->visible || particles_gpu_enabled(emitter) || f->emitter_batch[i] >= 0)
+      continue;
+
+    if (particle_emitter_analytic(emitter)) {
+      f->emitter_first[i] = push_analytic_emitter(f, emitter);
+    } else if (!batchable(f, emitter)) {
+      f->emitter_first[i] = push_emitter(f, emitter, 0);
+    }
+  }
+  push_batches(f, s);
+
+  f->icon_first = f->instances_count;
+  ParticleInstance* icon = push_instances(f, 1);
+  vec3_zero(icon->pos);
+  vec3_zero(icon->rot);
+  vec3_swizzle(icon->scale, LIGHT_ICON_SCALE);
+  vec3_dup(icon->color, s->light->color);
+  icon->color[3] = 1.0f;
+  vec2_zero(icon->batch);
+  push_sorted_list(f, s);
+
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, f->instance_vbo));
+  GL_WRAP(glBufferData(GL_ARRAY_BUFFER, f->instances_count * sizeof(ParticleInstance), NULL, GL_STREAM_DRAW));
+  GL_WRAP(glBufferSubData(GL_ARRAY_BUFFER, 0, f->instances_count * sizeof(ParticleInstance), f->instances));
+  if (f->analytic_count > 0) {
+    GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, f->analytic_vbo));
+    GL_WRAP(glBufferData(GL_ARRAY_BUFFER, f->analytic_count * sizeof(AnalyticParticleInstance), NULL, GL_STREAM_DRAW));
+    GL_WRAP(glBufferSubData(GL_ARRAY_BUFFER, 0, f->analytic_count * sizeof(AnalyticParticleInstance), f->analytic_instances));
+  }
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+// rotation turning the quad's xy plane to face the camera, in model space
+static void calculate_billboard(mat4x4 billboard, mat4x4 model, const Scene *s) {
   vec4 cam_forward, cam_up;
   cam_forward[3] = cam_up[3] = 0.0f;
   camera_forward(&s->camera, cam_forward);
@@ -33,50 +425,230 @@ static void calculate_billboard_euler(vec3 euler, mat4x4 model, const Scene *s)
   vec4_negate_in_place(model_cam_forward);
   mat4x4_mul_vec4(model_cam_up, invModel, cam_up);
 
-  mat4x4 lookAt, invLookAt;
+  mat4x4 lookAt;
   mat4x4_look_at(lookAt, Zero, model_cam_forward, model_cam_up);
-  mat4x4_invert(invLookAt, lookAt);
+  mat4x4_invert(billboard, lookAt);
+}
 
-  vec3_zero(euler);
-  mat4x4_to_euler(euler, invLookAt);
+static const char* const sParticleAttribs[] = { "vert", "translation", "rotation", "scale", "texcoord", "color", "velocity", "batch" };
+static const char* const sParticleOutputs[] = { "outColor", "outRevealage" };
+
+static int has_feature(const char** defines, int defines_count, ParticleShaderFeature feature) {
+  for (int i = 0; i < defines_count; i++) {
+    if (defines[i] == particle_shader_feature_defines[feature])
+      return 1;
+  }
+  return 0;
 }
 
-static int load_particle_shader(ParticleShader* shader, const char* vert, const char* frag, const char** defines, int defines_count) {
-  // initialize particle shader
-  if (!(shader->program = utility_create_program_defines(vert, frag, defines, defines_count))) {
-    printf("Unable to load shader [%s. %s]\n", vert, frag);
-    return 1;
+static int request_particle_shader(ProgramRequest* req, const char** defines, int defines_count) {
+  const char* vert = "shaders/particle.vert";
+  const char* frag = "shaders/particle_flat.frag";
+  if (has_feature(defines, defines_count, PARTICLE_SHADER_FEATURE_OVERDRAW)) {
+    frag = "shaders/overdraw.frag";
+  } else if (has_feature(defines, defines_count, PARTICLE_SHADER_FEATURE_TEXTURED)
+      || has_feature(defines, defines_count, PARTICLE_SHADER_FEATURE_SORTED_LIST)) {
+    frag = "shaders/particle_textured.frag";
   }
-  GL_WRAP(glBindAttribLocation(shader->program, 0, "vert"));
-  GL_WRAP(glBindAttribLocation(shader->program, 1, "translation"));
-  GL_WRAP(glBindAttribLocation(shader->program, 2, "rotation"));
-  GL_WRAP(glBindAttribLocation(shader->program, 3, "scale"));
-  GL_WRAP(glBindAttribLocation(shader->program, 4, "texcoord"));
-  GL_WRAP(glBindAttribLocation(shader->program, 5, "color"));
-  if (utility_link_program(shader->program)) {
-    printf( "Unable to load shader\n" );
+
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = vert;
+  desc.frag_filename = frag;
+  desc.defines = defines;
+  desc.defines_count = defines_count;
+  desc.attribs = sParticleAttribs;
+  desc.attribs_count = STATIC_ELEMENT_COUNT(sParticleAttribs);
+  desc.frag_outputs = sParticleOutputs;
+  desc.frag_outputs_count = STATIC_ELEMENT_COUNT(sParticleOutputs);
+  if (utility_request_program(req, &desc)) {
+    printf("Unable to load shader [%s. %s]\n", vert, frag);
     return 1;
   }
+  return 0;
+}
+
+static void resolve_particle_shader(void* out_shader, GLuint program) {
+  ParticleShader* shader = (ParticleShader*)out_shader;
+  shader->program = program;
   GL_WRAP(shader->vert_loc = glGetAttribLocation(shader->program, "vert"));
   GL_WRAP(shader->trans_loc = glGetAttribLocation(shader->program, "translation"));
   GL_WRAP(shader->rot_loc = glGetAttribLocation(shader->program, "rotation"));
   GL_WRAP(shader->scale_loc = glGetAttribLocation(shader->program, "scale"));
   GL_WRAP(shader->uv_loc = glGetAttribLocation(shader->program, "texcoord"));
   GL_WRAP(shader->color_loc = glGetAttribLocation(shader->program, "color"));
+  GL_WRAP(shader->velocity_loc = glGetAttribLocation(shader->program, "velocity"));
+  GL_WRAP(shader->batch_loc = glGetAttribLocation(shader->program, "batch"));
   GL_WRAP(shader->modelviewproj_loc = glGetUniformLocation(shader->program, "ModelViewProj"));
+  GL_WRAP(shader->screen_aligned_loc = glGetUniformLocation(shader->program, "ScreenAligned"));
+  GL_WRAP(shader->billboard_loc = glGetUniformLocation(shader->program, "Billboard"));
   GL_WRAP(shader->texture_loc = glGetUniformLocation(shader->program, "Texture"));
   GL_WRAP(shader->gbuffer_depth_loc = glGetUniformLocation(shader->program, "GBuffer_Depth"));
+  GL_WRAP(shader->z_near_loc = glGetUniformLocation(shader->program, "ZNear"));
+  GL_WRAP(shader->z_far_loc = glGetUniformLocation(shader->program, "ZFar"));
+  GL_WRAP(shader->reverse_z_loc = glGetUniformLocation(shader->program, "ReverseZ"));
+  GL_WRAP(shader->time_loc = glGetUniformLocation(shader->program, "Time"));
+  GL_WRAP(shader->gravity_loc = glGetUniformLocation(shader->program, "Gravity"));
+  GL_WRAP(shader->start_color_loc = glGetUniformLocation(shader->program, "StartColor"));
+  GL_WRAP(shader->end_color_loc = glGetUniformLocation(shader->program, "EndColor"));
+  GL_WRAP(shader->scale_ramp_loc = glGetUniformLocation(shader->program, "ScaleRamp"));
+  GL_WRAP(shader->icon_loc = glGetUniformLocation(shader->program, "Icon"));
+  GL_WRAP(shader->textured_loc = glGetUniformLocation(shader->program, "Textured"));
+  GL_WRAP(shader->soft_loc = glGetUniformLocation(shader->program, "Soft"));
+}
+
+static const char* const sResolveAttribs[] = { "position", "texcoord" };
+
+static int request_resolve_shader(ProgramRequest* req, const char* frag) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/passthrough.vert";
+  desc.frag_filename = frag;
+  desc.attribs = sResolveAttribs;
+  desc.attribs_count = STATIC_ELEMENT_COUNT(sResolveAttribs);
+  if (utility_request_program(req, &desc)) {
+    printf("Unable to load shader [%s. %s]\n", desc.vert_filename, frag);
+    return 1;
+  }
+  return 0;
+}
+
+static int resolve_resolve_shader(ParticleResolveShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
+    printf("Unable to load shader [%s. %s]\n", req->vert_filename, req->frag_filename);
+    return 1;
+  }
+  GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
+  GL_WRAP(shader->texcoord_loc = glGetAttribLocation(shader->program, "texcoord"));
+  GL_WRAP(shader->gbuffer_depth_loc = glGetUniformLocation(shader->program, "GBuffer_Depth"));
+  GL_WRAP(shader->z_near_loc = glGetUniformLocation(shader->program, "ZNear"));
+  GL_WRAP(shader->z_far_loc = glGetUniformLocation(shader->program, "ZFar"));
+  GL_WRAP(shader->reverse_z_loc = glGetUniformLocation(shader->program, "ReverseZ"));
+  GL_WRAP(shader->divisor_loc = glGetUniformLocation(shader->program, "Divisor"));
+  GL_WRAP(shader->particles_loc = glGetUniformLocation(shader->program, "Particles"));
+  GL_WRAP(shader->depth_range_loc = glGetUniformLocation(shader->program, "DepthRange"));
+  GL_WRAP(shader->accum_loc = glGetUniformLocation(shader->program, "Accum"));
+  GL_WRAP(shader->revealage_loc = glGetUniformLocation(shader->program, "Revealage"));
+  return 0;
+}
+
+static GLuint generate_target_texture(GLenum internal_format, GLenum format, GLenum type, int width, int height) {
+  GLuint tex = 0;
+  GL_WRAP(glGenTextures(1, &tex));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, tex));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+  GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, 0));
+  return tex;
+}
+
+static void destroy_particle_target(ParticleTarget* t) {
+  GL_WRAP(glDeleteFramebuffers(1, &t->fbo));
+  GL_WRAP(glDeleteTextures(1, &t->color_render_buffer));
+  GL_WRAP(glDeleteTextures(1, &t->depth_range_render_buffer));
+  GL_WRAP(glDeleteTextures(1, &t->depth_render_buffer));
+  t->fbo = t->color_render_buffer = t->depth_range_render_buffer = t->depth_render_buffer = 0;
+}
+
+static int initialize_particle_target(ParticleTarget* t) {
+  GL_WRAP(glGenFramebuffers(1, &t->fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, t->fbo));
+  t->color_render_buffer = generate_target_texture(GL_RGBA16F, GL_RGBA, GL_FLOAT, t->width, t->height);
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->color_render_buffer, 0));
+  t->depth_range_render_buffer = generate_target_texture(GL_RG32F, GL_RG, GL_FLOAT, t->width, t->height);
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, t->depth_range_render_buffer, 0));
+  t->depth_render_buffer = generate_target_texture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, t->width, t->height);
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, t->depth_render_buffer, 0));
+
+  GLenum fbo_status;
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE)
+    return 1;
+  return 0;
+}
+
+// Fits the target to the g-buffer, downsamples the g-buffer depth into it
+// and clears its color. Leaves the target bound for drawing particles.
+static int begin_particle_target(Forward* f, ParticleTarget* t, int divisor, const Scene *s) {
+  const GBuffer* g_buffer = f->g_buffer;
+  int width = (g_buffer->width + divisor - 1) / divisor;
+  int height = (g_buffer->height + divisor - 1) / divisor;
+  if (t->divisor != divisor || t->width != width || t->height != height) {
+    // a failed target isn't retried until the g-buffer size changes
+    destroy_particle_target(t);
+    t->divisor = divisor;
+    t->width = width;
+    t->height = height;
+    if (initialize_particle_target(t)) {
+      printf("Unable to create the 1/%i resolution particle target\n", divisor);
+      destroy_particle_target(t);
+    }
+  }
+  if (!t->fbo)
+    return 1;
+
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, t->fbo));
+  GL_WRAP(glViewport(0, 0, t->width, t->height));
+
+  // no particle color over the full transmittance
+  const GLfloat clear_color[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+  GL_WRAP(glDrawBuffer(GL_COLOR_ATTACHMENT0));
+  GL_WRAP(glClearBufferfv(GL_COLOR, 0, clear_color));
+
+  // every block writes its depth range and farthest depth
+  const ParticleResolveShader* shader = &f->downsample_shader;
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glDrawBuffer(GL_COLOR_ATTACHMENT1));
+  GL_WRAP(glDisable(GL_BLEND));
+  GL_WRAP(glDepthFunc(GL_ALWAYS));
+  GL_WRAP(glDepthMask(GL_TRUE));
+
+  GL_WRAP(glActiveTexture(GL_TEXTURE0));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, g_buffer->depth_render_buffer));
+  GL_WRAP(glUniform1i(shader->gbuffer_depth_loc, 0));
+  GL_WRAP(glUniform1i(shader->divisor_loc, divisor));
+  GL_WRAP(glUniform1f(shader->z_near_loc, Z_NEAR));
+  GL_WRAP(glUniform1f(shader->z_far_loc, Z_FAR));
+  GL_WRAP(glUniform1i(shader->reverse_z_loc, s->camera.reverse_z));
+  utility_draw_fullscreen_quad(shader->texcoord_loc, shader->pos_loc);
+
+  GL_WRAP(glDepthFunc(s->camera.reverse_z ? GL_GEQUAL : GL_LEQUAL));
+  GL_WRAP(glDepthMask(GL_FALSE));
+  GL_WRAP(glEnable(GL_BLEND));
+  GL_WRAP(glDrawBuffer(GL_COLOR_ATTACHMENT0));
   return 0;
 }
 
-static void draw_billboard(Forward* f, GLuint texture, const vec3 position, float scale, const Scene *s) {
-    const ParticleShader* shader = &f->particle_shader_textured;
+// Upsamples the target over the bound output: color + output * transmittance
+static void composite_particle_target(const Forward* f, const ParticleTarget* t, const Scene *s) {
+  const ParticleResolveShader* shader = &f->composite_shader;
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+  GL_WRAP(glBlendFunc(GL_ONE, GL_SRC_ALPHA));
+
+  GL_WRAP(glActiveTexture(GL_TEXTURE0));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, t->color_render_buffer));
+  GL_WRAP(glUniform1i(shader->particles_loc, 0));
+  GL_WRAP(glActiveTexture(GL_TEXTURE1));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, t->depth_range_render_buffer));
+  GL_WRAP(glUniform1i(shader->depth_range_loc, 1));
+  GL_WRAP(glActiveTexture(GL_TEXTURE2));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, f->g_buffer->depth_render_buffer));
+  GL_WRAP(glUniform1i(shader->gbuffer_depth_loc, 2));
+  GL_WRAP(glUniform1f(shader->z_near_loc, Z_NEAR));
+  GL_WRAP(glUniform1f(shader->z_far_loc, Z_FAR));
+  GL_WRAP(glUniform1i(shader->reverse_z_loc, s->camera.reverse_z));
+  utility_draw_fullscreen_quad(shader->texcoord_loc, shader->pos_loc);
+
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
+}
+
+static void draw_billboard(const Forward* f, const ParticleShader* shader, GLuint texture, const vec3 position, const Scene *s) {
 
     // bind shader
     GL_WRAP(glUseProgram(shader->program));
-    GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-    GL_WRAP(glViewport(VIEWPORT_X_OFFSET, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT));
-    GL_WRAP(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)); // alpha blend
 
     mat4x4 model;
     mat4x4_identity(model);
@@ -89,141 +661,427 @@ static void draw_billboard(Forward* f, GLuint texture, const vec3 position, floa
 
     // bind texture
     GL_WRAP(glActiveTexture(GL_TEXTURE0));
-    GL_WRAP(glBindTexture(GL_TEXTURE_2D, texture));
+    GL_WRAP(glBindTexture(GL_TEXTURE_2D_ARRAY, texture));
     GL_WRAP(glUniform1i(shader->texture_loc, 0));
 
-    // calculate billboard factor
-    vec3 rot;
-    calculate_billboard_euler(rot, model, s);
+    // face the camera
+    mat4x4 billboard;
+    calculate_billboard(billboard, model, s);
+    GL_WRAP(glUniform1i(shader->screen_aligned_loc, 1));
+    GL_WRAP(glUniformMatrix4fv(shader->billboard_loc, 1, GL_FALSE, (const GLfloat*)billboard));
 
     // submit
-    vec4 color; color[3] = 1.0f;
-    vec3_dup(color, s->light->color);
-    vec3 scale3;
-    vec3_swizzle(scale3, scale);
-    draw_quad(shader, Vec_Zero, rot, scale3, color);
+    draw_instances(f, shader, f->icon_first, 1);
 }
 
-int forward_initialize(Forward* f) {
+int forward_initialize(Forward* f, LoadingCallback update_loading_cb) {
   memset(f, 0, sizeof(Forward));
-  if (load_particle_shader(&f->particle_shader_flat, "shaders/particle.vert", "shaders/particle_flat.frag", NULL, 0)) {
+
+  if (!GLEW_VERSION_3_3 && !GLEW_ARB_instanced_arrays) {
+    printf("Instanced arrays are required for particle rendering\n");
     return 1;
   }
-  if (load_particle_shader(&f->particle_shader_textured, "shaders/particle.vert", "shaders/particle_textured.frag", NULL, 0 )) {
+
+  f->has_oit = GLEW_VERSION_4_0 || GLEW_ARB_draw_buffers_blend;
+  printf("Forward -- Weighted Blended OIT: %s\n", BOOL_TO_STRING(f->has_oit));
+
+  // Issue all builds before waiting on any of them; every particle variant
+  // the emitters can ask for is built up front
+  permutation_cache_initialize(&f->particle_shaders, "particle", particle_shader_feature_defines, particle_shader_feature_defines_count
+    , sizeof(ParticleShader), &request_particle_shader, &resolve_particle_shader);
+
+  const uint32_t textured = PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_TEXTURED);
+  const uint32_t shading_keys[] = { 0, textured, textured | PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_SOFT) };
+  const uint32_t analytic_keys[] = { 0, PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_ANALYTIC) };
+  for (unsigned a = 0; a < STATIC_ELEMENT_COUNT(analytic_keys); a++) {
+    for (unsigned i = 0; i < STATIC_ELEMENT_COUNT(shading_keys); i++) {
+      permutation_cache_prefetch(&f->particle_shaders, analytic_keys[a] | shading_keys[i]);
+      if (f->has_oit) {
+        permutation_cache_prefetch(&f->particle_shaders, analytic_keys[a] | shading_keys[i] | PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_OIT));
+      }
+    }
+    permutation_cache_prefetch(&f->particle_shaders, analytic_keys[a] | PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_OVERDRAW));
+  }
+  permutation_cache_prefetch(&f->particle_shaders, PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_SORTED_LIST));
+
+  ProgramRequest downsample_req, composite_req, oit_resolve_req;
+  particles_gpu_initialize();
+  if (request_resolve_shader(&downsample_req, "shaders/particle_depth_downsample.frag")
+      || request_resolve_shader(&composite_req, "shaders/particle_composite.frag")
+      || (f->has_oit && request_resolve_shader(&oit_resolve_req, "shaders/particle_oit_resolve.frag"))) {
+    utility_cancel_program(&downsample_req);
+    utility_cancel_program(&composite_req);
     return 1;
   }
 
-  const char* soft_defines[] = {
-    "#define SOFT_PARTICLES\n"
-  };
-  if (load_particle_shader(&f->particle_shader_textured_soft, "shaders/particle.vert", "shaders/particle_textured.frag"
-      , soft_defines, STATIC_ELEMENT_COUNT(soft_defines))) {
+  utility_wait_programs("Initializing forward renderer...", update_loading_cb);
+
+  if (permutation_cache_finish(&f->particle_shaders)
+      || resolve_resolve_shader(&f->downsample_shader, &downsample_req)
+      || resolve_resolve_shader(&f->composite_shader, &composite_req)
+      || (f->has_oit && resolve_resolve_shader(&f->oit_resolve_shader, &oit_resolve_req))) {
+    printf("Unable to load particle shaders\n");
+    utility_cancel_program(&downsample_req);
+    utility_cancel_program(&composite_req);
+    utility_cancel_program(&oit_resolve_req);
     return 1;
   }
+  particles_gpu_finish();
 
-  if ((f->light_icon = utility_load_texture(GL_TEXTURE_2D, "icons/lightbulb.png")) == 0) {
+  GLuint light_icon;
+  if ((light_icon = utility_load_texture(GL_TEXTURE_2D, "icons/lightbulb.png", 0)) == 0) {
     return 1;
   }
+  f->light_icon = utility_build_texture_array(&light_icon, 1, LIGHT_ICON_SIZE);
+  GL_WRAP(glDeleteTextures(1, &light_icon));
+  f->batch_emitters = 1;
+  f->has_sorted_list = particle_shader(f, PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_SORTED_LIST)) != NULL;
+
+  GL_WRAP(glGenBuffers(1, &f->quad_vbo));
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, f->quad_vbo));
+  GL_WRAP(glBufferData(GL_ARRAY_BUFFER, sizeof(sQuadVertices), sQuadVertices, GL_STATIC_DRAW));
+  GL_WRAP(glGenBuffers(1, &f->instance_vbo));
+  GL_WRAP(glGenBuffers(1, &f->analytic_vbo));
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
 
   return 0;
 }
 
-void forward_render(Forward* f, const Scene *s) {
-  // bind default backbuffer
-  GL_WRAP(glDepthMask(GL_FALSE));
+// Uploads the transforms of count scene emitters (or the light icon, -1)
+// into the shader's per emitter slots, in order
+static void bind_emitter_slots(const ParticleShader* shader, const int* emitters, int count, const Scene *s) {
+  mat4x4 mvp[PARTICLE_BATCH_MAX];
+  mat4x4 billboard[PARTICLE_BATCH_MAX];
+  int screen_aligned[PARTICLE_BATCH_MAX];
+  for (int i = 0; i < count; i++) {
+    // calculate model matrix
+    mat4x4 model;
+    emitter_model(model, emitters[i], s);
+    mat4x4_mul(mvp[i], s->camera.viewProj, model);
 
-  // setup render state
-  GL_WRAP(glDisable(GL_CULL_FACE));
-  GL_WRAP(glEnable(GL_BLEND));
-  GL_WRAP(glBlendEquation(GL_FUNC_ADD));
+    // screen aligned particles all share one camera facing rotation, the
+    // light icon always faces the camera
+    screen_aligned[i] = emitters[i] < 0 || s->emitters[emitters[i]]->desc->orient_mode == PARTICLE_ORIENT_SCREEN_ALIGNED;
+    if (screen_aligned[i]) {
+      calculate_billboard(billboard[i], model, s);
+    } else {
+      mat4x4_identity(billboard[i]);
+    }
+  }
+  GL_WRAP(glUniformMatrix4fv(shader->modelviewproj_loc, count, GL_FALSE, (const GLfloat*)mvp));
+  GL_WRAP(glUniform1iv(shader->screen_aligned_loc, count, screen_aligned));
+  GL_WRAP(glUniformMatrix4fv(shader->billboard_loc, count, GL_FALSE, (const GLfloat*)billboard));
+}
 
-  // draw emitters
-  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
-    if (!s->emitters[i])
-      continue;
+static void draw_emitter(const Forward* f, const ParticleShader* shader, int index, const Scene *s) {
+  const ParticleEmitter* emitter = s->emitters[index];
+  bind_emitter_slots(shader, &index, 1, s);
 
-    ParticleEmitter* emitter = s->emitters[i];
-    const ParticleEmitterDesc* desc = emitter->desc;
-
-    const ParticleShader* shader = NULL;
-    switch (desc->shading_mode) {
-      case PARTICLE_SHADING_TEXTURED: {
-        if (desc->soft) {
-          shader = &f->particle_shader_textured_soft;
-        }
-        else {
-          shader = &f->particle_shader_textured;
-        }
-        break;
-      }
-      case PARTICLE_SHADING_FLAT: //  fallthrough
-      default: shader = &f->particle_shader_flat;
+  // GPU and analytic instances have no batch attribute, they take slot 0
+  // and their layer from the constant attribute value
+  if (shader->batch_loc >= 0) {
+    GL_WRAP(glVertexAttrib2f(shader->batch_loc, 0.0f, (float)atlas_layer(emitter->desc->texture)));
+  }
+
+  // draw particles
+  if (particles_gpu_enabled(emitter)) {
+    draw_gpu_instances(f, shader, emitter);
+  } else if (particle_emitter_analytic(emitter)) {
+    draw_analytic_instances(f, shader, emitter, f->emitter_first[index], emitter->count);
+  } else {
+    draw_instances(f, shader, f->emitter_first[index], emitter->count);
+  }
+}
+
+static void draw_batch(const Forward* f, const ParticleShader* shader, const ParticleBatch* batch, const Scene *s) {
+  bind_emitter_slots(shader, batch->emitters, batch->emitters_count, s);
+  draw_instances(f, shader, batch->first, batch->count);
+}
+
+// Draws the sorted transparency list over the output in one alpha blended
+// call. Each slot picks its own shading, the icon's is textured and hard.
+static void draw_sorted_list(const Forward* f, const Scene *s, GLuint depth_tex) {
+  const ParticleBatch* list = &f->sorted_list;
+  const ParticleShader* shader = list->shader;
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)); // alpha blend
+
+  int textured[PARTICLE_BATCH_MAX];
+  int soft[PARTICLE_BATCH_MAX];
+  textured[0] = 1;
+  soft[0] = 0;
+  for (int slot = 1; slot < list->emitters_count; slot++) {
+    const ParticleEmitterDesc* desc = s->emitters[list->emitters[slot]]->desc;
+    textured[slot] = desc->shading_mode == PARTICLE_SHADING_TEXTURED;
+    soft[slot] = desc->soft && depth_tex;
+  }
+  GL_WRAP(glUniform1iv(shader->textured_loc, list->emitters_count, textured));
+  GL_WRAP(glUniform1iv(shader->soft_loc, list->emitters_count, soft));
+
+  if (depth_tex) {
+    GL_WRAP(glActiveTexture(GL_TEXTURE0));
+    GL_WRAP(glBindTexture(GL_TEXTURE_2D, depth_tex));
+    GL_WRAP(glUniform1i(shader->gbuffer_depth_loc, 0));
+    GL_WRAP(glUniform1f(shader->z_near_loc, Z_NEAR));
+    GL_WRAP(glUniform1f(shader->z_far_loc, Z_FAR));
+    GL_WRAP(glUniform1i(shader->reverse_z_loc, s->camera.reverse_z));
+  }
+  GL_WRAP(glActiveTexture(GL_TEXTURE1));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D_ARRAY, gParticleAtlas));
+  GL_WRAP(glUniform1i(shader->texture_loc, 1));
+  GL_WRAP(glActiveTexture(GL_TEXTURE2));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D_ARRAY, f->light_icon));
+  GL_WRAP(glUniform1i(shader->icon_loc, 2));
+
+  draw_batch(f, shader, list, s);
+}
+
+void forward_simulate(const Scene *s) {
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    if (s->emitters[i]) {
+      particles_gpu_step(s->emitters[i]);
     }
+  }
+}
 
-    // bind particle program
-    GL_WRAP(glUseProgram(shader->program));
-    GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-    GL_WRAP(glViewport(VIEWPORT_X_OFFSET, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT));
+// where render_emitters draws to
+typedef enum
+{
+  FORWARD_TARGET_OUTPUT,
+  FORWARD_TARGET_REDUCED, // a ParticleTarget
+  FORWARD_TARGET_OIT      // the g-buffer's OIT targets
+} ForwardTarget;
+
+// alpha blended emitters the scene left unsorted are accumulated for OIT
+static int uses_oit(const Forward* f, const Scene *s, const ParticleEmitter* emitter) {
+  return f->has_oit && f->g_buffer && emitter->desc->depth_sort_alpha_blend && !scene_emitter_sorted(s, emitter);
+}
+
+static int draws_emitter(const Forward* f, const Scene *s, const ParticleEmitter* emitter, ParticleResolution resolution, ForwardTarget target) {
+  if (!emitter || !emitter->visible || emitter->desc->resolution != resolution)
+    return 0;
+  return uses_oit(f, s, emitter) == (target == FORWARD_TARGET_OIT);
+}
+
+static int has_emitters(const Forward* f, const Scene *s, ParticleResolution resolution, ForwardTarget target) {
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    if (draws_emitter(f, s, s->emitters[i], resolution, target))
+      return 1;
+  }
+  return 0;
+}
+
+// Particle targets also carry the transmittance in alpha, which additive
+// particles leave alone. The OIT targets blend per draw buffer, set up by
+// render_oit.
+static void select_blend_mode(const ParticleEmitterDesc* desc, ForwardTarget target) {
+  if (target == FORWARD_TARGET_OIT)
+    return;
 
-    // depth sort and select blend mode
-    if (desc->depth_sort_alpha_blend) {
-      particle_emitter_sort(emitter, s->camera.pos);
+  if (desc->depth_sort_alpha_blend) {
+    if (target == FORWARD_TARGET_REDUCED) {
+      GL_WRAP(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA));
+    } else {
       GL_WRAP(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)); // alpha blend
+    }
+  } else {
+    if (target == FORWARD_TARGET_REDUCED) {
+      GL_WRAP(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE));
     } else {
       GL_WRAP(glBlendFunc(GL_SRC_ALPHA, GL_ONE)); // additive blend
     }
+  }
+}
 
-    // calculate model matrix
-    mat4x4 model;
-    mat4x4_make_transform_uscale(model, emitter->scale, emitter->rot, emitter->pos);
+// Binds the program and state drawing desc's particles into target, soft
+// particles fading against depth_tex
+static void bind_emitter_program(const Scene *s, const ParticleShader* shader, const ParticleEmitterDesc* desc, GLuint depth_tex, ForwardTarget target) {
+  // bind particle program
+  GL_WRAP(glUseProgram(shader->program));
 
-    // bind model-view-projection matrix
-    mat4x4 mvp;
-    mat4x4_mul(mvp, s->camera.viewProj, model);
-    GL_WRAP(glUniformMatrix4fv(shader->modelviewproj_loc, 1, GL_FALSE, (const GLfloat*)mvp));
+  // select blend mode, particle_emitter_sort left sorted emitters farthest
+  // first when they were streamed
+  select_blend_mode(desc, target);
+
+  // bind depth texture for 'soft' particles
+  if (desc->soft && depth_tex && shader->gbuffer_depth_loc != -1) {
+    GL_WRAP(glActiveTexture(GL_TEXTURE0));
+    GL_WRAP(glBindTexture(GL_TEXTURE_2D, depth_tex));
+    GL_WRAP(glUniform1i(shader->gbuffer_depth_loc, 0));
+    GL_WRAP(glUniform1f(shader->z_near_loc, Z_NEAR));
+    GL_WRAP(glUniform1f(shader->z_far_loc, Z_FAR));
+    GL_WRAP(glUniform1i(shader->reverse_z_loc, s->camera.reverse_z));
+  }
+
+  // every texture is a layer of the atlas
+  if (shader->texture_loc >= 0) {
+    GL_WRAP(glUniform1i(shader->texture_loc, 1));
+  }
+}
+
+// Draws the visible emitters of one resolution into the bound target, soft
+// particles fading against depth_tex
+static void render_emitters(Forward* f, const Scene *s, ParticleResolution resolution, GLuint depth_tex, ForwardTarget target) {
+  GL_WRAP(glActiveTexture(GL_TEXTURE1));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D_ARRAY, gParticleAtlas));
+
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    if (!draws_emitter(f, s, s->emitters[i], resolution, target) || f->emitter_batch[i] >= 0)
+      continue;
+
+    ParticleEmitter* emitter = s->emitters[i];
+    const ParticleShader* shader = select_particle_shader(f, emitter, target == FORWARD_TARGET_OIT);
+    if (!shader)
+      continue;
+    bind_emitter_program(s, shader, emitter->desc, depth_tex, target);
+    draw_emitter(f, shader, i, s);
+  }
+
+  // batches are additive, so never part of the OIT
+  if (target == FORWARD_TARGET_OIT)
+    return;
+
+  for (int i = 0; i < f->batches_count; i++) {
+    const ParticleBatch* batch = &f->batches[i];
+    if (batch->resolution != resolution || !batch->shader)
+      continue;
+
+    // emitters of a batch only differ in what the per emitter slots hold
+    bind_emitter_program(s, batch->shader, s->emitters[batch->emitters[0]]->desc, depth_tex, target);
+    draw_batch(f, batch->shader, batch, s);
+  }
+}
+
+static void blend_func_indexed(GLuint buf, GLenum src, GLenum dst) {
+  if (GLEW_VERSION_4_0) {
+    GL_WRAP(glBlendFunci(buf, src, dst));
+  } else {
+    GL_WRAP(glBlendFunciARB(buf, src, dst));
+  }
+}
+
+// Accumulates the OIT emitters in any order, then resolves them over the
+// output in one pass. Leaves the output bound.
+static void render_oit(Forward* f, const Scene *s) {
+  GBuffer* g_buffer = f->g_buffer;
+  gbuffer_bind_oit(g_buffer);
+
+  // summed weighted color over full revealage
+  const GLfloat clear_accum[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  const GLfloat clear_revealage[] = { 1.0f, 0.0f, 0.0f, 0.0f };
+  GL_WRAP(glClearBufferfv(GL_COLOR, 0, clear_accum));
+  GL_WRAP(glClearBufferfv(GL_COLOR, 1, clear_revealage));
+  blend_func_indexed(0, GL_ONE, GL_ONE);
+  blend_func_indexed(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+  render_emitters(f, s, PARTICLE_RESOLUTION_FULL, g_buffer->depth_render_buffer, FORWARD_TARGET_OIT);
 
-    // bind depth texture for 'soft' particles
-    if (desc->soft && f->g_buffer && shader->gbuffer_depth_loc != -1) {
-      GL_WRAP(glActiveTexture(GL_TEXTURE0));
-      GL_WRAP(glBindTexture(GL_TEXTURE_2D, f->g_buffer->depth_render_buffer));
-      GL_WRAP(glUniform1i(shader->gbuffer_depth_loc, 0));
+  gbuffer_bind_output(g_buffer);
+  const ParticleResolveShader* shader = &f->oit_resolve_shader;
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+  GL_WRAP(glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA));
+
+  GL_WRAP(glActiveTexture(GL_TEXTURE0));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, g_buffer->oit_accum_render_buffer));
+  GL_WRAP(glUniform1i(shader->accum_loc, 0));
+  GL_WRAP(glActiveTexture(GL_TEXTURE1));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, g_buffer->oit_revealage_render_buffer));
+  GL_WRAP(glUniform1i(shader->revealage_loc, 1));
+  utility_draw_fullscreen_quad(shader->texcoord_loc, shader->pos_loc);
+
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
+}
+
+void forward_render(Forward* f, const Scene *s) {
+  // bind the output target, depth tested against the g-buffer depth
+  gbuffer_bind_output(f->g_buffer);
+  GL_WRAP(glDepthMask(GL_FALSE));
+
+  // setup render state
+  GL_WRAP(glDisable(GL_CULL_FACE));
+  GL_WRAP(glEnable(GL_BLEND));
+  GL_WRAP(glBlendEquation(GL_FUNC_ADD));
+
+  // sort and upload every emitter's particles at once
+  stream_instances(f, s, 1);
+
+  // draw full resolution emitters, then resolve the unsorted alpha blended
+  // ones over them
+  GLuint depth_tex = f->g_buffer ? f->g_buffer->depth_render_buffer : 0;
+  render_emitters(f, s, PARTICLE_RESOLUTION_FULL, depth_tex, FORWARD_TARGET_OUTPUT);
+  if (has_emitters(f, s, PARTICLE_RESOLUTION_FULL, FORWARD_TARGET_OIT)) {
+    render_oit(f, s);
+  }
+
+  // draw reduced resolution emitters offscreen and upsample them over the
+  // output, falling back to full resolution without a target
+  for (int r = PARTICLE_RESOLUTION_HALF; r < particle_resolution_strings_count; r++) {
+    ParticleResolution resolution = (ParticleResolution)r;
+    if (!has_emitters(f, s, resolution, FORWARD_TARGET_OUTPUT))
+      continue;
+
+    ParticleTarget* target = &f->targets[r - 1];
+    if (!f->g_buffer || begin_particle_target(f, target, 1 << r, s)) {
+      render_emitters(f, s, resolution, depth_tex, FORWARD_TARGET_OUTPUT);
+      continue;
     }
+    render_emitters(f, s, resolution, target->depth_render_buffer, FORWARD_TARGET_REDUCED);
 
-    // bind texture
-    if (shader->texture_loc >= 0 && desc->texture > 0) {
-      GL_WRAP(glActiveTexture(GL_TEXTURE1));
-      GL_WRAP(glBindTexture(GL_TEXTURE_2D, desc->texture));
-      GL_WRAP(glUniform1i(shader->texture_loc, 1));
+    gbuffer_bind_output(f->g_buffer);
+    if (f->compare_resolution) {
+      int half_width = f->g_buffer->width / 2;
+      GL_WRAP(glEnable(GL_SCISSOR_TEST));
+      GL_WRAP(glScissor(half_width, 0, f->g_buffer->width - half_width, f->g_buffer->height));
+      render_emitters(f, s, resolution, depth_tex, FORWARD_TARGET_OUTPUT);
+      GL_WRAP(glScissor(0, 0, half_width, f->g_buffer->height));
     }
+    composite_particle_target(f, target, s);
+    GL_WRAP(glDisable(GL_SCISSOR_TEST));
+  }
 
-    // calc optional billboarding euler angles
-    vec3 euler;
-    if (desc->orient_mode == PARTICLE_ORIENT_SCREEN_ALIGNED) {
-      calculate_billboard_euler(euler, model, s);
+  // Draw the sorted transparency list, which holds the main light icon,
+  // or the icon alone
+  if (f->sorted_list.count > 0) {
+    draw_sorted_list(f, s, depth_tex);
+  } else {
+    const ParticleShader* icon_shader = particle_shader(f, PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_TEXTURED));
+    if (icon_shader) {
+      GL_WRAP(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)); // alpha blend
+      draw_billboard(f, icon_shader, f->light_icon, s->light->position, s);
     }
+  }
 
-    // draw particles
-    for (int j = 0; j < emitter->count; j++) {
-      const Particle* part;
-      if (desc->depth_sort_alpha_blend) {
-        part = &emitter->particles[emitter->sort_records[j].index];
-      } else {
-        part = &emitter->particles[j];
-      }
+  GL_WRAP(glDepthMask(GL_TRUE));
+}
 
-      vec3 rot;
-      if (desc->orient_mode == PARTICLE_ORIENT_SCREEN_ALIGNED) {
-        vec3_dup(rot, euler);
-      } else {
-        vec3_dup(rot, part->rot);
-      }
+void forward_render_overdraw(Forward* f, const Scene *s) {
+  const uint32_t overdraw = PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_OVERDRAW);
+  const ParticleShader* shader = particle_shader(f, overdraw);
+  const ParticleShader* analytic_shader = particle_shader(f, overdraw | PERMUTATION_BIT(PARTICLE_SHADER_FEATURE_ANALYTIC));
+  if (!shader || !analytic_shader)
+    return;
 
-      draw_quad(shader, part->pos, rot, part->scale, part->color);
+  // every rasterized fragment adds one to the counter target, occluded or not
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+  GL_WRAP(glDisable(GL_CULL_FACE));
+  GL_WRAP(glEnable(GL_BLEND));
+  GL_WRAP(glBlendEquation(GL_FUNC_ADD));
+  GL_WRAP(glBlendFunc(GL_ONE, GL_ONE));
+
+  stream_instances(f, s, 0);
+
+  for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
+    if (s->emitters[i] && s->emitters[i]->visible && f->emitter_batch[i] < 0) {
+      const ParticleShader* emitter_shader = particle_emitter_analytic(s->emitters[i]) ? analytic_shader : shader;
+      GL_WRAP(glUseProgram(emitter_shader->program));
+      draw_emitter(f, emitter_shader, i, s);
     }
   }
+  GL_WRAP(glUseProgram(shader->program));
+  for (int i = 0; i < f->batches_count; i++) {
+    draw_batch(f, shader, &f->batches[i], s);
+  }
+  draw_billboard(f, shader, f->light_icon, s->light->position, s);
 
-  // Draw main light icon
-  draw_billboard(f, f->light_icon, s->light->position, 2.0f, s);
-
-  GL_WRAP(glDepthMask(GL_TRUE));
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
 }
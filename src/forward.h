@@ -3,6 +3,28 @@
 #include "common.h"
 #include "gbuffer.h"
 #include "scene.h"
+#include "permutation.h"
+
+// emitters drawn by one batched call, mirrored in particle.vert
+#define PARTICLE_BATCH_MAX 16
+
+// Forward.emitter_batch of the emitters in the sorted transparency list
+#define PARTICLE_BATCH_SORTED_LIST SCENE_EMITTERS_MAX
+
+// Particle shader variants. Overdraw selects overdraw.frag, textured and
+// the sorted list particle_textured.frag, anything else particle_flat.frag.
+// Analytic particles are evaluated from their age, OIT variants write
+// weighted blended OIT accumulation and revealage, and the sorted list
+// variant shades flat, textured and soft emitters alike.
+#define ENUM_ParticleShaderFeature(D)                                        \
+  D(PARTICLE_SHADER_FEATURE_TEXTURED,     "#define PARTICLE_TEXTURED\n")     \
+  D(PARTICLE_SHADER_FEATURE_SOFT,         "#define SOFT_PARTICLES\n")        \
+  D(PARTICLE_SHADER_FEATURE_OVERDRAW,     "#define PARTICLE_OVERDRAW\n")     \
+  D(PARTICLE_SHADER_FEATURE_ANALYTIC,     "#define ANALYTIC_PARTICLES\n")    \
+  D(PARTICLE_SHADER_FEATURE_OIT,          "#define WEIGHTED_OIT\n")          \
+  D(PARTICLE_SHADER_FEATURE_SORTED_LIST,  "#define SORTED_LIST\n")
+
+DECLARE_ENUM(ParticleShaderFeature, particle_shader_feature_defines, ENUM_ParticleShaderFeature);
 
 typedef struct
 {
@@ -15,25 +37,185 @@ typedef struct
   GLint scale_loc;
   GLint uv_loc;
   GLint color_loc;
+  GLint velocity_loc;
+  GLint batch_loc;
 
   // uniforms
   GLint modelviewproj_loc;
+  GLint screen_aligned_loc;
+  GLint billboard_loc;
   GLint texture_loc;
   GLint gbuffer_depth_loc;
+  GLint z_near_loc;
+  GLint z_far_loc;
+  GLint reverse_z_loc;
+
+  // analytic variant only
+  GLint time_loc;
+  GLint gravity_loc;
+  GLint start_color_loc;
+  GLint end_color_loc;
+  GLint scale_ramp_loc;
+
+  // sorted list variant only
+  GLint icon_loc;
+  GLint textured_loc;
+  GLint soft_loc;
 } ParticleShader;
 
+// fullscreen passes around the reduced resolution particle targets
+typedef struct
+{
+  GLuint program;
+
+  // attributes
+  GLint pos_loc;
+  GLint texcoord_loc;
+
+  // uniforms
+  GLint gbuffer_depth_loc;
+  GLint z_near_loc;
+  GLint z_far_loc;
+  GLint reverse_z_loc;
+
+  // downsample only
+  GLint divisor_loc;
+
+  // composite only
+  GLint particles_loc;
+  GLint depth_range_loc;
+
+  // OIT resolve only
+  GLint accum_loc;
+  GLint revealage_loc;
+} ParticleResolveShader;
+
+// Reduced resolution particle target, created on first use. Color holds
+// premultiplied color over the transmittance left in alpha, so it composites
+// over the output in one blend. Depth holds the farthest g-buffer depth of
+// each block and depth_range the nearest and farthest linear depths.
+typedef struct
+{
+  int divisor;
+  int width, height;
+
+  GLuint fbo;
+  GLuint color_render_buffer;
+  GLuint depth_range_render_buffer;
+  GLuint depth_render_buffer;
+} ParticleTarget;
+
+// per-instance vertex data of one particle quad
 typedef struct
 {
-  ParticleShader particle_shader_flat;
-  ParticleShader particle_shader_textured;
-  ParticleShader particle_shader_textured_soft;
+  vec3 pos;
+  vec3 rot;
+  vec3 scale;
+  vec4 color;
+  vec2 batch; // emitter slot in its batch, atlas layer
+} ParticleInstance;
+
+// Additive CPU emitters sharing a shader and a resolution, drawn with one
+// instanced call. Their instances are contiguous and every emitter's
+// transform sits in its own slot of the shader's per emitter uniforms.
+// The sorted transparency list is a batch too, with the light icon (-1) in
+// slot 0 and its instances ordered back to front across emitters.
+typedef struct
+{
+  const ParticleShader* shader;
+  ParticleResolution resolution;
+  int first;
+  int count;
+  int emitters[PARTICLE_BATCH_MAX]; // scene emitter index of each slot, -1 for the light icon
+  int emitters_count;
+} ParticleBatch;
+
+// per-instance vertex data of one analytic particle, its spawn state
+typedef struct
+{
+  vec3 velocity;
+  float born;
+  vec3 rot;
+  float life_time;
+} AnalyticParticleInstance;
+
+typedef struct
+{
+  PermutationCache particle_shaders; // ParticleShader, keyed by ParticleShaderFeature bits
+
+  // per draw buffer blending is available for weighted blended OIT, the
+  // OIT variants are only built when set
+  int has_oit;
+
+  // downsamples the g-buffer depth and upsamples the reduced resolution
+  // particles into the output
+  ParticleResolveShader downsample_shader;
+  ParticleResolveShader composite_shader;
+  ParticleResolveShader oit_resolve_shader;
+
+  // one per reduced ParticleResolution, needs the g-buffer
+  ParticleTarget targets[2];
+
+  // if true, the right half of the view draws every emitter at full
+  // resolution to compare against the reduced resolution left half
+  int compare_resolution;
 
   // Optional gbuffer
   GBuffer* g_buffer;
 
-  // Light 2d icon
+  // Light icon, a single layer array like the particle atlas
   GLuint light_icon;
+
+  // unit quad, drawn once per particle instance
+  GLuint quad_vbo;
+
+  // instances of every emitter, refilled and uploaded once per frame
+  GLuint instance_vbo;
+  ParticleInstance* instances;
+  int instances_count;
+  int instances_max;
+
+  // instances of the analytic emitters, uploaded alongside
+  GLuint analytic_vbo;
+  AnalyticParticleInstance* analytic_instances;
+  int analytic_count;
+  int analytic_max;
+
+  // where each emitter's (and the light icon's) instances start this frame,
+  // in the array matching the emitter
+  int emitter_first[SCENE_EMITTERS_MAX];
+  int icon_first;
+
+  // if true, additive emitters are merged into batches when streamed
+  int batch_emitters;
+  ParticleBatch batches[SCENE_EMITTERS_MAX];
+  int batches_count;
+
+  // index of the batch drawing each emitter this frame, -1 if drawn alone
+  // and PARTICLE_BATCH_SORTED_LIST if in the sorted transparency list
+  int emitter_batch[SCENE_EMITTERS_MAX];
+
+  // the emitters the scene listed (see Scene::particle_sorted_list) and the
+  // light icon, merged into one list, sorted once and drawn with one call.
+  // has_sorted_list is set when its shader built.
+  int has_sorted_list;
+  ParticleBatch sorted_list;
+
+  // the list's sort keys, the radix sort's ping-pong records and the
+  // instances being reordered, list_max of each
+  SortRecord* list_records;
+  SortRecord* list_scratch;
+  ParticleInstance* list_instances;
+  int list_max;
 } Forward;
 
-int forward_initialize(Forward* f);
+int forward_initialize(Forward* f, LoadingCallback update_loading_cb);
+// advances the GPU simulated emitters, before any of them is drawn
+void forward_simulate(const Scene *s);
 void forward_render(Forward* f, const Scene *s);
+void forward_render_overdraw(Forward* f, const Scene *s);
+
+// Orders the sorted list's instances, each in the space of its slot's
+// emitter (or the light icon), farthest from the camera's eye first with
+// one radix sort. Needs no GL context.
+void forward_sort_list(Forward* f, const Scene *s);
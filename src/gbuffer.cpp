@@ -20,11 +20,15 @@ static GLuint generate_render_buffer() {
 
 static GLuint initialize_depthbuffer(int width, int height) {
   GLuint depth_render_buffer = generate_render_buffer();
-  GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, 0));
-  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_render_buffer, 0));
+  GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH32F_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 0));
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_render_buffer, 0));
   return depth_render_buffer;
 }
 
+static void attach_depthbuffer(GLuint depth_render_buffer) {
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_render_buffer, 0));
+}
+
 static GLuint initialize_attachment(GLenum attachment_slot, GLenum format, int width, int height) {
   GLuint attachment = generate_render_buffer();
   GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_FLOAT, 0));
@@ -57,6 +61,57 @@ int gbuffer_initialize(GBuffer *g_buffer, int width, int height) {
   GL_WRAP(glDrawBuffers(STATIC_ELEMENT_COUNT(DrawBuffers), DrawBuffers));
 
   GLenum fbo_status;
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE)
+    return 1;
+
+  // Initialize overdraw counter target
+  GL_WRAP(glGenFramebuffers(1, &g_buffer->overdraw_fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->overdraw_fbo));
+  g_buffer->overdraw_render_buffer = initialize_attachment(GL_COLOR_ATTACHMENT0, GL_R16F, width, height);
+  attach_depthbuffer(g_buffer->depth_render_buffer);
+  GL_WRAP(glDrawBuffer(GL_COLOR_ATTACHMENT0));
+
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE)
+    return 1;
+
+  // Initialize weighted blended OIT targets
+  GL_WRAP(glGenFramebuffers(1, &g_buffer->oit_fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->oit_fbo));
+  g_buffer->oit_accum_render_buffer = initialize_attachment(GL_COLOR_ATTACHMENT0, GL_RGBA16F, width, height);
+  g_buffer->oit_revealage_render_buffer = initialize_attachment(GL_COLOR_ATTACHMENT1, GL_R8, width, height);
+  attach_depthbuffer(g_buffer->depth_render_buffer);
+  GLenum OitBuffers[] = {
+    GL_COLOR_ATTACHMENT0,
+    GL_COLOR_ATTACHMENT1
+  };
+  GL_WRAP(glDrawBuffers(STATIC_ELEMENT_COUNT(OitBuffers), OitBuffers));
+
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE)
+    return 1;
+
+  // Initialize visibility target
+  GL_WRAP(glGenFramebuffers(1, &g_buffer->visibility_fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->visibility_fbo));
+  g_buffer->visibility_render_buffer = generate_render_buffer();
+  GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, 0));
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_buffer->visibility_render_buffer, 0));
+  attach_depthbuffer(g_buffer->depth_render_buffer);
+  GL_WRAP(glDrawBuffer(GL_COLOR_ATTACHMENT0));
+
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE)
+    return 1;
+
+  // Initialize output target, sharing the g-buffer depth + stencil
+  GL_WRAP(glGenFramebuffers(1, &g_buffer->output_fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->output_fbo));
+  g_buffer->output_render_buffer = initialize_attachment(GL_COLOR_ATTACHMENT0, GL_SRGB8_ALPHA8, width, height);
+  attach_depthbuffer(g_buffer->depth_render_buffer);
+  GL_WRAP(glDrawBuffer(GL_COLOR_ATTACHMENT0));
+
   GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
   if (fbo_status != GL_FRAMEBUFFER_COMPLETE)
     return 1;
@@ -68,3 +123,34 @@ void gbuffer_bind(GBuffer *g_buffer) {
   GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->fbo));
   GL_WRAP(glViewport(0, 0, g_buffer->width, g_buffer->height));
 }
+
+void gbuffer_bind_overdraw(GBuffer *g_buffer) {
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->overdraw_fbo));
+  GL_WRAP(glViewport(0, 0, g_buffer->width, g_buffer->height));
+}
+
+void gbuffer_bind_oit(GBuffer *g_buffer) {
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->oit_fbo));
+  GL_WRAP(glViewport(0, 0, g_buffer->width, g_buffer->height));
+}
+
+void gbuffer_bind_visibility(GBuffer *g_buffer) {
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->visibility_fbo));
+  GL_WRAP(glViewport(0, 0, g_buffer->width, g_buffer->height));
+}
+
+void gbuffer_bind_output(GBuffer *g_buffer) {
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, g_buffer->output_fbo));
+  GL_WRAP(glViewport(0, 0, g_buffer->width, g_buffer->height));
+}
+
+void gbuffer_blit_output(GBuffer *g_buffer, int x_off, int y_off) {
+  // with sRGB conversion off the blit copies the encoded values as-is
+  GL_WRAP(glDisable(GL_FRAMEBUFFER_SRGB));
+  GL_WRAP(glBindFramebuffer(GL_READ_FRAMEBUFFER, g_buffer->output_fbo));
+  GL_WRAP(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));
+  GL_WRAP(glBlitFramebuffer(0, 0, g_buffer->width, g_buffer->height,
+    x_off, y_off, x_off + g_buffer->width, y_off + g_buffer->height,
+    GL_COLOR_BUFFER_BIT, GL_NEAREST));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+}
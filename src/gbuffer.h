@@ -24,8 +24,31 @@ typedef struct
     };
     GLint attachments[GBUFFER_ATTACHMENTS_COUNT];
   };
+
+  // additive counter target for the overdraw/complexity debug views
+  GLuint overdraw_fbo;
+  GLuint overdraw_render_buffer;
+
+  // weighted blended OIT accumulation (RGBA16F) and revealage (R8), depth
+  // tested against the g-buffer depth
+  GLuint oit_fbo;
+  GLuint oit_accum_render_buffer;
+  GLuint oit_revealage_render_buffer;
+
+  // visibility buffer ids, drawn against the g-buffer depth + stencil
+  GLuint visibility_fbo;
+  GLuint visibility_render_buffer;
+
+  // final sRGB color target; geometry pixels are marked with stencil = 1
+  GLuint output_fbo;
+  GLuint output_render_buffer;
 } GBuffer;
 
 
 int gbuffer_initialize(GBuffer *g_buffer, int width, int height);
 void gbuffer_bind(GBuffer *g_buffer);
+void gbuffer_bind_overdraw(GBuffer *g_buffer);
+void gbuffer_bind_oit(GBuffer *g_buffer);
+void gbuffer_bind_visibility(GBuffer *g_buffer);
+void gbuffer_bind_output(GBuffer *g_buffer);
+void gbuffer_blit_output(GBuffer *g_buffer, int x_off, int y_off);
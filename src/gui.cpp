@@ -1,5 +1,6 @@
 #include "gui.h"
 #include "assets.h"
+#include "particle_pool.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_custom_theme.h"
@@ -120,6 +121,13 @@ void gui_render(SDL_Window* window, Renderer* renderer, Scene* scene, float dt,
   );
   ImGui::Combo("Render Mode", (int*)&renderer->deferred.render_mode, render_mode_strings, render_mode_strings_count);
   ImGui::Combo("Tonemapping Operator", (int*)&renderer->deferred.tonemapping_op, tonemapping_op_strings, tonemapping_op_strings_count);
+  if (renderer->deferred.render_mode == RENDER_MODE_OVERDRAW
+      || renderer->deferred.render_mode == RENDER_MODE_LIGHTING_COMPLEXITY) {
+    ImGui::SliderFloat("Heatmap Max", (float*)&renderer->deferred.heatmap_max, 1.0f, 32.0f);
+  }
+  if (renderer->deferred.has_visibility_buffer) {
+    ImGui::Checkbox("Visibility Buffer", (bool*)&renderer->deferred.visibility_buffer);
+  }
   ImGui::SliderFloat("AO Strength", (float*)&renderer->deferred.ao_strength, 0.0f, 10.0f);
   ImGui::Checkbox("Show Debug Lines", (bool*)&renderer->render_debug_lines);
   ImGui::Separator();
@@ -127,6 +135,9 @@ void gui_render(SDL_Window* window, Renderer* renderer, Scene* scene, float dt,
     ImGui::Checkbox("Auto Rotate", (bool*)&scene->camera.auto_rotate);
     ImGui::SliderFloat("Cam Zoom", (float*)&scene->camera.boom_len, 0.0f, 150.0f);
     ImGui::SliderFloat("FOVy", (float*)&scene->camera.fovy, 0.0f, 180.0f);
+    if (renderer->has_clip_control) {
+      ImGui::Checkbox("Reverse-Z (Infinite Far)", (bool*)&scene->camera.reverse_z);
+    }
     ImGui::SliderFloat("Exposure", (float*)&scene->camera.exposure, 0.0f, 1.0f);
   }
   if (ImGui::CollapsingHeader("Environment", ImGuiTreeNodeFlags_DefaultOpen)) {
@@ -158,6 +169,10 @@ void gui_render(SDL_Window* window, Renderer* renderer, Scene* scene, float dt,
   }
   if (ImGui::CollapsingHeader("Shadow Map", ImGuiTreeNodeFlags_DefaultOpen)) {
     ImGui::Checkbox("Show Debug View", (bool*)&renderer->debug_shadow_map);
+    shadow_map_gui(&renderer->shadow_map);
+  }
+  if (ImGui::CollapsingHeader("Profiler")) {
+    profiler_gui();
   }
   if (ImGui::Button("Save Screenshot")) {
     if (!utility_save_screenshot("./test.png", 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT)) {
@@ -221,6 +236,23 @@ void gui_render(SDL_Window* window, Renderer* renderer, Scene* scene, float dt,
     }
     if (ImGui::BeginTabItem("Emitter")) {
       particle_emitter_gui(scene->emitters[0], gParticleTextures, gParticleTexturesCount);
+      ImGui::Checkbox("Compare Full Resolution", (bool*)&renderer->forward.compare_resolution);
+      ImGui::Checkbox("Batch Additive Emitters", (bool*)&renderer->forward.batch_emitters);
+      if (renderer->forward.has_sorted_list) {
+        ImGui::Checkbox("Global Sorted Transparency", (bool*)&scene->particle_sorted_list);
+      }
+      if (renderer->forward.has_oit) {
+        ImGui::Checkbox("Weighted Blended OIT", (bool*)&scene->particle_oit);
+      }
+      if (ImGui::CollapsingHeader("Particle Pool")) {
+        particle_pool_gui();
+      }
+      if (ImGui::CollapsingHeader("Particle Budget")) {
+        const SceneParticleStats* stats = &scene->particle_stats;
+        ImGui::SliderInt("Budget", &scene->particle_budget, 0, 1 << 20, scene->particle_budget ? "%d" : "Unlimited");
+        ImGui::Text("Emitters: %i simulated, %i visible of %i", stats->emitters_simulated, stats->emitters_visible, stats->emitters);
+        ImGui::Text("Particles: %i simulated, %i drawn of %i", stats->particles_simulated, stats->particles_drawn, stats->particles);
+      }
       ImGui::EndTabItem();
     }
     ImGui::EndTabBar();
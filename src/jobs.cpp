@@ -0,0 +1,108 @@
+#include "jobs.h"
+
+typedef struct
+{
+  SDL_Thread* threads[JOBS_WORKERS_MAX];
+  int workers_count;
+  int active_workers;
+
+  // posted once per worker per parallel for, and once back when it's done
+  SDL_sem* start;
+  SDL_sem* done;
+  int quit;
+
+  // current parallel for
+  JobFunc func;
+  void* data;
+  int count;
+  SDL_atomic_t next;
+} JobPool;
+
+static JobPool sPool;
+
+static void run_jobs() {
+  int index;
+  while ((index = SDL_AtomicAdd(&sPool.next, 1)) < sPool.count) {
+    sPool.func(sPool.data, index);
+  }
+}
+
+static int worker_main(void* data) {
+  (void)data;
+  for (;;) {
+    SDL_SemWait(sPool.start);
+    if (sPool.quit)
+      return 0;
+    run_jobs();
+    SDL_SemPost(sPool.done);
+  }
+}
+
+int jobs_initialize(int worker_count) {
+  memset(&sPool, 0, sizeof(JobPool));
+  if (worker_count <= 0) {
+    worker_count = SDL_GetCPUCount() - 1;
+  }
+  worker_count = std::min(std::max(worker_count, 0), JOBS_WORKERS_MAX);
+
+  sPool.start = SDL_CreateSemaphore(0);
+  sPool.done = SDL_CreateSemaphore(0);
+  if (!sPool.start || !sPool.done) {
+    printf("Unable to create job semaphores: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  for (int i = 0; i < worker_count; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "Worker %i", i);
+    if (!(sPool.threads[i] = SDL_CreateThread(worker_main, name, NULL))) {
+      printf("Unable to create worker thread: %s\n", SDL_GetError());
+      break;
+    }
+    sPool.workers_count++;
+  }
+  sPool.active_workers = sPool.workers_count;
+  printf("Jobs -- Worker Threads: %i\n", sPool.workers_count);
+  return 0;
+}
+
+void jobs_shutdown() {
+  sPool.quit = 1;
+  for (int i = 0; i < sPool.workers_count; i++) {
+    SDL_SemPost(sPool.start);
+  }
+  for (int i = 0; i < sPool.workers_count; i++) {
+    SDL_WaitThread(sPool.threads[i], NULL);
+  }
+  if (sPool.start) SDL_DestroySemaphore(sPool.start);
+  if (sPool.done) SDL_DestroySemaphore(sPool.done);
+  memset(&sPool, 0, sizeof(JobPool));
+}
+
+int jobs_thread_count() {
+  return sPool.active_workers + 1;
+}
+
+void jobs_set_thread_count(int thread_count) {
+  sPool.active_workers = std::min(std::max(thread_count - 1, 0), sPool.workers_count);
+}
+
+void jobs_parallel_for(JobFunc func, void* data, int count) {
+  if (count <= 0)
+    return;
+
+  sPool.func = func;
+  sPool.data = data;
+  sPool.count = count;
+  SDL_AtomicSet(&sPool.next, 0);
+
+  // a single job isn't worth waking anyone for
+  int workers = std::min(sPool.active_workers, count - 1);
+  for (int i = 0; i < workers; i++) {
+    SDL_SemPost(sPool.start);
+  }
+  run_jobs();
+  for (int i = 0; i < workers; i++) {
+    SDL_SemWait(sPool.done);
+  }
+}
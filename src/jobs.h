@@ -0,0 +1,20 @@
+#pragma once
+#include "common.h"
+
+#define JOBS_WORKERS_MAX 63
+
+// Called once per index of a parallel for, from any thread
+typedef void(*JobFunc)(void* data, int index);
+
+// Starts worker_count worker threads, or one less than the cpu count when 0
+int jobs_initialize(int worker_count);
+void jobs_shutdown();
+
+// Threads a parallel for runs on, the caller included. Lowering it below
+// the started count leaves the extra workers idle (for benchmarking).
+int jobs_thread_count();
+void jobs_set_thread_count(int thread_count);
+
+// Calls func(data, i) for every i in [0, count) across the workers and the
+// calling thread and returns once every call has finished. Not reentrant.
+void jobs_parallel_for(JobFunc func, void* data, int count);
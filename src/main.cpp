@@ -3,6 +3,9 @@
 #include "gui.h"
 #include "scene.h"
 #include "renderer.h"
+#include "benchmark.h"
+#include "tests.h"
+#include "jobs.h"
 #include "physics_particles.h"
 #include "physics_rigidbodies.h"
 #include "container.h"
@@ -15,6 +18,7 @@ static Scene gScene;
 static PhysicsWorld gPhysWorld;
 static EditorState gEditor;
 static PhysicsContactGenerator* gContactGenerators[2];
+static Benchmark gBenchmark;
 
 struct Entity {
   DECLATE_INTRUSIVE_LL_MEMBERS(Entity);
@@ -65,11 +69,15 @@ static int setup_scene(int sphere_scene) {
   gScene.light = (Light*)malloc(sizeof(Light));
   vec3 lightPos = { 0.0f, 10.0f, 10.0f };
   light_initialize_point(gScene.light, lightPos, White, 100.0f);
+  vec3_srgb_to_linear(gScene.light->color, gScene.light->color); // authored in sRGB like the materials
 
   // Setup particle system
   ParticleEmitterDesc* desc = (ParticleEmitterDesc*)calloc(1, sizeof(ParticleEmitterDesc));
   gScene.emitters[0] = (ParticleEmitter*)malloc(sizeof(ParticleEmitter));
-  particle_emitter_initialize(gScene.emitters[0], desc);
+  if (particle_emitter_initialize(gScene.emitters[0], desc)) {
+    printf("Unable to initialize particle emitter\n");
+    return 1;
+  }
   gScene.emitters[0]->muted = true; // start muted
 
   // Setup model(s)
@@ -116,9 +124,10 @@ static int setup_scene(int sphere_scene) {
   return 0;
 }
 
-static int initialize() {
+static int initialize(int sphere_scene) {
   // seed not so random
   srand((unsigned)time(0));
+  utility_random_seed((uint64_t)time(0));
 
   // init imgui
   gui_initialize(gWindow);
@@ -138,7 +147,7 @@ static int initialize() {
 
   int err = 0;
   printf("<-- Initializing renderer... -->\n");
-  if ((err = renderer_initialize(&gRenderer))) {
+  if ((err = renderer_initialize(&gRenderer, &update_loading_screen))) {
     printf("Deferred renderer init failed\n");
     return err;
   }
@@ -149,11 +158,15 @@ static int initialize() {
   }
 
   printf("<-- Initializing scene... -->\n");
-  if ((err = setup_scene(false))) {
+  if ((err = setup_scene(sphere_scene))) {
     printf("Scene init failed\n");
     return err;
   }
+  gScene.camera.reverse_z = gRenderer.has_clip_control;
+  gScene.particle_oit = gRenderer.forward.has_oit;
+  gScene.particle_sorted_list = gRenderer.forward.has_sorted_list;
 
+  program_cache_print_stats();
   printf("<-- Initialization complete -->\n");
   return 0;
 }
@@ -335,8 +348,39 @@ static int frame() {
 }
 
 int main(int argc, char* argv[]) {
-  (void)(argc);
-  (void)(argv);
+  // worker threads for the scene update
+  if (jobs_initialize(0)) {
+    printf("Failed to start worker threads. Exiting.\n");
+    return -1;
+  }
+
+  // parse command line
+  int benchmark_shadows = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--benchmark-shadows")) {
+      benchmark_shadows = 1;
+    } else if (!strcmp(argv[i], "--benchmark-particles")) {
+      // cpu only, runs without a window
+      benchmark_particles();
+      jobs_shutdown();
+      return 0;
+    } else if (!strcmp(argv[i], "--benchmark-sort")) {
+      benchmark_particle_sort();
+      jobs_shutdown();
+      return 0;
+    } else if (!strcmp(argv[i], "--benchmark-emitters")) {
+      benchmark_emitters();
+      jobs_shutdown();
+      return 0;
+    } else if (!strcmp(argv[i], "--test")) {
+      // cpu only self checks, fails the process on any failure
+      int failed = tests_run();
+      jobs_shutdown();
+      return failed ? 1 : 0;
+    } else {
+      printf("Unknown argument '%s'\n", argv[i]);
+    }
+  }
 
   // init SDL
   SDL_Init(SDL_INIT_VIDEO);
@@ -353,18 +397,27 @@ int main(int argc, char* argv[]) {
 
   // init gl
   SDL_GLContext glcontext = SDL_GL_CreateContext(gWindow);
-  SDL_GL_SetSwapInterval(1); // Enable vsync
+  SDL_GL_SetSwapInterval(benchmark_shadows ? 0 : 1); // Enable vsync unless benchmarking
   glewExperimental = 1;
   glewInit();
 
   // main init
-  if(initialize()) {
+  if(initialize(benchmark_shadows)) {
     printf("Failed to initialize. Exiting.\n");
     return -1;
   }
 
+  // the shadow benchmark renders the sphere grid over the floor
+  if (benchmark_shadows) {
+    benchmark_shadows_begin(&gBenchmark, &gRenderer);
+  }
+
   // while the window is open: enter program loop
   while (!frame()) {
+    if (benchmark_shadows && benchmark_shadows_update(&gBenchmark, &gRenderer)) {
+      break;
+    }
+
     // swap
     SDL_GL_SwapWindow(gWindow);
     GL_CHECK_ERROR();
@@ -374,6 +427,7 @@ int main(int argc, char* argv[]) {
   gui_destroy();
   SDL_GL_DeleteContext(glcontext);
   SDL_DestroyWindow(gWindow);
+  jobs_shutdown();
   SDL_Quit();
   return 0;
 }
@@ -3,47 +3,35 @@
 #include "assets.h"
 #include "imgui/imgui.h"
 
-static const vec4 Normal_Z_Up = { 0.5f, 0.5f, 1.0f, 0.0f };
-
-int material_initialize_default(Material *out) {
-  memset(out, 0, sizeof(Material));
-  out->albedo_map = utility_load_texture_constant(White);
-  out->normal_map = utility_load_texture_constant(Normal_Z_Up);
-  out->height_map = utility_load_texture_constant(White);
-  out->metalness_map = utility_load_texture_constant(White);
-  out->roughness_map = utility_load_texture_constant(White);
-  out->ao_map = utility_load_texture_constant(White);
-  out->emissive_map = utility_load_texture_constant(White);
-  vec3_swizzle(out->albedo_base, 1.0f);
-  out->metalness_base = 0.0f;
-  out->roughness_base = 1.0f;
-  vec3_swizzle(out->emissive_base, 0.0f);
-  out->height_map_scale = 0.0f;
-  return 0;
-}
-
 int material_load(Material *out, const MaterialDesc *desc) {
   memset(out, 0, sizeof(Material));
 
-  if (!desc->albedo_map_path || !(out->albedo_map = utility_load_texture(GL_TEXTURE_2D, desc->albedo_map_path, desc->use_point_sampling)))
+  // color maps are sRGB, every other map is data and loaded as-is
+  const int point_flag = desc->use_point_sampling ? TEXTURE_FLAG_POINT_SAMPLING : 0;
+
+  if (!desc->albedo_map_path || !(out->albedo_map = utility_load_texture(GL_TEXTURE_2D, desc->albedo_map_path, point_flag)))
     out->albedo_map = 0;
-  if (!desc->normal_map_path || !(out->normal_map = utility_load_texture(GL_TEXTURE_2D, desc->normal_map_path, desc->use_point_sampling)))
+  if (!desc->normal_map_path || !(out->normal_map = utility_load_texture(GL_TEXTURE_2D, desc->normal_map_path, point_flag | TEXTURE_FLAG_LINEAR)))
     out->normal_map = 0;
-  if (!desc->height_map_path || !(out->height_map = utility_load_texture(GL_TEXTURE_2D, desc->height_map_path, desc->use_point_sampling)))
+  if (!desc->height_map_path || !(out->height_map = utility_load_texture(GL_TEXTURE_2D, desc->height_map_path, point_flag | TEXTURE_FLAG_LINEAR)))
     out->height_map = 0;
-  if (!desc->metalness_map_path || !(out->metalness_map = utility_load_texture(GL_TEXTURE_2D, desc->metalness_map_path, desc->use_point_sampling)))
+  if (!desc->metalness_map_path || !(out->metalness_map = utility_load_texture(GL_TEXTURE_2D, desc->metalness_map_path, point_flag | TEXTURE_FLAG_LINEAR)))
     out->metalness_map = 0;
-  if (!desc->roughness_map_path || !(out->roughness_map = utility_load_texture(GL_TEXTURE_2D, desc->roughness_map_path, desc->use_point_sampling)))
+  if (!desc->roughness_map_path || !(out->roughness_map = utility_load_texture(GL_TEXTURE_2D, desc->roughness_map_path, point_flag | TEXTURE_FLAG_LINEAR)))
     out->roughness_map = 0;
-  if (!desc->ao_map_path || !(out->ao_map = utility_load_texture(GL_TEXTURE_2D, desc->ao_map_path, desc->use_point_sampling)))
+  if (!desc->ao_map_path || !(out->ao_map = utility_load_texture(GL_TEXTURE_2D, desc->ao_map_path, point_flag | TEXTURE_FLAG_LINEAR)))
     out->ao_map = 0;
-  if (!desc->emissive_map_path || !(out->emissive_map = utility_load_texture(GL_TEXTURE_2D, desc->emissive_map_path, desc->use_point_sampling)))
+  if (!desc->emissive_map_path || !(out->emissive_map = utility_load_texture(GL_TEXTURE_2D, desc->emissive_map_path, point_flag)))
     out->emissive_map = 0;
   vec3_dup(out->albedo_base, desc->albedo_base);
   out->metalness_base = desc->metalness_base;
   out->roughness_base = desc->roughness_base;
   vec3_dup(out->emissive_base, desc->emissive_base);
   out->height_map_scale = desc->height_map_scale;
+  out->parallax_min_layers = desc->parallax_min_layers ? desc->parallax_min_layers : PARALLAX_MIN_LAYERS_DEFAULT;
+  out->parallax_max_layers = desc->parallax_max_layers ? desc->parallax_max_layers : PARALLAX_MAX_LAYERS_DEFAULT;
+  out->parallax_max_layers = std::max(out->parallax_max_layers, out->parallax_min_layers);
+  out->parallax_fade_distance = desc->parallax_fade_distance > 0.0f ? desc->parallax_fade_distance : PARALLAX_FADE_DISTANCE_DEFAULT;
   out->desc = desc;
   return 0;
 }
@@ -99,6 +87,9 @@ void material_gui(Material* material) {
       texture_map_toggle_gui("Texture", &material->height_map, desc->material.height_map);
       if (desc->material.height_map) {
         ImGui::SliderFloat("Height Scale", &material->height_map_scale,  0.0f, 0.1f);
+        ImGui::SliderInt("Min Layers", &material->parallax_min_layers, 1, PARALLAX_LAYERS_MAX);
+        ImGui::SliderInt("Max Layers", &material->parallax_max_layers, material->parallax_min_layers, PARALLAX_LAYERS_MAX);
+        ImGui::SliderFloat("Fade Distance", &material->parallax_fade_distance, 1.0f, 100.0f);
       }
       ImGui::Unindent();
       ImGui::PopID();
@@ -2,6 +2,11 @@
 
 struct MaterialDesc;
 
+#define PARALLAX_MIN_LAYERS_DEFAULT 8
+#define PARALLAX_MAX_LAYERS_DEFAULT 32
+#define PARALLAX_LAYERS_MAX 64
+#define PARALLAX_FADE_DISTANCE_DEFAULT 40.0f
+
 struct Material
 {
   vec3 albedo_base;
@@ -9,6 +14,9 @@ struct Material
   float roughness_base;
   vec3 emissive_base;
   float height_map_scale;
+  int parallax_min_layers;
+  int parallax_max_layers;
+  float parallax_fade_distance;
   GLuint albedo_map;
   GLuint normal_map;
   GLuint height_map;
@@ -34,10 +42,15 @@ struct MaterialDesc
   float roughness_base;
   vec3 emissive_base;
   float height_map_scale;
+
+  // parallax quality caps, zero picks the defaults
+  int parallax_min_layers;
+  int parallax_max_layers;
+  float parallax_fade_distance;
+
   Material material;
   int use_point_sampling;
 };
 
-int material_initialize_default(Material *out);
 int material_load(Material *out_material, const MaterialDesc *desc);
 void material_gui(Material* material);
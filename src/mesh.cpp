@@ -1,4 +1,5 @@
 #include "mesh.h"
+#include "profiler.h"
 
 static const float box_vertices[] = {
   // back face
@@ -193,8 +194,10 @@ void mesh_draw(const Mesh *mesh, GLint texcoord_loc, GLint normal_loc, GLint tan
 
   if (mesh->indices) {
     GL_WRAP(glDrawElements(mesh->mode, mesh->index_count, GL_UNSIGNED_INT, mesh->indices));
+    profiler_count_draw(mesh->mode, mesh->index_count);
   } else {
     GL_WRAP(glDrawArrays(mesh->mode, 0, mesh->vertex_count));
+    profiler_count_draw(mesh->mode, mesh->vertex_count);
   }
 
   GL_WRAP(glDisableVertexAttribArray(pos_loc));
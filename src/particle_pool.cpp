@@ -0,0 +1,146 @@
+#include "particle_pool.h"
+#include "particles.h"
+#include "imgui/imgui.h"
+
+// sits in front of every block, its size keeps the blocks aligned
+typedef struct alignas(PARTICLE_SIMD_ALIGN) PoolBlockHeader
+{
+  struct PoolBlockHeader* next; // free list link
+  size_t requested;
+  int size_class;
+} PoolBlockHeader;
+
+static_assert(sizeof(PoolBlockHeader) == PARTICLE_SIMD_ALIGN, "block header must keep blocks aligned");
+
+typedef struct
+{
+  SDL_SpinLock lock;
+  size_t cap;
+  size_t reserved;
+  size_t leased;
+  size_t requested;
+  int blocks_leased;
+  int blocks_free;
+
+  PoolBlockHeader* free_lists[PARTICLE_POOL_CLASSES];
+
+  // unused tail of the newest chunk
+  unsigned char* bump;
+  size_t bump_left;
+} ParticlePool;
+
+static ParticlePool sPool = { 0, PARTICLE_POOL_DEFAULT_CAP };
+
+static size_t class_size(int size_class) {
+  return (size_t)1 << (size_class + PARTICLE_POOL_MIN_SHIFT);
+}
+
+// aligned allocation counted against the cap, never freed
+static unsigned char* reserve(size_t size) {
+  if (sPool.reserved + size + PARTICLE_SIMD_ALIGN > sPool.cap)
+    return NULL;
+  unsigned char* mem = (unsigned char*)malloc(size + PARTICLE_SIMD_ALIGN);
+  if (!mem)
+    return NULL;
+  sPool.reserved += size + PARTICLE_SIMD_ALIGN;
+  return (unsigned char*)(((uintptr_t)mem + PARTICLE_SIMD_ALIGN - 1) & ~(uintptr_t)(PARTICLE_SIMD_ALIGN - 1));
+}
+
+static PoolBlockHeader* carve(int size_class) {
+  const size_t size = class_size(size_class);
+
+  // blocks bigger than a chunk get one to themselves
+  if (size > PARTICLE_POOL_CHUNK_SIZE)
+    return (PoolBlockHeader*)reserve(size);
+
+  // start a new chunk, abandoning the old tail
+  if (sPool.bump_left < size) {
+    unsigned char* chunk = reserve(PARTICLE_POOL_CHUNK_SIZE);
+    if (!chunk)
+      return NULL;
+    sPool.bump = chunk;
+    sPool.bump_left = PARTICLE_POOL_CHUNK_SIZE;
+  }
+  PoolBlockHeader* block = (PoolBlockHeader*)sPool.bump;
+  sPool.bump += size;
+  sPool.bump_left -= size;
+  return block;
+}
+
+void* particle_pool_lease(size_t size) {
+  int size_class = 0;
+  while (size_class < PARTICLE_POOL_CLASSES && class_size(size_class) < size + sizeof(PoolBlockHeader)) {
+    size_class++;
+  }
+  if (size_class >= PARTICLE_POOL_CLASSES)
+    return NULL;
+
+  SDL_AtomicLock(&sPool.lock);
+  PoolBlockHeader* block = sPool.free_lists[size_class];
+  if (block) {
+    sPool.free_lists[size_class] = block->next;
+    sPool.blocks_free--;
+  } else {
+    block = carve(size_class);
+  }
+  if (block) {
+    block->next = NULL;
+    block->requested = size;
+    block->size_class = size_class;
+    sPool.leased += class_size(size_class);
+    sPool.requested += size;
+    sPool.blocks_leased++;
+  }
+  SDL_AtomicUnlock(&sPool.lock);
+  return block ? block + 1 : NULL;
+}
+
+void particle_pool_return(void* mem) {
+  if (!mem)
+    return;
+  PoolBlockHeader* block = (PoolBlockHeader*)mem - 1;
+
+  SDL_AtomicLock(&sPool.lock);
+  sPool.leased -= class_size(block->size_class);
+  sPool.requested -= block->requested;
+  sPool.blocks_leased--;
+  block->next = sPool.free_lists[block->size_class];
+  sPool.free_lists[block->size_class] = block;
+  sPool.blocks_free++;
+  SDL_AtomicUnlock(&sPool.lock);
+}
+
+void particle_pool_set_cap(size_t cap) {
+  SDL_AtomicLock(&sPool.lock);
+  sPool.cap = cap;
+  SDL_AtomicUnlock(&sPool.lock);
+}
+
+void particle_pool_get_stats(ParticlePoolStats* stats) {
+  SDL_AtomicLock(&sPool.lock);
+  stats->cap = sPool.cap;
+  stats->reserved = sPool.reserved;
+  stats->leased = sPool.leased;
+  stats->requested = sPool.requested;
+  stats->blocks_leased = sPool.blocks_leased;
+  stats->blocks_free = sPool.blocks_free;
+  SDL_AtomicUnlock(&sPool.lock);
+}
+
+void particle_pool_gui() {
+  ParticlePoolStats stats;
+  particle_pool_get_stats(&stats);
+
+  const float mb = 1.0f / (1 << 20);
+  char overlay[64];
+  snprintf(overlay, sizeof(overlay), "%.1f / %.1f MB leased", stats.leased * mb, stats.reserved * mb);
+  ImGui::ProgressBar(stats.reserved ? (float)stats.leased / (float)stats.reserved : 0.0f, ImVec2(-1, 0), overlay);
+  ImGui::Text("Blocks: %i leased, %i free", stats.blocks_leased, stats.blocks_free);
+  ImGui::Text("Used by emitters: %.1f MB (%.0f%% of leased)", stats.requested * mb
+    , stats.leased ? 100.0f * (float)stats.requested / (float)stats.leased : 0.0f);
+
+  int cap_mb = (int)(stats.cap >> 20);
+  if (ImGui::SliderInt("Cap (MB)", &cap_mb, 16, 2048)) {
+    particle_pool_set_cap((size_t)cap_mb << 20);
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "common.h"
+
+// Arena the particle emitters lease their streams and sort records from.
+// Blocks come in power of two size classes carved out of chunks that are
+// never moved or freed, so growing the pool leaves live particles in place
+// and a returned block is reused by the next lease of its class. The pool
+// stops growing at its memory cap.
+#define PARTICLE_POOL_MIN_SHIFT 12 // smallest block, 4 KB
+#define PARTICLE_POOL_CLASSES 20
+#define PARTICLE_POOL_CHUNK_SIZE (4 << 20)
+#define PARTICLE_POOL_DEFAULT_CAP ((size_t)256 << 20)
+
+typedef struct
+{
+  // bytes the pool may reserve, and has reserved
+  size_t cap;
+  size_t reserved;
+
+  // bytes of the blocks leased out, and of what their owners asked for
+  size_t leased;
+  size_t requested;
+
+  int blocks_leased;
+  int blocks_free;
+} ParticlePoolStats;
+
+// Returns a PARTICLE_SIMD_ALIGN aligned block of at least size bytes, or
+// NULL when the cap is reached. Thread safe, like particle_pool_return.
+void* particle_pool_lease(size_t size);
+void particle_pool_return(void* block);
+
+void particle_pool_set_cap(size_t cap);
+void particle_pool_get_stats(ParticlePoolStats* stats);
+void particle_pool_gui();
@@ -1,19 +1,29 @@
 #include "particles.h"
+#include "particles_gpu.h"
+#include "particle_pool.h"
 #include "assets.h"
 #include "imgui/imgui.h"
 
-#define PARTICLE_GRAVITY -9.81f
-
 DEFINE_ENUM(ParticleShadingMode, particle_shading_mode_strings, ENUM_ParticleShadingMode);
 DEFINE_ENUM(ParticleOrientationMode, particle_orient_mode_strings, ENUM_ParticleOrientationMode);
+DEFINE_ENUM(ParticleSortMode, particle_sort_mode_strings, ENUM_ParticleSortMode);
+DEFINE_ENUM(ParticleResolution, particle_resolution_strings, ENUM_ParticleResolution);
 
-static void random_direction(vec3 out) {
-  float theta = (float)M_PI * utility_random_real11();
-  float phi = acosf(utility_random_real11());
-  out[0] = cosf(theta)*sinf(phi);
-  out[1] = sinf(theta)*sinf(phi);
-  out[2] = -cosf(phi);
-}
+#define PARTICLE_SORT_RADIX_BITS 11
+#define PARTICLE_SORT_RADIX_BUCKETS (1 << PARTICLE_SORT_RADIX_BITS)
+#define PARTICLE_SORT_RADIX_PASSES 3
+
+// adaptive sorts insertion sort when at most 1 in this many neighbours is
+// out of order, and give up on it after this many moves per particle
+#define PARTICLE_SORT_COHERENT_RATIO 32
+#define PARTICLE_SORT_MAX_MOVES 8
+
+// particles spawned per round of random numbers
+#define PARTICLE_SPAWN_BATCH 256
+
+// analytic emitters wind their clock back by this much once it gets there,
+// before spawn times lose precision
+#define PARTICLE_ANALYTIC_REBASE_TIME 1024.0f
 
 #if 0
 static void random_conical_direction(vec3 out, const vec3 axis) {
@@ -26,47 +36,363 @@ static void random_conical_direction(vec3 out, const vec3 axis) {
 }
 #endif
 
-void particle_update(const ParticleEmitterDesc* def, Particle* part, float dt) {
-  if (def->simulate_gravity) {
-    part->velocity[1] += PARTICLE_GRAVITY * dt;
+// The update kernel is written once against these wrappers and runs 8 wide
+// with AVX, 4 wide with SSE2 and one particle at a time elsewhere
+#if defined(__AVX__)
+#include <immintrin.h>
+typedef __m256 SimdFloat;
+#define SIMD_WIDTH 8
+#define simd_load(p) _mm256_load_ps(p)
+#define simd_store(p, v) _mm256_store_ps(p, v)
+#define simd_storeu(p, v) _mm256_storeu_ps(p, v)
+#define simd_set1(f) _mm256_set1_ps(f)
+#define simd_add(a, b) _mm256_add_ps(a, b)
+#define simd_sub(a, b) _mm256_sub_ps(a, b)
+#define simd_mul(a, b) _mm256_mul_ps(a, b)
+#define simd_min(a, b) _mm256_min_ps(a, b)
+#define simd_max(a, b) _mm256_max_ps(a, b)
+#define simd_div(a, b) _mm256_div_ps(a, b)
+#define simd_sqrt(v) _mm256_sqrt_ps(v)
+#define simd_positive_mask(v) _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GT_OQ))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+typedef __m128 SimdFloat;
+#define SIMD_WIDTH 4
+#define simd_load(p) _mm_load_ps(p)
+#define simd_store(p, v) _mm_store_ps(p, v)
+#define simd_storeu(p, v) _mm_storeu_ps(p, v)
+#define simd_set1(f) _mm_set1_ps(f)
+#define simd_add(a, b) _mm_add_ps(a, b)
+#define simd_sub(a, b) _mm_sub_ps(a, b)
+#define simd_mul(a, b) _mm_mul_ps(a, b)
+#define simd_min(a, b) _mm_min_ps(a, b)
+#define simd_max(a, b) _mm_max_ps(a, b)
+#define simd_div(a, b) _mm_div_ps(a, b)
+#define simd_sqrt(v) _mm_sqrt_ps(v)
+#define simd_positive_mask(v) _mm_movemask_ps(_mm_cmpgt_ps(v, _mm_setzero_ps()))
+#else
+typedef float SimdFloat;
+#define SIMD_WIDTH 1
+#define simd_load(p) (*(p))
+#define simd_store(p, v) (*(p) = (v))
+#define simd_storeu(p, v) (*(p) = (v))
+#define simd_set1(f) (f)
+#define simd_add(a, b) ((a) + (b))
+#define simd_sub(a, b) ((a) - (b))
+#define simd_mul(a, b) ((a) * (b))
+#define simd_min(a, b) fminf(a, b)
+#define simd_max(a, b) fmaxf(a, b)
+#define simd_div(a, b) ((a) / (b))
+#define simd_sqrt(v) sqrtf(v)
+#define simd_positive_mask(v) ((v) > 0.0f)
+#endif
+
+#define SIMD_ALL_LANES ((1 << SIMD_WIDTH) - 1)
+
+// Integer lanes for the spawn generators. AVX alone has no 256 bit integer
+// ops, so without AVX2 they run 4 wide whatever the float width.
+#if defined(__AVX2__)
+typedef __m256i SimdInt;
+#define SIMD_INT_WIDTH 8
+#define simd_int_loadu(p) _mm256_loadu_si256((const __m256i*)(p))
+#define simd_int_storeu(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define simd_int_add(a, b) _mm256_add_epi32(a, b)
+#define simd_int_xor(a, b) _mm256_xor_si256(a, b)
+#define simd_int_or(a, b) _mm256_or_si256(a, b)
+#define simd_int_shl(v, n) _mm256_slli_epi32(v, n)
+#define simd_int_shr(v, n) _mm256_srli_epi32(v, n)
+#define simd_int_store_real01(p, v) _mm256_storeu_ps(p, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v, 8)), _mm256_set1_ps(1.0f / 16777215.0f)))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+typedef __m128i SimdInt;
+#define SIMD_INT_WIDTH 4
+#define simd_int_loadu(p) _mm_loadu_si128((const __m128i*)(p))
+#define simd_int_storeu(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define simd_int_add(a, b) _mm_add_epi32(a, b)
+#define simd_int_xor(a, b) _mm_xor_si128(a, b)
+#define simd_int_or(a, b) _mm_or_si128(a, b)
+#define simd_int_shl(v, n) _mm_slli_epi32(v, n)
+#define simd_int_shr(v, n) _mm_srli_epi32(v, n)
+#define simd_int_store_real01(p, v) _mm_storeu_ps(p, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 8)), _mm_set1_ps(1.0f / 16777215.0f)))
+#else
+typedef uint32_t SimdInt;
+#define SIMD_INT_WIDTH 1
+#define simd_int_loadu(p) (*(p))
+#define simd_int_storeu(p, v) (*(p) = (v))
+#define simd_int_add(a, b) ((a) + (b))
+#define simd_int_xor(a, b) ((a) ^ (b))
+#define simd_int_or(a, b) ((a) | (b))
+#define simd_int_shl(v, n) ((v) << (n))
+#define simd_int_shr(v, n) ((v) >> (n))
+#define simd_int_store_real01(p, v) (*(p) = (float)((v) >> 8) * (1.0f / 16777215.0f))
+#endif
+
+static_assert(PARTICLE_SIMD_WIDTH % SIMD_WIDTH == 0, "streams must pad to whole SIMD blocks");
+
+static float** stream_array(ParticleStreams* streams) {
+  return (float**)streams;
+}
+
+// Fills count (a multiple of PARTICLE_SIMD_WIDTH) floats with uniform values
+// in [0, 1], the same 24 bit scale as utility_random_real01. Every lane of
+// the state is its own xoshiro128+ generator.
+static void random_fill_real01(uint32_t state[4][PARTICLE_SIMD_WIDTH], float* out, int count) {
+  for (int lane = 0; lane < PARTICLE_SIMD_WIDTH; lane += SIMD_INT_WIDTH) {
+    SimdInt s0 = simd_int_loadu(&state[0][lane]);
+    SimdInt s1 = simd_int_loadu(&state[1][lane]);
+    SimdInt s2 = simd_int_loadu(&state[2][lane]);
+    SimdInt s3 = simd_int_loadu(&state[3][lane]);
+    for (int i = lane; i < count; i += PARTICLE_SIMD_WIDTH) {
+      SimdInt result = simd_int_add(s0, s3);
+      SimdInt t = simd_int_shl(s1, 9);
+      s2 = simd_int_xor(s2, s0);
+      s3 = simd_int_xor(s3, s1);
+      s1 = simd_int_xor(s1, s2);
+      s0 = simd_int_xor(s0, s3);
+      s2 = simd_int_xor(s2, t);
+      s3 = simd_int_or(simd_int_shl(s3, 11), simd_int_shr(s3, 21));
+      simd_int_store_real01(&out[i], result);
+    }
+    simd_int_storeu(&state[0][lane], s0);
+    simd_int_storeu(&state[1][lane], s1);
+    simd_int_storeu(&state[2][lane], s2);
+    simd_int_storeu(&state[3][lane], s3);
   }
+}
 
-  vec3 deltaPos;
-  vec3_scale(deltaPos, part->velocity, dt);
-  vec3_add(part->pos, part->pos, deltaPos);
-  part->ttl -= dt;
+// sin(x) for x in [-pi/2, pi/2], Taylor series to x^11
+static inline SimdFloat simd_sin_half_range(SimdFloat x) {
+  SimdFloat x2 = simd_mul(x, x);
+  SimdFloat p = simd_set1(-1.0f / 39916800.0f);
+  p = simd_add(simd_mul(p, x2), simd_set1(1.0f / 362880.0f));
+  p = simd_add(simd_mul(p, x2), simd_set1(-1.0f / 5040.0f));
+  p = simd_add(simd_mul(p, x2), simd_set1(1.0f / 120.0f));
+  p = simd_add(simd_mul(p, x2), simd_set1(-1.0f / 6.0f));
+  p = simd_add(simd_mul(p, x2), simd_set1(1.0f));
+  return simd_mul(p, x);
+}
+
+// Writes the first n lanes of v to out, which needn't be aligned
+static inline void store_lanes(float* out, SimdFloat v, int n) {
+  if (n == SIMD_WIDTH) {
+    simd_storeu(out, v);
+    return;
+  }
+  alignas(PARTICLE_SIMD_ALIGN) float lanes[SIMD_WIDTH];
+  simd_store(lanes, v);
+  memcpy(out, lanes, n * sizeof(float));
+}
 
-  float min_dt = fminf(part->ttl, dt);
+// Writes the lanes of v selected by mask to out, packed together. out never
+// runs ahead of the block being read, so the spare lanes land on slots that
+// are either rewritten later or past the surviving count.
+static inline void store_packed(float* out, SimdFloat v, int mask) {
+  if (mask == SIMD_ALL_LANES) {
+    simd_storeu(out, v);
+    return;
+  }
+  alignas(PARTICLE_SIMD_ALIGN) float lanes[SIMD_WIDTH];
+  simd_store(lanes, v);
+  int w = 0;
+  for (int k = 0; k < SIMD_WIDTH; k++) {
+    out[w] = lanes[k];
+    w += (mask >> k) & 1;
+  }
+}
 
-  vec4 dt_color;
-  vec4_scale(dt_color, part->delta_color, min_dt);
-  vec4_add(part->color, part->color, dt_color);
+static void stream_range(const float* stream, int count, float* out_min, float* out_max) {
+  SimdFloat vmin = simd_set1(FLT_MAX);
+  SimdFloat vmax = simd_set1(-FLT_MAX);
+  int i = 0;
+  for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+    SimdFloat v = simd_load(&stream[i]);
+    vmin = simd_min(vmin, v);
+    vmax = simd_max(vmax, v);
+  }
 
-  vec3 dt_scale;
-  vec3_scale(dt_scale, part->delta_scale, min_dt);
-  vec3_add(part->scale, part->scale, dt_scale);
+  alignas(PARTICLE_SIMD_ALIGN) float lanes_min[SIMD_WIDTH];
+  alignas(PARTICLE_SIMD_ALIGN) float lanes_max[SIMD_WIDTH];
+  simd_store(lanes_min, vmin);
+  simd_store(lanes_max, vmax);
+  float min = FLT_MAX, max = -FLT_MAX;
+  for (int k = 0; k < SIMD_WIDTH; k++) {
+    min = fminf(min, lanes_min[k]);
+    max = fmaxf(max, lanes_max[k]);
+  }
+  for (; i < count; i++) {
+    min = fminf(min, stream[i]);
+    max = fmaxf(max, stream[i]);
+  }
+  *out_min = min;
+  *out_max = max;
+}
+
+// One instantiation per combination of PARTICLE_FEATURE_GRAVITY, _COLOR_RAMP
+// and _SCALE_RAMP. The feature tests are constants, so each one compiles
+// down to just the streams its emitters change.
+template <int Features>
+static int update_kernel(ParticleStreams* s, int count, float dt, ParticleBounds* bounds) {
+  const SimdFloat vdt = simd_set1(dt);
+  const SimdFloat vgravity = simd_set1(PARTICLE_GRAVITY * dt);
+
+  int alive = 0;
+  for (int i = 0; i < count; i += SIMD_WIDTH) {
+    // lanes past count are padding, treat them as dead
+    SimdFloat ttl = simd_sub(simd_load(&s->ttl[i]), vdt);
+    int mask = simd_positive_mask(ttl) & ((1 << std::min(count - i, SIMD_WIDTH)) - 1);
+
+    SimdFloat min_dt = simd_min(ttl, vdt);
+    SimdFloat vx = simd_load(&s->vx[i]);
+    SimdFloat vy = simd_load(&s->vy[i]);
+    SimdFloat vz = simd_load(&s->vz[i]);
+    if (Features & PARTICLE_FEATURE_GRAVITY) {
+      vy = simd_add(vy, vgravity);
+    }
+
+#define PACK(stream, value) store_packed(&s->stream[alive], value, mask)
+    PACK(ttl, ttl);
+    PACK(vx, vx);
+    PACK(vy, vy);
+    PACK(vz, vz);
+    PACK(px, simd_add(simd_load(&s->px[i]), simd_mul(vx, vdt)));
+    PACK(py, simd_add(simd_load(&s->py[i]), simd_mul(vy, vdt)));
+    PACK(pz, simd_add(simd_load(&s->pz[i]), simd_mul(vz, vdt)));
+    if (Features & PARTICLE_FEATURE_COLOR_RAMP) {
+      PACK(r, simd_add(simd_load(&s->r[i]), simd_mul(simd_load(&s->dr[i]), min_dt)));
+      PACK(g, simd_add(simd_load(&s->g[i]), simd_mul(simd_load(&s->dg[i]), min_dt)));
+      PACK(b, simd_add(simd_load(&s->b[i]), simd_mul(simd_load(&s->db[i]), min_dt)));
+      PACK(a, simd_add(simd_load(&s->a[i]), simd_mul(simd_load(&s->da[i]), min_dt)));
+    }
+    if (Features & PARTICLE_FEATURE_SCALE_RAMP) {
+      PACK(scale, simd_add(simd_load(&s->scale[i]), simd_mul(simd_load(&s->delta_scale[i]), min_dt)));
+    }
+
+    // the constant streams only move once something before them has died
+    if (mask != SIMD_ALL_LANES || alive != i) {
+      if (!(Features & PARTICLE_FEATURE_COLOR_RAMP)) {
+        PACK(r, simd_load(&s->r[i]));
+        PACK(g, simd_load(&s->g[i]));
+        PACK(b, simd_load(&s->b[i]));
+        PACK(a, simd_load(&s->a[i]));
+      }
+      if (!(Features & PARTICLE_FEATURE_SCALE_RAMP)) {
+        PACK(scale, simd_load(&s->scale[i]));
+      }
+      PACK(dr, simd_load(&s->dr[i]));
+      PACK(dg, simd_load(&s->dg[i]));
+      PACK(db, simd_load(&s->db[i]));
+      PACK(da, simd_load(&s->da[i]));
+      PACK(delta_scale, simd_load(&s->delta_scale[i]));
+      PACK(rx, simd_load(&s->rx[i]));
+      PACK(ry, simd_load(&s->ry[i]));
+      PACK(rz, simd_load(&s->rz[i]));
+    }
+#undef PACK
+
+    for (int k = 0; k < SIMD_WIDTH; k++) {
+      alive += (mask >> k) & 1;
+    }
+  }
+
+  // bounds of the survivors, while the positions are still in cache
+  float min_scale;
+  stream_range(s->px, alive, &bounds->min[0], &bounds->max[0]);
+  stream_range(s->py, alive, &bounds->min[1], &bounds->max[1]);
+  stream_range(s->pz, alive, &bounds->min[2], &bounds->max[2]);
+  stream_range(s->scale, alive, &min_scale, &bounds->max_scale);
+  return alive;
+}
+
+static const ParticleUpdateKernel sUpdateKernels[] = {
+  update_kernel<0>, update_kernel<1>, update_kernel<2>, update_kernel<3>,
+  update_kernel<4>, update_kernel<5>, update_kernel<6>, update_kernel<7>,
+};
+static_assert(STATIC_ELEMENT_COUNT(sUpdateKernels) == PARTICLE_UPDATE_FEATURES(PARTICLE_FEATURE_ALL) + 1, "one update kernel per feature set");
+
+int particle_streams_update(ParticleStreams* streams, int count, float dt, int features, ParticleBounds* bounds) {
+  return sUpdateKernels[PARTICLE_UPDATE_FEATURES(features)](streams, count, dt, bounds);
+}
+
+// local bounds of everything a particle of desc could reach in its life
+static void reach_bounds(const ParticleEmitterDesc* desc, ParticleBounds* bounds) {
+  float age = desc->life_time + fabsf(desc->life_time_variance);
+  float reach = (fabsf(desc->speed) + fabsf(desc->speed_variance)) * age;
+  float fall = desc->simulate_gravity ? 0.5f * fabsf(PARTICLE_GRAVITY) * age * age : 0.0f;
+  vec3_set(bounds->min, -reach, -reach - fall, -reach);
+  vec3_set(bounds->max, reach, reach, reach);
+  bounds->max_scale = fmaxf(fabsf(desc->start_scale), fabsf(desc->end_scale));
+}
+
+// Conservative world box around local bounds, padded by the largest quad.
+// Empty emitters are bounded by what their next particles could reach, so
+// they aren't culled (and starved of updates) before they spawn any.
+static void update_world_bounds(ParticleEmitter* emitter, const ParticleBounds* bounds) {
+  ParticleBounds spawn_bounds;
+  if (emitter->count <= 0) {
+    reach_bounds(emitter->desc, &spawn_bounds);
+    bounds = &spawn_bounds;
+  }
+
+  mat4x4 model;
+  mat4x4_make_transform_uscale(model, emitter->scale, emitter->rot, emitter->pos);
+  vec4 center, world_center;
+  vec3 extents;
+  for (int i = 0; i < 3; i++) {
+    center[i] = 0.5f * (bounds->min[i] + bounds->max[i]);
+    extents[i] = 0.5f * (bounds->max[i] - bounds->min[i]) + fabsf(bounds->max_scale);
+  }
+  center[3] = 1.0f;
+  mat4x4_mul_vec4(world_center, model, center);
+  for (int i = 0; i < 3; i++) {
+    float extent = fabsf(model[0][i]) * extents[0] + fabsf(model[1][i]) * extents[1] + fabsf(model[2][i]) * extents[2];
+    emitter->bounds_min[i] = world_center[i] - extent;
+    emitter->bounds_max[i] = world_center[i] + extent;
+  }
 }
 
 int particle_emitter_initialize(ParticleEmitter *emitter, const ParticleEmitterDesc* def) {
   memset(emitter, 0, sizeof(ParticleEmitter));
   emitter->desc = def;
-  if ((emitter->particles = (Particle*)calloc(def->max, sizeof(Particle))) == NULL) {
-    return 1; // error: unable to allocate memory
+
+  for (int lane = 0; lane < PARTICLE_SIMD_WIDTH; lane++) {
+    for (int i = 0; i < 4; i++) {
+      emitter->random[i][lane] = utility_random_u32();
+    }
+    emitter->random[0][lane] |= 1; // an all zero state never leaves zero
   }
+
   emitter->max = def->max;
+  emitter->budget_max = def->max;
+  emitter->expiry = FLT_MAX;
+  particle_emitter_select_kernels(emitter);
+  emitter->visible = 1;
+  emitter->coverage = 1.0f;
   quat_identity(emitter->rot);
   emitter->scale = 1.0f;
+  update_world_bounds(emitter, NULL);
+
+  // one pooled block carved into aligned, padded streams
+  size_t stride = ((size_t)std::max(def->max, 1) + PARTICLE_SIMD_WIDTH - 1) / PARTICLE_SIMD_WIDTH * PARTICLE_SIMD_WIDTH;
+  if ((emitter->streams_block = particle_pool_lease(stride * PARTICLE_STREAM_COUNT * sizeof(float))) == NULL) {
+    // stays usable but empty: without room it never spawns, so the NULL
+    // streams are never touched
+    emitter->max = 0;
+    emitter->budget_max = 0;
+    return 1; // error: particle pool exhausted
+  }
+  float** streams = stream_array(&emitter->streams);
+  for (int i = 0; i < PARTICLE_STREAM_COUNT; i++) {
+    streams[i] = (float*)emitter->streams_block + stride * i;
+  }
   return 0;
 }
 
 int particle_emitter_destroy(ParticleEmitter *emitter) {
-  if (!emitter->desc || !emitter->particles) {
+  if (!emitter->desc) {
     return 1; // error: uninitialized emitter
   }
-  free(emitter->particles);
-  if (emitter->sort_records) {
-    free(emitter->sort_records);
-  }
+  particle_pool_return(emitter->streams_block);
+  particle_pool_return(emitter->sort_block);
+  particles_gpu_release(emitter);
   memset(emitter, 0, sizeof(ParticleEmitter));
   return 0;
 }
@@ -83,115 +409,470 @@ int particle_emitter_refresh(ParticleEmitter *emitter) {
   return 0;
 }
 
-Particle* particle_emitter_emit_one(ParticleEmitter* emitter) {
+void particle_emitter_select_kernels(ParticleEmitter* emitter) {
   const ParticleEmitterDesc* desc = emitter->desc;
-  if (emitter->count >= emitter->max) {
-    return NULL; // error: not enough space
-  }
-  Particle* part = &emitter->particles[emitter->count++];
-  memset(part, 0, sizeof(Particle));
-  part->ttl = desc->life_time + utility_random_real11() * desc->life_time_variance;
-  part->scale[0] = part->scale[1] = part->scale[2] = desc->start_scale;
-  vec3_swizzle(part->delta_scale, (desc->end_scale - desc->start_scale) / part->ttl);
-  random_direction(part->velocity);
-  vec3_dup(part->rot, part->velocity);
-  //quat_rotation_between(part->rot, part->velocity, Axis_Forward);
-  vec3_scale(part->velocity, part->velocity, desc->speed + utility_random_real11() * desc->speed_variance);
-  vec4_dup(part->color, desc->start_color);
-  vec4_sub(part->delta_color, desc->end_color, desc->start_color);
-  vec4_scale(part->delta_color, part->delta_color, 1.0f/part->ttl);
-  return part;
+  int features = 0;
+  if (desc->simulate_gravity) {
+    features |= PARTICLE_FEATURE_GRAVITY;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (desc->start_color[i] != desc->end_color[i]) {
+      features |= PARTICLE_FEATURE_COLOR_RAMP;
+    }
+  }
+  if (desc->start_scale != desc->end_scale) {
+    features |= PARTICLE_FEATURE_SCALE_RAMP;
+  }
+  if (desc->orient_mode != PARTICLE_ORIENT_SCREEN_ALIGNED) {
+    features |= PARTICLE_FEATURE_ROTATION;
+  }
+  emitter->features = features;
+  emitter->update_kernel = sUpdateKernels[PARTICLE_UPDATE_FEATURES(features)];
+}
+
+int particle_emitter_emit(ParticleEmitter* emitter, int count) {
+  const ParticleEmitterDesc* desc = emitter->desc;
+  count = std::min(count, emitter->budget_max - emitter->count);
+  if (count <= 0) {
+    return 0;
+  }
+  ParticleStreams* s = &emitter->streams;
+
+  const SimdFloat zero = simd_set1(0.0f);
+  const SimdFloat one = simd_set1(1.0f);
+  const SimdFloat two = simd_set1(2.0f);
+  const SimdFloat half_pi = simd_set1(0.5f * (float)M_PI);
+  const SimdFloat life_time = simd_set1(desc->life_time);
+  const SimdFloat life_time_variance = simd_set1(desc->life_time_variance);
+  const SimdFloat speed = simd_set1(desc->speed);
+  const SimdFloat speed_variance = simd_set1(desc->speed_variance);
+  const SimdFloat start_scale = simd_set1(desc->start_scale);
+  const SimdFloat scale_range = simd_set1(desc->end_scale - desc->start_scale);
+  const SimdFloat born = simd_set1(emitter->time);
+  SimdFloat min_ttl = simd_set1(FLT_MAX);
+  SimdFloat start_color[4], color_range[4];
+  for (int c = 0; c < 4; c++) {
+    start_color[c] = simd_set1(desc->start_color[c]);
+    color_range[c] = simd_set1(desc->end_color[c] - desc->start_color[c]);
+  }
+
+  // one row of random numbers per input: life time, theta, cos(phi), speed
+  alignas(PARTICLE_SIMD_ALIGN) float uniform[4][PARTICLE_SPAWN_BATCH];
+  for (int batch = 0; batch < count; batch += PARTICLE_SPAWN_BATCH) {
+    int batch_count = std::min(count - batch, PARTICLE_SPAWN_BATCH);
+    int padded = (batch_count + PARTICLE_SIMD_WIDTH - 1) & ~(PARTICLE_SIMD_WIDTH - 1);
+    for (int r = 0; r < 4; r++) {
+      random_fill_real01(emitter->random, uniform[r], padded);
+    }
+
+    for (int k = 0; k < batch_count; k += SIMD_WIDTH) {
+      int i = emitter->count + batch + k;
+      int n = std::min(SIMD_WIDTH, batch_count - k);
+      SimdFloat r0 = simd_sub(simd_mul(simd_load(&uniform[0][k]), two), one);
+      SimdFloat r1 = simd_sub(simd_mul(simd_load(&uniform[1][k]), two), one);
+      SimdFloat r2 = simd_sub(simd_mul(simd_load(&uniform[2][k]), two), one);
+      SimdFloat r3 = simd_sub(simd_mul(simd_load(&uniform[3][k]), two), one);
+
+      SimdFloat ttl = simd_add(life_time, simd_mul(r0, life_time_variance));
+      SimdFloat inv_ttl = simd_div(one, ttl);
+      min_ttl = simd_min(min_ttl, ttl); // padding lanes only make this earlier
+      store_lanes(&s->ttl[i], ttl, n);
+      store_lanes(&s->born[i], born, n);
+      store_lanes(&s->scale[i], start_scale, n);
+      store_lanes(&s->delta_scale[i], simd_mul(scale_range, inv_ttl), n);
+
+      // uniform on the sphere like before: theta = pi * r1 and phi = acos(r2).
+      // theta comes from its half angle, which stays in the polynomial's range.
+      SimdFloat sin_half = simd_sin_half_range(simd_mul(half_pi, r1));
+      SimdFloat cos_half = simd_sqrt(simd_max(zero, simd_sub(one, simd_mul(sin_half, sin_half))));
+      SimdFloat sin_theta = simd_mul(two, simd_mul(sin_half, cos_half));
+      SimdFloat cos_theta = simd_sub(one, simd_mul(two, simd_mul(sin_half, sin_half)));
+      SimdFloat sin_phi = simd_sqrt(simd_max(zero, simd_sub(one, simd_mul(r2, r2))));
+      SimdFloat dx = simd_mul(cos_theta, sin_phi);
+      SimdFloat dy = simd_mul(sin_theta, sin_phi);
+      SimdFloat dz = simd_sub(zero, r2);
+      store_lanes(&s->rx[i], dx, n);
+      store_lanes(&s->ry[i], dy, n);
+      store_lanes(&s->rz[i], dz, n);
+
+      SimdFloat v = simd_add(speed, simd_mul(r3, speed_variance));
+      store_lanes(&s->vx[i], simd_mul(dx, v), n);
+      store_lanes(&s->vy[i], simd_mul(dy, v), n);
+      store_lanes(&s->vz[i], simd_mul(dz, v), n);
+      store_lanes(&s->px[i], zero, n);
+      store_lanes(&s->py[i], zero, n);
+      store_lanes(&s->pz[i], zero, n);
+
+      store_lanes(&s->r[i], start_color[0], n);
+      store_lanes(&s->g[i], start_color[1], n);
+      store_lanes(&s->b[i], start_color[2], n);
+      store_lanes(&s->a[i], start_color[3], n);
+      store_lanes(&s->dr[i], simd_mul(color_range[0], inv_ttl), n);
+      store_lanes(&s->dg[i], simd_mul(color_range[1], inv_ttl), n);
+      store_lanes(&s->db[i], simd_mul(color_range[2], inv_ttl), n);
+      store_lanes(&s->da[i], simd_mul(color_range[3], inv_ttl), n);
+    }
+  }
+  emitter->count += count;
+
+  alignas(PARTICLE_SIMD_ALIGN) float lanes[SIMD_WIDTH];
+  simd_store(lanes, min_ttl);
+  for (int k = 0; k < SIMD_WIDTH; k++) {
+    emitter->expiry = fminf(emitter->expiry, emitter->time + lanes[k]);
+  }
+  return count;
+}
+
+int particle_emitter_emit_one(ParticleEmitter* emitter) {
+  if (!particle_emitter_emit(emitter, 1)) {
+    return -1; // error: not enough space
+  }
+  return emitter->count - 1;
 }
 
 void particle_emitter_burst(ParticleEmitter* emitter, int count) {
-  for (int i = 0; i < count; i++) {
-    particle_emitter_emit_one(emitter);
+  if (particles_gpu_enabled(emitter)) {
+    emitter->gpu.pending_spawns += count;
+    return;
   }
+  particle_emitter_emit(emitter, count);
 }
 
 void particle_emitter_destroy_at_index(ParticleEmitter* emitter, int index) {
   if (index >= 0 && index < emitter->count) {
-    if (index != emitter->count-1) {
+    int last = emitter->count-1;
+    if (index != last) {
       // swap end into hole except for last element
-      emitter->particles[index] = emitter->particles[emitter->count-1];
+      float** streams = stream_array(&emitter->streams);
+      for (int i = 0; i < PARTICLE_STREAM_COUNT; i++) {
+        streams[i][index] = streams[i][last];
+      }
     }
     emitter->count--;
   }
 }
 
-void particle_emitter_update(ParticleEmitter* emitter, float dt) {
+void particle_emitter_spawn(ParticleEmitter* emitter, float dt) {
   const ParticleEmitterDesc* desc = emitter->desc;
+  int gpu = particles_gpu_enabled(emitter);
+  emitter->time += dt;
 
-  // spawn particles
-  if (!emitter->muted && desc->spawn_rate > 0) {
-    float rate = 1.0f / desc->spawn_rate;
+  // spawn particles, fewer when over budget
+  float spawn_rate = emitter->max > 0 ? desc->spawn_rate * emitter->budget_max / (float)emitter->max : 0.0f;
+  if (!emitter->muted && spawn_rate > 0) {
+    float rate = 1.0f / spawn_rate;
     emitter->time_till_spawn += dt;
+    int spawns = 0;
     while (emitter->time_till_spawn > rate) {
-      particle_emitter_emit_one(emitter);
+      spawns++;
       emitter->time_till_spawn -= rate;
     }
+    if (gpu) {
+      emitter->gpu.pending_spawns += spawns;
+    } else {
+      int first = emitter->count;
+      int spawned = particle_emitter_emit(emitter, spawns);
+
+      // analytic particles can be born when they were due during dt, which
+      // keeps a long catch up step from spawning them all in one clump
+      if (particle_emitter_analytic(emitter)) {
+        ParticleStreams* s = &emitter->streams;
+        for (int k = 0; k < spawned; k++) {
+          int i = first + k;
+          s->born[i] = emitter->time - (emitter->time_till_spawn + (float)(spawns - 1 - k) * rate);
+          emitter->expiry = fminf(emitter->expiry, s->born[i] + s->ttl[i]);
+        }
+      }
+    }
   }
 
-  // advance particle state
-  for (int i = 0; i < emitter->count; i++) {
-    Particle* part = &emitter->particles[i];
-    particle_update(desc, part, dt);
+  // the renderer steps gpu emitters once per frame
+  if (gpu) {
+    emitter->gpu.pending_dt += dt;
   }
+}
 
-  // destroy particles
-  for (int i = 0; i < emitter->count; i++) {
-    Particle* part = &emitter->particles[i];
-    if (part->ttl <= 0.0f) {
-      particle_emitter_destroy_at_index(emitter, i);
+int particle_emitter_update_range(ParticleEmitter* emitter, int first, int count, float dt, ParticleBounds* bounds) {
+  assert(first % PARTICLE_SIMD_WIDTH == 0);
+  ParticleStreams range;
+  float** src = stream_array(&emitter->streams);
+  float** dst = stream_array(&range);
+  for (int i = 0; i < PARTICLE_STREAM_COUNT; i++) {
+    dst[i] = src[i] + first;
+  }
+  return emitter->update_kernel(&range, count, dt, bounds);
+}
+
+void particle_emitter_join_ranges(ParticleEmitter* emitter, int range_size, const int* alive, const ParticleBounds* bounds, int ranges_count) {
+  float** streams = stream_array(&emitter->streams);
+  ParticleBounds joined = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, -FLT_MAX };
+  for (int r = 0; r < ranges_count; r++) {
+    for (int i = 0; i < 3; i++) {
+      joined.min[i] = fminf(joined.min[i], bounds[r].min[i]);
+      joined.max[i] = fmaxf(joined.max[i], bounds[r].max[i]);
     }
+    joined.max_scale = fmaxf(joined.max_scale, bounds[r].max_scale);
+  }
+
+  int count = ranges_count > 0 ? alive[0] : 0;
+  for (int r = 1; r < ranges_count; r++) {
+    int first = r * range_size;
+    if (count != first) {
+      for (int i = 0; i < PARTICLE_STREAM_COUNT; i++) {
+        memmove(streams[i] + count, streams[i] + first, alive[r] * sizeof(float));
+      }
+    }
+    count += alive[r];
+  }
+  emitter->count = count;
+  update_world_bounds(emitter, &joined);
+}
+
+void particle_emitter_update(ParticleEmitter* emitter, float dt) {
+  particle_emitter_spawn(emitter, dt);
+  if (particles_gpu_enabled(emitter))
+    return;
+  if (particle_emitter_analytic(emitter)) {
+    particle_emitter_expire(emitter);
+    return;
   }
+
+  // advance particle state and drop the dead ones
+  ParticleBounds bounds;
+  emitter->count = emitter->update_kernel(&emitter->streams, emitter->count, dt, &bounds);
+  update_world_bounds(emitter, &bounds);
+}
+
+int particle_emitter_analytic(const ParticleEmitter* emitter) {
+  return emitter->desc->analytic && !particles_gpu_enabled(emitter);
 }
 
-static int partition(SortRecord* recs, int low, int high) {
-  SortRecord pivot = recs[high];
-  int i = low - 1;
-  for (int j = low; j <= high - 1; j++) {
-    if (recs[j].depth <= pivot.depth) {
-      i++;
+// Packs the particles still alive at time to the front of the streams an
+// analytic emitter keeps, and returns how many there are
+static int analytic_streams_expire(ParticleStreams* s, int count, float time) {
+  const SimdFloat vtime = simd_set1(time);
+  int alive = 0;
+  for (int i = 0; i < count; i += SIMD_WIDTH) {
+    SimdFloat born = simd_load(&s->born[i]);
+    SimdFloat ttl = simd_load(&s->ttl[i]);
+    int mask = simd_positive_mask(simd_sub(simd_add(born, ttl), vtime)) & ((1 << std::min(count - i, SIMD_WIDTH)) - 1);
+    if (mask == SIMD_ALL_LANES && alive == i) {
+      alive += SIMD_WIDTH;
+      continue;
+    }
 
-      SortRecord tmp = recs[i];
-      recs[i] = recs[j];
-      recs[j] = tmp;
+#define PACK(stream) store_packed(&s->stream[alive], simd_load(&s->stream[i]), mask)
+    PACK(born);
+    PACK(ttl);
+    PACK(vx);
+    PACK(vy);
+    PACK(vz);
+    PACK(rx);
+    PACK(ry);
+    PACK(rz);
+#undef PACK
+
+    for (int k = 0; k < SIMD_WIDTH; k++) {
+      alive += (mask >> k) & 1;
     }
   }
-  recs[high] = recs[i + 1];
-  recs[i + 1] = pivot;
-  return i + 1;
+  return alive;
 }
 
-static void quicksort(SortRecord* recs, int low, int high) {
-  if (low < high) {
-    int pi = partition(recs, low, high);
-    quicksort(recs, low, pi - 1);
-    quicksort(recs, pi + 1, high);
+// earliest death among count analytic particles
+static float analytic_streams_expiry(const ParticleStreams* s, int count) {
+  SimdFloat vexpiry = simd_set1(FLT_MAX);
+  int i = 0;
+  for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+    vexpiry = simd_min(vexpiry, simd_add(simd_load(&s->born[i]), simd_load(&s->ttl[i])));
+  }
+  alignas(PARTICLE_SIMD_ALIGN) float lanes[SIMD_WIDTH];
+  simd_store(lanes, vexpiry);
+  float expiry = FLT_MAX;
+  for (int k = 0; k < SIMD_WIDTH; k++) {
+    expiry = fminf(expiry, lanes[k]);
+  }
+  for (; i < count; i++) {
+    expiry = fminf(expiry, s->born[i] + s->ttl[i]);
   }
+  return expiry;
 }
 
-void particle_emitter_sort(ParticleEmitter* emitter, const vec3 cam_position) {
-  // allocate sort records the first time we sort
-  if (!emitter->sort_records) {
-    if (emitter->max <= 0 || (emitter->sort_records = (SortRecord*)calloc(emitter->max, sizeof(SortRecord))) == NULL) {
-      return; // unable to allocate sort records
+void particle_emitter_expire(ParticleEmitter* emitter) {
+  const ParticleEmitterDesc* desc = emitter->desc;
+  ParticleStreams* s = &emitter->streams;
+
+  // nothing has died until the earliest expiry passes
+  if (emitter->time >= emitter->expiry) {
+    emitter->count = analytic_streams_expire(s, emitter->count, emitter->time);
+    emitter->expiry = analytic_streams_expiry(s, emitter->count);
+  }
+
+  if (emitter->time >= PARTICLE_ANALYTIC_REBASE_TIME) {
+    emitter->time -= PARTICLE_ANALYTIC_REBASE_TIME;
+    emitter->expiry -= PARTICLE_ANALYTIC_REBASE_TIME;
+    for (int i = 0; i < emitter->count; i++) {
+      s->born[i] -= PARTICLE_ANALYTIC_REBASE_TIME;
     }
   }
 
-  // calculate depth from camera
-  vec3 diff;
+  // no positions to measure, so bound everything a particle could reach
+  ParticleBounds bounds;
+  reach_bounds(desc, &bounds);
+  update_world_bounds(emitter, &bounds);
+}
+
+// Fills in the positions of analytic particles at the emitter's clock, only
+// sorting needs them on the CPU
+static void analytic_streams_positions(ParticleStreams* s, int count, float time, int simulate_gravity) {
+  const SimdFloat vtime = simd_set1(time);
+  const SimdFloat half_gravity = simd_set1(simulate_gravity ? 0.5f * PARTICLE_GRAVITY : 0.0f);
+  for (int i = 0; i < count; i += SIMD_WIDTH) {
+    SimdFloat age = simd_sub(vtime, simd_load(&s->born[i]));
+    simd_store(&s->px[i], simd_mul(simd_load(&s->vx[i]), age));
+    simd_store(&s->py[i], simd_mul(simd_add(simd_load(&s->vy[i]), simd_mul(half_gravity, age)), age));
+    simd_store(&s->pz[i], simd_mul(simd_load(&s->vz[i]), age));
+  }
+}
+
+// flips float bits so they order as unsigned integers, negatives included
+static uint32_t float_sort_key(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(uint32_t));
+  uint32_t mask = (uint32_t)(-(int32_t)(bits >> 31)) | 0x80000000u;
+  return bits ^ mask;
+}
+
+SortRecord* particle_sort_radix(SortRecord* records, SortRecord* scratch, int count) {
+  uint32_t histograms[PARTICLE_SORT_RADIX_PASSES][PARTICLE_SORT_RADIX_BUCKETS];
+  memset(histograms, 0, sizeof(histograms));
+  for (int i = 0; i < count; i++) {
+    uint32_t key = float_sort_key(records[i].depth);
+    for (int pass = 0; pass < PARTICLE_SORT_RADIX_PASSES; pass++) {
+      histograms[pass][(key >> (pass * PARTICLE_SORT_RADIX_BITS)) & (PARTICLE_SORT_RADIX_BUCKETS - 1)]++;
+    }
+  }
+
+  SortRecord* src = records;
+  SortRecord* dst = scratch;
+  for (int pass = 0; pass < PARTICLE_SORT_RADIX_PASSES; pass++) {
+    uint32_t* histogram = histograms[pass];
+    const int shift = pass * PARTICLE_SORT_RADIX_BITS;
+
+    // every key shares this digit, the pass would copy without reordering
+    if (count > 0 && histogram[(float_sort_key(src[0].depth) >> shift) & (PARTICLE_SORT_RADIX_BUCKETS - 1)] == (uint32_t)count)
+      continue;
+
+    // exclusive prefix sum into bucket offsets
+    uint32_t offset = 0;
+    for (int b = 0; b < PARTICLE_SORT_RADIX_BUCKETS; b++) {
+      uint32_t bucket_count = histogram[b];
+      histogram[b] = offset;
+      offset += bucket_count;
+    }
+
+    for (int i = 0; i < count; i++) {
+      uint32_t digit = (float_sort_key(src[i].depth) >> shift) & (PARTICLE_SORT_RADIX_BUCKETS - 1);
+      dst[histogram[digit]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  return src;
+}
+
+// Gives up, leaving the records partially sorted, once more than max_moves
+// records moved
+static int insertion_sort(SortRecord* recs, int count, int max_moves) {
+  int moves = 0;
+  for (int i = 1; i < count; i++) {
+    SortRecord rec = recs[i];
+    int j = i - 1;
+    while (j >= 0 && recs[j].depth > rec.depth) {
+      recs[j + 1] = recs[j];
+      j--;
+    }
+    recs[j + 1] = rec;
+    moves += i - 1 - j;
+    if (moves > max_moves)
+      return 0;
+  }
+  return 1;
+}
+
+SortRecord* particle_sort_adaptive(SortRecord* records, SortRecord* scratch, int count) {
+  int descents = 0;
+  for (int i = 1; i < count; i++) {
+    descents += records[i - 1].depth > records[i].depth;
+  }
+  if (descents * PARTICLE_SORT_COHERENT_RATIO <= count
+      && insertion_sort(records, count, count * PARTICLE_SORT_MAX_MOVES)) {
+    return records;
+  }
+  return particle_sort_radix(records, scratch, count);
+}
+
+void particle_emitter_to_local(const ParticleEmitter* emitter, vec3 out, const vec3 world) {
+  mat4x4 model, inv_model;
+  mat4x4_make_transform_uscale(model, emitter->scale, emitter->rot, emitter->pos);
+  mat4x4_invert(inv_model, model);
+  vec4 point = { world[0], world[1], world[2], 1.0f };
+  vec4 local;
+  mat4x4_mul_vec4(local, inv_model, point);
+  vec3_dup(out, local);
+}
+
+void particle_emitter_sort(ParticleEmitter* emitter, const vec3 local_eye) {
+  // lease sort records the first time we sort
+  if (!emitter->sort_block) {
+    if (emitter->max <= 0 || (emitter->sort_block = particle_pool_lease(2 * emitter->max * sizeof(SortRecord))) == NULL) {
+      return; // particle pool exhausted
+    }
+    emitter->sort_records = (SortRecord*)emitter->sort_block;
+    emitter->sort_scratch = emitter->sort_records + emitter->max;
+  }
+
+  // calculate depth from the eye, negated as the sorts are ascending and
+  // blending wants the farthest particles first. The uniform scale keeps
+  // the local order the world order.
+  ParticleStreams* s = &emitter->streams;
+  if (particle_emitter_analytic(emitter)) {
+    analytic_streams_positions(s, emitter->count, emitter->time, emitter->desc->simulate_gravity);
+  }
+  int ordered = 1;
   for (int i = 0; i < emitter->count; i++) {
-    Particle* part = &emitter->particles[i];
     SortRecord* rec = &emitter->sort_records[i];
-    vec3_sub(diff, part->pos, cam_position);
-    rec->depth = vec3_len2(diff);
+    float dx = s->px[i] - local_eye[0];
+    float dy = s->py[i] - local_eye[1];
+    float dz = s->pz[i] - local_eye[2];
+    rec->depth = -(dx*dx + dy*dy + dz*dz);
     rec->index = i;
+    ordered &= i == 0 || rec[-1].depth <= rec->depth;
+  }
+  if (ordered)
+    return;
+
+  // sort, the streams kept last frame's order so adaptive is usually cheap
+  SortRecord* sorted;
+  if (emitter->desc->sort_mode == PARTICLE_SORT_ADAPTIVE) {
+    sorted = particle_sort_adaptive(emitter->sort_records, emitter->sort_scratch, emitter->count);
+  } else {
+    sorted = particle_sort_radix(emitter->sort_records, emitter->sort_scratch, emitter->count);
+  }
+  if (sorted != emitter->sort_records) {
+    std::swap(emitter->sort_records, emitter->sort_scratch);
   }
 
-  // sort
-  quicksort(emitter->sort_records, 0, emitter->count-1);
+  // apply the order to every stream, the scratch records are free again
+  // and hold at least one stream's worth of floats
+  float* gathered = (float*)emitter->sort_scratch;
+  float** streams = stream_array(s);
+  for (int i = 0; i < PARTICLE_STREAM_COUNT; i++) {
+    float* stream = streams[i];
+    for (int j = 0; j < emitter->count; j++) {
+      gathered[j] = stream[emitter->sort_records[j].index];
+    }
+    memcpy(stream, gathered, emitter->count * sizeof(float));
+  }
 }
 
 static int get_particle_texture_index(GLuint texId, const ParticleEmitterTextureDesc* texDefs, int texDefsCount) {
@@ -203,25 +884,33 @@ static int get_particle_texture_index(GLuint texId, const ParticleEmitterTexture
   return 0;
 }
 
+// a failed refresh leaves the emitter empty until the pool has room again
+static void refresh_emitter(ParticleEmitter* emitter) {
+  if (particle_emitter_refresh(emitter)) {
+    printf("Unable to refresh emitter, the particle pool is exhausted\n");
+  }
+}
+
 void particle_emitter_gui(ParticleEmitter* emitter, const ParticleEmitterTextureDesc* tex_defs, int tex_defs_count) {
   ParticleEmitterDesc* desc = (ParticleEmitterDesc*)emitter->desc; // HACKy const cast here
   if (ImGui::Button("Flare")) {
     *desc = gEmitterDescs[0];
-    particle_emitter_refresh(emitter);
+    refresh_emitter(emitter);
   }
   ImGui::SameLine();
   if (ImGui::Button("Particle")) {
     *desc = gEmitterDescs[1];
-    particle_emitter_refresh(emitter);
+    refresh_emitter(emitter);
   }
   ImGui::SameLine();
   if (ImGui::Button("Smoke")) {
     *desc = gEmitterDescs[2];
-    particle_emitter_refresh(emitter);
+    refresh_emitter(emitter);
   }
   if ( ImGui::Button("Refresh") ) {
-    particle_emitter_refresh(emitter);
+    refresh_emitter(emitter);
   }
+  int features_changed = 0;
   ImGui::SliderFloat( "Spawn Rate", &desc->spawn_rate, 0, 500.0f );
   ImGui::SliderInt( "Max Particles", &desc->max, 1, 2048 );
 
@@ -241,16 +930,29 @@ void particle_emitter_gui(ParticleEmitter* emitter, const ParticleEmitterTexture
       ImGui::EndCombo();
     }
   }
-  ImGui::SliderFloat( "Start Scale", &desc->start_scale, .01f, 10.0f );
-  ImGui::SliderFloat( "End Scale", &desc->end_scale, .01f, 10.0f );
-  ImGui::ColorEdit4( "Start Color", desc->start_color );
-  ImGui::ColorEdit4( "End Color", desc->end_color );
+  features_changed |= ImGui::SliderFloat( "Start Scale", &desc->start_scale, .01f, 10.0f );
+  features_changed |= ImGui::SliderFloat( "End Scale", &desc->end_scale, .01f, 10.0f );
+  features_changed |= ImGui::ColorEdit4( "Start Color", desc->start_color );
+  features_changed |= ImGui::ColorEdit4( "End Color", desc->end_color );
 
-  ImGui::Combo( "Orientation Mode", ( int* )&desc->orient_mode, particle_orient_mode_strings, particle_orient_mode_strings_count );
+  features_changed |= ImGui::Combo( "Orientation Mode", ( int* )&desc->orient_mode, particle_orient_mode_strings, particle_orient_mode_strings_count );
   ImGui::Checkbox( "Depth Sort", ( bool* )&desc->depth_sort_alpha_blend );
+  if (desc->depth_sort_alpha_blend) {
+    ImGui::Combo( "Sort Mode", ( int* )&desc->sort_mode, particle_sort_mode_strings, particle_sort_mode_strings_count );
+  }
   ImGui::Checkbox( "Soft", ( bool* )&desc->soft );
-  ImGui::Checkbox( "Gravity", ( bool* )&desc->simulate_gravity );
+  ImGui::Combo( "Resolution", ( int* )&desc->resolution, particle_resolution_strings, particle_resolution_strings_count );
+  features_changed |= ImGui::Checkbox( "Gravity", ( bool* )&desc->simulate_gravity );
   ImGui::Checkbox( "Mute", ( bool* )&emitter->muted );
+  ImGui::SliderFloat( "Budget Priority", &desc->priority, 0.0f, 10.0f );
+  if (particles_gpu_supported()) {
+    if (ImGui::Checkbox( "GPU Simulation", ( bool* )&desc->gpu_simulation )) {
+      refresh_emitter(emitter);
+    }
+  }
+  if (ImGui::Checkbox( "Analytic", ( bool* )&desc->analytic )) {
+    refresh_emitter(emitter);
+  }
   ImGui::SliderFloat( "Life Time", &desc->life_time, 0.0f, 10.0f );
   ImGui::SliderFloat( "Life Time Variance", &desc->life_time_variance, 0.0f, 10.0f );
   ImGui::SliderFloat( "Speed", &desc->speed, 0.0f, 10.0f );
@@ -262,4 +964,8 @@ void particle_emitter_gui(ParticleEmitter* emitter, const ParticleEmitterTexture
     particle_emitter_burst(emitter, desc->burst_count);
   }
   ImGui::SliderInt( "Burst Count", &desc->burst_count, 0, 1000 );
+
+  if (features_changed) {
+    particle_emitter_select_kernels(emitter);
+  }
 }
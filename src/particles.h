@@ -1,6 +1,8 @@
 #pragma once
 #include "common.h"
 
+#define PARTICLE_GRAVITY -9.81f
+
 #define ENUM_ParticleShadingMode(D)						\
   D(PARTICLE_SHADING_FLAT, 			"Flat")				\
   D(PARTICLE_SHADING_TEXTURED, 	"Textured")
@@ -13,33 +15,93 @@ DECLARE_ENUM(ParticleShadingMode, particle_shading_mode_strings, ENUM_ParticleSh
 
 DECLARE_ENUM(ParticleOrientationMode, particle_orient_mode_strings, ENUM_ParticleOrientationMode);
 
-// single particle
-typedef struct
-{
-  // position in emitter local space
-  vec3 pos;
+#define ENUM_ParticleSortMode(D)								\
+  D(PARTICLE_SORT_ADAPTIVE, 	"Adaptive")					\
+  D(PARTICLE_SORT_RADIX, 			"Radix")
+
+DECLARE_ENUM(ParticleSortMode, particle_sort_mode_strings, ENUM_ParticleSortMode);
 
-  // xyz-euler angles in emitter local space
-  vec3 rot;
+// reduced resolutions divide the view by 1 << resolution
+#define ENUM_ParticleResolution(D)								\
+  D(PARTICLE_RESOLUTION_FULL, 		"Full")							\
+  D(PARTICLE_RESOLUTION_HALF, 		"Half")							\
+  D(PARTICLE_RESOLUTION_QUARTER, 	"Quarter")
 
-  // scale in emitter local space
-  vec3 scale;
+DECLARE_ENUM(ParticleResolution, particle_resolution_strings, ENUM_ParticleResolution);
+
+// Particle state as structure-of-arrays streams, so the update kernel can
+// advance PARTICLE_SIMD_WIDTH particles per iteration. Every stream points
+// into one allocation, is PARTICLE_SIMD_ALIGN aligned and holds a multiple
+// of PARTICLE_SIMD_WIDTH elements. Positions, rotations and velocities are
+// in emitter local space.
+#define PARTICLE_SIMD_WIDTH 8
+#define PARTICLE_SIMD_ALIGN 32
+
+typedef struct
+{
+  // position
+  float* px;
+  float* py;
+  float* pz;
 
   // velocity
-  vec3 velocity;
+  float* vx;
+  float* vy;
+  float* vz;
 
   // time to live (counts down to zero)
-  float ttl;
+  float* ttl;
 
-  // current color
-  vec4 color;
+  // current rgba
+  float* r;
+  float* g;
+  float* b;
+  float* a;
 
   // color change/second
-  vec4 delta_color;
+  float* dr;
+  float* dg;
+  float* db;
+  float* da;
 
-  // scale change/second
-  vec3 delta_scale;
-} Particle;
+  // uniform scale and its change/second
+  float* scale;
+  float* delta_scale;
+
+  // xyz-euler angles, only read when rendering
+  float* rx;
+  float* ry;
+  float* rz;
+
+  // spawn time on the emitter's clock, only kept by analytic emitters
+  float* born;
+} ParticleStreams;
+
+#define PARTICLE_STREAM_COUNT (int)(sizeof(ParticleStreams) / sizeof(float*))
+
+// bounds of a set of particles in emitter local space; min > max when empty
+typedef struct
+{
+  vec3 min;
+  vec3 max;
+  float max_scale;
+} ParticleBounds;
+
+// What an emitter's particles do, selecting the specialized kernels that
+// update them and fill their instances. Update kernels are indexed by the
+// low three bits, fill kernels by the high three.
+#define PARTICLE_FEATURE_GRAVITY    (1 << 0)
+#define PARTICLE_FEATURE_COLOR_RAMP (1 << 1) // start and end color differ
+#define PARTICLE_FEATURE_SCALE_RAMP (1 << 2) // start and end scale differ
+#define PARTICLE_FEATURE_ROTATION   (1 << 3) // per particle orientation, unused when screen aligned
+#define PARTICLE_FEATURE_ALL ((1 << 4) - 1)
+#define PARTICLE_UPDATE_FEATURES(features) ((features) & 7)
+#define PARTICLE_FILL_FEATURES(features) ((features) >> 1)
+
+// Advances count particles by dt and packs the survivors to the front of
+// the streams, keeping their order. Returns the surviving count and their
+// bounds.
+typedef int (*ParticleUpdateKernel)(ParticleStreams* streams, int count, float dt, ParticleBounds* bounds);
 
 // definition of a particle emitter
 typedef struct
@@ -89,14 +151,35 @@ typedef struct
   // if true, this emitter uses depth sorting and renders with alpha blending
   int depth_sort_alpha_blend;
 
+  // adaptive sorting insertion sorts when last frame's order mostly holds
+  ParticleSortMode sort_mode;
+
+  // weight in the scene's particle budget, on top of the base weight of 1
+  float priority;
+
   // if true, renders this as 'soft' particles
   int soft;
 
+  // resolution this emitter is drawn at. Reduced resolutions are drawn
+  // offscreen and upsampled into the output after the full resolution
+  // emitters.
+  ParticleResolution resolution;
+
   // if true, particle velocity is modified by gravity
   int simulate_gravity;
 
   // emitter cone axis
   vec3 emit_cone_axis;
+
+  // if true and supported, particles are simulated and stored on the GPU
+  // (see particles_gpu.h). GPU emitters are not depth sorted.
+  int gpu_simulation;
+
+  // if true, particles keep only their spawn state (velocity, rotation,
+  // life time and spawn time) and particle.vert evaluates the rest from
+  // their age, so the CPU never integrates them. Ignored when gpu_simulation
+  // is in effect.
+  int analytic;
 } ParticleEmitterDesc;
 
 // small easily swappable data structure for depth sorting
@@ -109,17 +192,49 @@ typedef struct
   int index;
 } SortRecord;
 
+// GPU side state of an emitter with gpu_simulation set
+typedef struct
+{
+  // double-buffered GpuParticle arrays, advanced by transform feedback
+  GLuint state_vbo[2];
+
+  // random seeds of spawned particles, one per slot
+  GLuint seed_vbo;
+
+  // GpuParticleCommands whose counts are written by the GPU
+  GLuint command_buffer;
+
+  // particles written by the last step
+  GLuint query;
+
+  // index of the state buffer holding the living particles
+  int current;
+
+  // particles each state buffer can hold, 0 until the buffers exist
+  int capacity;
+
+  // simulation time and spawns accumulated since the last step
+  float pending_dt;
+  int pending_spawns;
+} ParticleEmitterGpu;
+
 // instance of a ParticleEmitterDesc
 typedef struct
 {
   // definition that created this system
   const ParticleEmitterDesc* desc;
 
-  // buffer of particle
-  Particle* particles;
+  // particle state, count particles are alive
+  ParticleStreams streams;
 
-  // doubly indirected sort record
+  // particle pool block behind the streams
+  void* streams_block;
+
+  // sort keys and the radix sort's ping-pong buffer, both max records of
+  // one particle pool block leased on the first sort
   SortRecord* sort_records;
+  SortRecord* sort_scratch;
+  void* sort_block;
 
   // current count of living particles
   int count;
@@ -139,22 +254,98 @@ typedef struct
   // time remaining until next emission
   float time_till_spawn;
 
+  // seconds simulated, the clock analytic particles are born on, and the
+  // earliest time one of them dies
+  float time;
+  float expiry;
+
   // stops automatic spawning when set
   int muted;
+
+  // PARTICLE_FEATURE_ flags of the descriptor and the update kernel they
+  // select, both refreshed by particle_emitter_select_kernels
+  int features;
+  ParticleUpdateKernel update_kernel;
+
+  // state of gpu simulated emitters, their particles never reach the CPU
+  ParticleEmitterGpu gpu;
+
+  // xoshiro128+ state of the spawn generators, one per SIMD lane
+  uint32_t random[4][PARTICLE_SIMD_WIDTH];
+
+  // conservative world space bounds of the particles as of the last update,
+  // unknown (and not maintained) for gpu simulated emitters
+  vec3 bounds_min;
+  vec3 bounds_max;
+
+  // live particles allowed by the scene's particle budget, at most max. The
+  // spawn rate scales down with it.
+  int budget_max;
+
+  // maintained by the scene: whether the emitter is worth drawing this frame,
+  // the fraction of the screen its bounds cover, the simulation time
+  // skipped while it was culled or far away and whether it is sorted in
+  // the scene's sorted transparency list rather than on its own
+  int visible;
+  float coverage;
+  float catch_up_dt;
+  int listed;
 } ParticleEmitter;
 
-void particle_update(Particle* part, float dt);
+// Runs the update kernel for the given PARTICLE_FEATURE_ flags
+int particle_streams_update(ParticleStreams* streams, int count, float dt, int features, ParticleBounds* bounds);
 
+// On failure (the particle pool is exhausted) the emitter is still valid,
+// with max 0 so it stays empty
 int particle_emitter_initialize(ParticleEmitter *emitter, const ParticleEmitterDesc* def);
 int particle_emitter_destroy(ParticleEmitter *emitter);
 int particle_emitter_refresh(ParticleEmitter *emitter);
 
-Particle* particle_emitter_emit_one(ParticleEmitter* emitter);
+// call after changing the descriptor's gravity, color, scale or orientation
+void particle_emitter_select_kernels(ParticleEmitter* emitter);
+
+// Spawns up to count particles at the end of the streams, fewer when the
+// budget runs out. Returns the number spawned.
+int particle_emitter_emit(ParticleEmitter* emitter, int count);
+
+// returns the index of the new particle, or -1 when the emitter is full
+int particle_emitter_emit_one(ParticleEmitter* emitter);
 void particle_emitter_burst(ParticleEmitter* emitter, int count);
 
 void particle_emitter_destroy_at_index(ParticleEmitter* emitter, int index);
 void particle_emitter_update(ParticleEmitter* emitter, float dt);
-void particle_emitter_sort(ParticleEmitter* emitter, const vec3 cam_position);
+
+// Analytic emitters spawn as usual but are never updated; expiring drops
+// the particles that died by the emitter's clock and refreshes the bounds
+int particle_emitter_analytic(const ParticleEmitter* emitter);
+void particle_emitter_expire(ParticleEmitter* emitter);
+
+// particle_emitter_update in pieces that can run on different threads:
+// spawn, then update ranges starting at multiples of PARTICLE_SIMD_WIDTH
+// (each returns its survivors, packed at its start), then join the ranges
+void particle_emitter_spawn(ParticleEmitter* emitter, float dt);
+int particle_emitter_update_range(ParticleEmitter* emitter, int first, int count, float dt, ParticleBounds* bounds);
+void particle_emitter_join_ranges(ParticleEmitter* emitter, int range_size, const int* alive, const ParticleBounds* bounds, int ranges_count);
+
+// transforms a world space point into the emitter's local space, the
+// space its particle streams live in
+void particle_emitter_to_local(const ParticleEmitter* emitter, vec3 out, const vec3 world);
+
+// Sorts the particles farthest from the eye (in local space, see
+// particle_emitter_to_local) first, reordering the streams themselves so
+// the next frame starts out nearly sorted
+void particle_emitter_sort(ParticleEmitter* emitter, const vec3 local_eye);
+
+// Sorts count records by ascending depth in 3 passes of 11 bits. scratch
+// holds count records too; returns whichever buffer ended up sorted.
+SortRecord* particle_sort_radix(SortRecord* records, SortRecord* scratch, int count);
+
+// Insertion sorts records that are mostly in order already, radix sorts
+// the rest. Returns whichever buffer ended up sorted.
+SortRecord* particle_sort_adaptive(SortRecord* records, SortRecord* scratch, int count);
+
+// every particle texture is resampled to one layer of this size in the atlas
+#define PARTICLE_ATLAS_SIZE 256
 
 typedef struct
 {
@@ -0,0 +1,249 @@
+#include "particles_gpu.h"
+#include "profiler.h"
+
+typedef struct
+{
+  GLuint program;
+
+  // uniforms
+  GLint delta_time_loc;
+  GLint gravity_loc;
+  GLint start_color_loc;
+  GLint end_color_loc;
+  GLint start_scale_loc;
+  GLint end_scale_loc;
+  GLint speed_loc;
+  GLint speed_variance_loc;
+  GLint life_time_loc;
+  GLint life_time_variance_loc;
+  GLint spawn_seed_loc;
+} ParticleSimShader;
+
+typedef struct
+{
+  int supported;
+  ParticleSimShader update_shader;
+  ParticleSimShader spawn_shader;
+  ProgramRequest update_req;
+  ProgramRequest spawn_req;
+
+  // varies the spawn seeds from step to step
+  uint32_t steps;
+} ParticleSimulation;
+
+static ParticleSimulation sSim;
+
+// attribute locations follow these tables
+static const char* const sUpdateAttribs[] = { "position", "rotation", "velocity", "ttl", "life" };
+static const char* const sSpawnAttribs[] = { "seed" };
+
+// captured in GpuParticle order
+static const char* const sFeedbackVaryings[] = {
+  "OutPosition", "OutRotation", "OutScale", "OutColor", "OutVelocity", "OutTtl", "OutLife"
+};
+
+int particles_gpu_supported() {
+  return sSim.supported;
+}
+
+static int request_sim_shader(ProgramRequest* req, int spawn) {
+  const char* spawn_defines[] = { "#define PARTICLE_SPAWN\n" };
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = "shaders/particle_sim.vert";
+  desc.geom_filename = "shaders/particle_sim.geom";
+  if (spawn) {
+    desc.defines = spawn_defines;
+    desc.defines_count = STATIC_ELEMENT_COUNT(spawn_defines);
+    desc.attribs = sSpawnAttribs;
+    desc.attribs_count = STATIC_ELEMENT_COUNT(sSpawnAttribs);
+  } else {
+    desc.attribs = sUpdateAttribs;
+    desc.attribs_count = STATIC_ELEMENT_COUNT(sUpdateAttribs);
+  }
+  desc.feedback_varyings = sFeedbackVaryings;
+  desc.feedback_varyings_count = STATIC_ELEMENT_COUNT(sFeedbackVaryings);
+  return utility_request_program(req, &desc);
+}
+
+static int resolve_sim_shader(ParticleSimShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
+    return 1;
+  }
+  GL_WRAP(shader->delta_time_loc = glGetUniformLocation(shader->program, "DeltaTime"));
+  GL_WRAP(shader->gravity_loc = glGetUniformLocation(shader->program, "Gravity"));
+  GL_WRAP(shader->start_color_loc = glGetUniformLocation(shader->program, "StartColor"));
+  GL_WRAP(shader->end_color_loc = glGetUniformLocation(shader->program, "EndColor"));
+  GL_WRAP(shader->start_scale_loc = glGetUniformLocation(shader->program, "StartScale"));
+  GL_WRAP(shader->end_scale_loc = glGetUniformLocation(shader->program, "EndScale"));
+  GL_WRAP(shader->speed_loc = glGetUniformLocation(shader->program, "Speed"));
+  GL_WRAP(shader->speed_variance_loc = glGetUniformLocation(shader->program, "SpeedVariance"));
+  GL_WRAP(shader->life_time_loc = glGetUniformLocation(shader->program, "LifeTime"));
+  GL_WRAP(shader->life_time_variance_loc = glGetUniformLocation(shader->program, "LifeTimeVariance"));
+  GL_WRAP(shader->spawn_seed_loc = glGetUniformLocation(shader->program, "SpawnSeed"));
+  return 0;
+}
+
+int particles_gpu_initialize() {
+  memset(&sSim, 0, sizeof(ParticleSimulation));
+  sSim.supported = (GLEW_VERSION_4_0 || (GLEW_VERSION_3_2 && GLEW_ARB_draw_indirect))
+    && (GLEW_VERSION_4_4 || GLEW_ARB_query_buffer_object);
+  printf("GPU Particles -- Supported: %s\n", BOOL_TO_STRING(sSim.supported));
+  if (!sSim.supported)
+    return 0;
+
+  if (request_sim_shader(&sSim.update_req, 0) || request_sim_shader(&sSim.spawn_req, 1)) {
+    printf("Unable to load particle simulation shader, GPU particles are disabled\n");
+    sSim.supported = 0;
+  }
+  return 0;
+}
+
+int particles_gpu_finish() {
+  if (!sSim.supported)
+    return 0;
+
+  if (resolve_sim_shader(&sSim.update_shader, &sSim.update_req)
+      || resolve_sim_shader(&sSim.spawn_shader, &sSim.spawn_req)) {
+    printf("Unable to load particle simulation shader, GPU particles are disabled\n");
+    sSim.supported = 0;
+  }
+  return 0;
+}
+
+int particles_gpu_enabled(const ParticleEmitter* emitter) {
+  return sSim.supported && emitter->desc->gpu_simulation;
+}
+
+static int create_buffers(ParticleEmitter* emitter) {
+  ParticleEmitterGpu* gpu = &emitter->gpu;
+  if (gpu->capacity)
+    return 0;
+  if (emitter->max <= 0)
+    return 1;
+
+  GL_WRAP(glGenBuffers(2, gpu->state_vbo));
+  for (int i = 0; i < 2; i++) {
+    GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, gpu->state_vbo[i]));
+    GL_WRAP(glBufferData(GL_ARRAY_BUFFER, emitter->max * sizeof(GpuParticle), NULL, GL_DYNAMIC_COPY));
+  }
+
+  uint32_t* seeds = (uint32_t*)malloc(emitter->max * sizeof(uint32_t));
+  for (int i = 0; i < emitter->max; i++) {
+    seeds[i] = utility_random_u32();
+  }
+  GL_WRAP(glGenBuffers(1, &gpu->seed_vbo));
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, gpu->seed_vbo));
+  GL_WRAP(glBufferData(GL_ARRAY_BUFFER, emitter->max * sizeof(uint32_t), seeds, GL_STATIC_DRAW));
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  free(seeds);
+
+  // no particles yet
+  GpuParticleCommands commands;
+  memset(&commands, 0, sizeof(GpuParticleCommands));
+  commands.step.instance_count = 1;
+  commands.draw.count = 4;
+  GL_WRAP(glGenBuffers(1, &gpu->command_buffer));
+  GL_WRAP(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu->command_buffer));
+  GL_WRAP(glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(GpuParticleCommands), &commands, GL_DYNAMIC_COPY));
+  GL_WRAP(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+
+  GL_WRAP(glGenQueries(1, &gpu->query));
+  gpu->current = 0;
+  gpu->capacity = emitter->max;
+  return 0;
+}
+
+void particles_gpu_release(ParticleEmitter* emitter) {
+  ParticleEmitterGpu* gpu = &emitter->gpu;
+  if (gpu->capacity) {
+    GL_WRAP(glDeleteBuffers(2, gpu->state_vbo));
+    GL_WRAP(glDeleteBuffers(1, &gpu->seed_vbo));
+    GL_WRAP(glDeleteBuffers(1, &gpu->command_buffer));
+    GL_WRAP(glDeleteQueries(1, &gpu->query));
+  }
+  memset(gpu, 0, sizeof(ParticleEmitterGpu));
+}
+
+static void bind_sim_uniforms(const ParticleSimShader* shader, const ParticleEmitter* emitter) {
+  const ParticleEmitterDesc* desc = emitter->desc;
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glUniform1f(shader->delta_time_loc, emitter->gpu.pending_dt));
+  GL_WRAP(glUniform1i(shader->gravity_loc, desc->simulate_gravity));
+  GL_WRAP(glUniform4fv(shader->start_color_loc, 1, desc->start_color));
+  GL_WRAP(glUniform4fv(shader->end_color_loc, 1, desc->end_color));
+  GL_WRAP(glUniform1f(shader->start_scale_loc, desc->start_scale));
+  GL_WRAP(glUniform1f(shader->end_scale_loc, desc->end_scale));
+  GL_WRAP(glUniform1f(shader->speed_loc, desc->speed));
+  GL_WRAP(glUniform1f(shader->speed_variance_loc, desc->speed_variance));
+  GL_WRAP(glUniform1f(shader->life_time_loc, desc->life_time));
+  GL_WRAP(glUniform1f(shader->life_time_variance_loc, desc->life_time_variance));
+  GL_WRAP(glUniform1ui(shader->spawn_seed_loc, sSim.steps));
+}
+
+static void bind_state_attrib(GLuint loc, int size, size_t offset) {
+  GL_WRAP(glEnableVertexAttribArray(loc));
+  GL_WRAP(glVertexAttribPointer(loc, size, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (const void*)offset));
+}
+
+void particles_gpu_step(ParticleEmitter* emitter) {
+  ParticleEmitterGpu* gpu = &emitter->gpu;
+  if (!particles_gpu_enabled(emitter) || create_buffers(emitter))
+    return;
+
+  int src = gpu->current;
+  int dst = 1 - src;
+  sSim.steps++;
+
+  GL_WRAP(glEnable(GL_RASTERIZER_DISCARD));
+  GL_WRAP(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, gpu->state_vbo[dst]));
+  GL_WRAP(glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, gpu->query));
+  GL_WRAP(glBeginTransformFeedback(GL_POINTS));
+
+  // advance the living particles; the geometry shader only passes on the
+  // ones still alive, which compacts them at the front of the other buffer
+  bind_sim_uniforms(&sSim.update_shader, emitter);
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, gpu->state_vbo[src]));
+  bind_state_attrib(0, 3, offsetof(GpuParticle, pos));
+  bind_state_attrib(1, 3, offsetof(GpuParticle, rot));
+  bind_state_attrib(2, 3, offsetof(GpuParticle, velocity));
+  bind_state_attrib(3, 1, offsetof(GpuParticle, ttl));
+  bind_state_attrib(4, 1, offsetof(GpuParticle, life));
+  GL_WRAP(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu->command_buffer));
+  GL_WRAP(glDrawArraysIndirect(GL_POINTS, (const void*)offsetof(GpuParticleCommands, step)));
+  profiler_count_draw(GL_POINTS, 0);
+  GL_WRAP(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+  for (GLuint i = 0; i < STATIC_ELEMENT_COUNT(sUpdateAttribs); i++) {
+    GL_WRAP(glDisableVertexAttribArray(i));
+  }
+
+  // append the new particles behind them. The feedback buffer holds
+  // capacity particles and silently drops the writes past that.
+  int spawns = std::min(gpu->pending_spawns, gpu->capacity);
+  if (spawns > 0) {
+    bind_sim_uniforms(&sSim.spawn_shader, emitter);
+    GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, gpu->seed_vbo));
+    GL_WRAP(glEnableVertexAttribArray(0));
+    GL_WRAP(glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (const void*)0));
+    GL_WRAP(glDrawArrays(GL_POINTS, 0, spawns));
+    profiler_count_draw(GL_POINTS, spawns);
+    GL_WRAP(glDisableVertexAttribArray(0));
+  }
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+  GL_WRAP(glEndTransformFeedback());
+  GL_WRAP(glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN));
+  GL_WRAP(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0));
+  GL_WRAP(glDisable(GL_RASTERIZER_DISCARD));
+
+  // the surviving count goes straight into both draw commands, the GPU
+  // waits on the query instead of the CPU
+  GL_WRAP(glBindBuffer(GL_QUERY_BUFFER, gpu->command_buffer));
+  GL_WRAP(glGetQueryObjectuiv(gpu->query, GL_QUERY_RESULT, (GLuint*)offsetof(GpuParticleCommands, step.count)));
+  GL_WRAP(glGetQueryObjectuiv(gpu->query, GL_QUERY_RESULT, (GLuint*)offsetof(GpuParticleCommands, draw.instance_count)));
+  GL_WRAP(glBindBuffer(GL_QUERY_BUFFER, 0));
+
+  gpu->current = dst;
+  gpu->pending_dt = 0.0f;
+  gpu->pending_spawns = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "common.h"
+#include "particles.h"
+
+// State of one GPU simulated particle. The leading fields match
+// ParticleInstance, so the state buffer is drawn as the instance buffer.
+typedef struct
+{
+  vec3 pos;
+  vec3 rot;
+  vec3 scale;
+  vec4 color;
+  vec3 velocity;
+  float ttl;
+  float life; // ttl at spawn
+} GpuParticle;
+
+typedef struct
+{
+  GLuint count;
+  GLuint instance_count;
+  GLuint first;
+  GLuint base_instance;
+} DrawArraysIndirectCommand;
+
+// Both commands take their count from the particles written by the last
+// step, copied on the GPU through a query buffer
+typedef struct
+{
+  DrawArraysIndirectCommand step; // GL_POINTS, one vertex per particle
+  DrawArraysIndirectCommand draw; // GL_TRIANGLE_STRIP, one quad instance per particle
+} GpuParticleCommands;
+
+// Needs geometry shaders, indirect draws and query buffer objects, and the
+// simulation programs to have built
+int particles_gpu_supported();
+
+// Issues the simulation program builds; particles_gpu_finish resolves them
+// once they are done. Both are no-ops when unsupported.
+int particles_gpu_initialize();
+int particles_gpu_finish();
+
+int particles_gpu_enabled(const ParticleEmitter* emitter);
+
+// Advances the particles by the time accumulated since the last step,
+// appends the pending spawns and compacts away the dead ones
+void particles_gpu_step(ParticleEmitter* emitter);
+void particles_gpu_release(ParticleEmitter* emitter);
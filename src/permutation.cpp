@@ -0,0 +1,86 @@
+#include "permutation.h"
+
+void permutation_cache_initialize(PermutationCache* cache, const char* name
+  , const char* const* feature_defines, int feature_count
+  , size_t shader_size, PermutationRequestFunc request, PermutationResolveFunc resolve) {
+  assert(feature_count <= PERMUTATION_FEATURES_MAX);
+  memset(cache, 0, sizeof(PermutationCache));
+  cache->name = name;
+  cache->feature_defines = feature_defines;
+  cache->feature_count = feature_count;
+  cache->shader_size = shader_size;
+  cache->request = request;
+  cache->resolve = resolve;
+}
+
+static int find_permutation(const PermutationCache* cache, uint32_t key) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->keys[i] == key)
+      return i;
+  }
+  return -1;
+}
+
+static int request_permutation(PermutationCache* cache, uint32_t key) {
+  if (cache->count >= PERMUTATION_CACHE_MAX) {
+    printf("%s permutation cache is full\n", cache->name);
+    return -1;
+  }
+
+  const char* defines[PERMUTATION_FEATURES_MAX];
+  int defines_count = 0;
+  for (int i = 0; i < cache->feature_count; i++) {
+    if (key & PERMUTATION_BIT(i)) {
+      defines[defines_count++] = cache->feature_defines[i];
+    }
+  }
+
+  int idx = cache->count++;
+  cache->keys[idx] = key;
+  cache->shaders[idx] = NULL;
+  cache->pending[idx] = !cache->request(&cache->requests[idx], defines, defines_count);
+  if (!cache->pending[idx]) {
+    printf("Unable to build %s permutation 0x%x\n", cache->name, key);
+  }
+  return idx;
+}
+
+static void resolve_permutation(PermutationCache* cache, int idx) {
+  if (!cache->pending[idx])
+    return;
+  cache->pending[idx] = 0;
+
+  GLuint program;
+  if (!(program = utility_finish_program(&cache->requests[idx]))) {
+    printf("Unable to build %s permutation 0x%x\n", cache->name, cache->keys[idx]);
+    return;
+  }
+
+  void* shader = calloc(1, cache->shader_size);
+  cache->resolve(shader, program);
+  cache->shaders[idx] = shader;
+}
+
+void permutation_cache_prefetch(PermutationCache* cache, uint32_t key) {
+  if (find_permutation(cache, key) < 0) {
+    request_permutation(cache, key);
+  }
+}
+
+int permutation_cache_finish(PermutationCache* cache) {
+  int err = 0;
+  for (int i = 0; i < cache->count; i++) {
+    resolve_permutation(cache, i);
+    err |= !cache->shaders[i];
+  }
+  return err;
+}
+
+const void* permutation_cache_get(PermutationCache* cache, uint32_t key) {
+  int idx = find_permutation(cache, key);
+  if (idx < 0 && (idx = request_permutation(cache, key)) < 0)
+    return NULL;
+
+  resolve_permutation(cache, idx);
+  return cache->shaders[idx];
+}
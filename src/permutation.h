@@ -0,0 +1,46 @@
+#pragma once
+#include "common.h"
+
+#define PERMUTATION_FEATURES_MAX 32
+#define PERMUTATION_CACHE_MAX 128
+
+// Issues the program build for the #define lines of the enabled features
+typedef int (*PermutationRequestFunc)(ProgramRequest* req, const char** defines, int defines_count);
+
+// Fills in a shader struct once its program has linked
+typedef void (*PermutationResolveFunc)(void* out_shader, GLuint program);
+
+// Shader variants keyed by a bitmask of features, where bit i enables
+// feature_defines[i]. Variants are compiled on first use, or ahead of time
+// through permutation_cache_prefetch.
+typedef struct
+{
+  const char* name;
+  const char* const* feature_defines;
+  int feature_count;
+  size_t shader_size;
+  PermutationRequestFunc request;
+  PermutationResolveFunc resolve;
+
+  // key -> shader, NULL marks a variant that failed to build
+  uint32_t keys[PERMUTATION_CACHE_MAX];
+  void* shaders[PERMUTATION_CACHE_MAX];
+  ProgramRequest requests[PERMUTATION_CACHE_MAX];
+  int pending[PERMUTATION_CACHE_MAX];
+  int count;
+} PermutationCache;
+
+void permutation_cache_initialize(PermutationCache* cache, const char* name
+  , const char* const* feature_defines, int feature_count
+  , size_t shader_size, PermutationRequestFunc request, PermutationResolveFunc resolve);
+
+// starts building the variant for key without waiting for it
+void permutation_cache_prefetch(PermutationCache* cache, uint32_t key);
+
+// resolves every prefetched variant, returns non-zero if any failed to build
+int permutation_cache_finish(PermutationCache* cache);
+
+// returns the variant for key, building it if needed. NULL if it failed to build
+const void* permutation_cache_get(PermutationCache* cache, uint32_t key);
+
+#define PERMUTATION_BIT(feature) (1u << (feature))
@@ -0,0 +1,218 @@
+#include "profiler.h"
+#include "imgui/imgui.h"
+
+DEFINE_ENUM(ProfilerPass, profiler_pass_strings, ENUM_ProfilerPass);
+
+// frames of latency before a query result is read back
+#define PROFILER_QUERY_LATENCY 4
+
+// number of samples averaged for the displayed timings
+#define PROFILER_AVERAGE_FRAMES 30
+
+enum
+{
+  PROFILER_QUERY_TIME,
+  PROFILER_QUERY_PRIMITIVES,
+  PROFILER_QUERY_VERTEX_INVOCATIONS,
+  PROFILER_QUERY_FRAGMENT_INVOCATIONS,
+  PROFILER_QUERY_COUNT
+};
+
+static const GLenum sQueryTargets[PROFILER_QUERY_COUNT] = {
+  GL_TIME_ELAPSED,
+  GL_PRIMITIVES_SUBMITTED_ARB,
+  GL_VERTEX_SHADER_INVOCATIONS_ARB,
+  GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+};
+
+typedef struct
+{
+  GLuint queries[PROFILER_QUERY_LATENCY][PROFILER_PASS_COUNT][PROFILER_QUERY_COUNT];
+  int issued[PROFILER_QUERY_LATENCY][PROFILER_PASS_COUNT];
+  int has_timer_query;
+  int has_pipeline_statistics;
+  unsigned frame;
+  int active_pass;
+  float gpu_ms_accum[PROFILER_PASS_COUNT];
+  int gpu_ms_samples[PROFILER_PASS_COUNT];
+  ProfilerPassStats current[PROFILER_PASS_COUNT];
+  ProfilerPassStats stats[PROFILER_PASS_COUNT];
+} Profiler;
+
+static Profiler sProfiler;
+
+static int query_enabled(int query) {
+  if (query == PROFILER_QUERY_TIME)
+    return sProfiler.has_timer_query;
+  return sProfiler.has_pipeline_statistics;
+}
+
+int profiler_initialize() {
+  memset(&sProfiler, 0, sizeof(Profiler));
+  sProfiler.active_pass = -1;
+  sProfiler.has_timer_query = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+  sProfiler.has_pipeline_statistics = GLEW_ARB_pipeline_statistics_query;
+  printf("Profiler -- Timer Query: %s Pipeline Statistics: %s\n"
+    , BOOL_TO_STRING(sProfiler.has_timer_query), BOOL_TO_STRING(sProfiler.has_pipeline_statistics));
+  GL_WRAP(glGenQueries(PROFILER_QUERY_LATENCY * PROFILER_PASS_COUNT * PROFILER_QUERY_COUNT, &sProfiler.queries[0][0][0]));
+  return 0;
+}
+
+int profiler_has_timer_query() {
+  return sProfiler.has_timer_query;
+}
+
+int profiler_has_pipeline_statistics() {
+  return sProfiler.has_pipeline_statistics;
+}
+
+// read back the oldest frame's queries if the gpu has finished with them
+static void read_back_slot(int slot) {
+  for (int pass = 0; pass < PROFILER_PASS_COUNT; pass++) {
+    if (!sProfiler.issued[slot][pass])
+      continue;
+
+    GLuint available = GL_TRUE;
+    for (int q = 0; q < PROFILER_QUERY_COUNT; q++) {
+      if (query_enabled(q)) {
+        GLuint query_available = 0;
+        GL_WRAP(glGetQueryObjectuiv(sProfiler.queries[slot][pass][q], GL_QUERY_RESULT_AVAILABLE, &query_available));
+        available = available && query_available;
+      }
+    }
+    if (!available)
+      continue; // never stall, just drop the sample
+
+    GLuint64 results[PROFILER_QUERY_COUNT] = { 0 };
+    for (int q = 0; q < PROFILER_QUERY_COUNT; q++) {
+      if (query_enabled(q)) {
+        GL_WRAP(glGetQueryObjectui64v(sProfiler.queries[slot][pass][q], GL_QUERY_RESULT, &results[q]));
+      }
+    }
+
+    ProfilerPassStats* stats = &sProfiler.stats[pass];
+    sProfiler.gpu_ms_accum[pass] += results[PROFILER_QUERY_TIME] / 1000000.0f;
+    if (++sProfiler.gpu_ms_samples[pass] >= PROFILER_AVERAGE_FRAMES) {
+      stats->gpu_ms = sProfiler.gpu_ms_accum[pass] / sProfiler.gpu_ms_samples[pass];
+      sProfiler.gpu_ms_accum[pass] = 0.0f;
+      sProfiler.gpu_ms_samples[pass] = 0;
+    }
+    stats->primitives = results[PROFILER_QUERY_PRIMITIVES];
+    stats->vertex_invocations = results[PROFILER_QUERY_VERTEX_INVOCATIONS];
+    stats->fragment_invocations = results[PROFILER_QUERY_FRAGMENT_INVOCATIONS];
+  }
+}
+
+void profiler_begin_frame() {
+  int slot = sProfiler.frame % PROFILER_QUERY_LATENCY;
+  read_back_slot(slot);
+  memset(sProfiler.issued[slot], 0, sizeof(sProfiler.issued[slot])); // unread samples are dropped
+  memset(sProfiler.current, 0, sizeof(sProfiler.current));
+}
+
+void profiler_end_frame() {
+  assert(sProfiler.active_pass < 0);
+  for (int pass = 0; pass < PROFILER_PASS_COUNT; pass++) {
+    sProfiler.stats[pass].draws = sProfiler.current[pass].draws;
+    sProfiler.stats[pass].triangles = sProfiler.current[pass].triangles;
+  }
+  sProfiler.frame++;
+}
+
+void profiler_begin_pass(ProfilerPass pass) {
+  assert(sProfiler.active_pass < 0);
+  int slot = sProfiler.frame % PROFILER_QUERY_LATENCY;
+  sProfiler.active_pass = pass;
+  if (sProfiler.issued[slot][pass])
+    return; // pass was split within a frame, only the first part is queried
+
+  for (int q = 0; q < PROFILER_QUERY_COUNT; q++) {
+    if (query_enabled(q)) {
+      GL_WRAP(glBeginQuery(sQueryTargets[q], sProfiler.queries[slot][pass][q]));
+    }
+  }
+  sProfiler.issued[slot][pass] = 2; // begun but not yet ended
+}
+
+void profiler_end_pass() {
+  assert(sProfiler.active_pass >= 0);
+  int slot = sProfiler.frame % PROFILER_QUERY_LATENCY;
+  int pass = sProfiler.active_pass;
+  sProfiler.active_pass = -1;
+  if (sProfiler.issued[slot][pass] != 2)
+    return;
+
+  for (int q = 0; q < PROFILER_QUERY_COUNT; q++) {
+    if (query_enabled(q)) {
+      GL_WRAP(glEndQuery(sQueryTargets[q]));
+    }
+  }
+  sProfiler.issued[slot][pass] = 1;
+}
+
+void profiler_count_draw(GLenum mode, int vertex_count) {
+  if (sProfiler.active_pass < 0)
+    return;
+
+  ProfilerPassStats* stats = &sProfiler.current[sProfiler.active_pass];
+  stats->draws++;
+  switch (mode) {
+    case GL_TRIANGLES: stats->triangles += vertex_count / 3; break;
+    case GL_TRIANGLE_STRIP: // fallthrough
+    case GL_TRIANGLE_FAN: stats->triangles += std::max(vertex_count - 2, 0); break;
+    case GL_QUADS: stats->triangles += (vertex_count / 4) * 2; break;
+    default: break;
+  }
+}
+
+const ProfilerPassStats* profiler_get_stats(ProfilerPass pass) {
+  return &sProfiler.stats[pass];
+}
+
+static void format_count(char* buf, size_t buf_size, GLuint64 value) {
+  if (value >= 1000000) {
+    snprintf(buf, buf_size, "%.2fM", value / 1000000.0);
+  } else if (value >= 1000) {
+    snprintf(buf, buf_size, "%.1fK", value / 1000.0);
+  } else {
+    snprintf(buf, buf_size, "%u", (unsigned)value);
+  }
+}
+
+void profiler_gui() {
+  if (!sProfiler.has_timer_query) {
+    ImGui::Text("Timer queries unavailable");
+  }
+  if (!sProfiler.has_pipeline_statistics) {
+    ImGui::Text("ARB_pipeline_statistics_query unavailable");
+  }
+
+  ImGui::Columns(6, "profiler", false);
+  ImGui::SetColumnWidth(0, 80.0f);
+  ImGui::Text("Pass"); ImGui::NextColumn();
+  ImGui::Text("ms"); ImGui::NextColumn();
+  ImGui::Text("Draws"); ImGui::NextColumn();
+  ImGui::Text("Tris"); ImGui::NextColumn();
+  ImGui::Text("VS"); ImGui::NextColumn();
+  ImGui::Text("FS"); ImGui::NextColumn();
+  ImGui::Separator();
+
+  char buf[32];
+  float total_ms = 0.0f;
+  for (int pass = 0; pass < PROFILER_PASS_COUNT; pass++) {
+    const ProfilerPassStats* stats = &sProfiler.stats[pass];
+    total_ms += stats->gpu_ms;
+    ImGui::Text("%s", profiler_pass_strings[pass]); ImGui::NextColumn();
+    ImGui::Text("%.2f", stats->gpu_ms); ImGui::NextColumn();
+    ImGui::Text("%i", stats->draws); ImGui::NextColumn();
+    format_count(buf, sizeof(buf), (sProfiler.has_pipeline_statistics) ? stats->primitives : (GLuint64)stats->triangles);
+    ImGui::Text("%s", buf); ImGui::NextColumn();
+    format_count(buf, sizeof(buf), stats->vertex_invocations);
+    ImGui::Text("%s", buf); ImGui::NextColumn();
+    format_count(buf, sizeof(buf), stats->fragment_invocations);
+    ImGui::Text("%s", buf); ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  ImGui::Separator();
+  ImGui::Text("GPU Total: %.2f ms", total_ms);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "common.h"
+
+#define ENUM_ProfilerPass(D)                      \
+  D(PROFILER_PASS_SHADOW,     "Shadow Map")       \
+  D(PROFILER_PASS_GBUFFER,    "G-Buffer")         \
+  D(PROFILER_PASS_RESOLVE,    "Material Resolve") \
+  D(PROFILER_PASS_LIGHTING,   "Lighting")         \
+  D(PROFILER_PASS_SKYBOX,     "Skybox")           \
+  D(PROFILER_PASS_PARTICLES,  "Particle Sim")     \
+  D(PROFILER_PASS_FORWARD,    "Forward")          \
+  D(PROFILER_PASS_HEATMAP,    "Overdraw Heatmap") \
+  D(PROFILER_PASS_DEBUG,      "Debug")
+
+DECLARE_ENUM(ProfilerPass, profiler_pass_strings, ENUM_ProfilerPass);
+enum { PROFILER_PASS_COUNT = 0 ENUM_ProfilerPass(ENUM_COUNT_VALUE) };
+
+// Per-pass counters. GPU values lag a few frames behind the CPU values.
+typedef struct
+{
+  // gpu time spent in the pass
+  float gpu_ms;
+
+  // draw calls issued
+  int draws;
+
+  // triangles submitted (counted on the CPU)
+  int triangles;
+
+  // ARB_pipeline_statistics_query counters
+  GLuint64 primitives;
+  GLuint64 vertex_invocations;
+  GLuint64 fragment_invocations;
+} ProfilerPassStats;
+
+int profiler_initialize();
+int profiler_has_timer_query();
+int profiler_has_pipeline_statistics();
+
+void profiler_begin_frame();
+void profiler_end_frame();
+void profiler_begin_pass(ProfilerPass pass);
+void profiler_end_pass();
+
+// record a draw call of vertex_count vertices with the given primitive mode
+void profiler_count_draw(GLenum mode, int vertex_count);
+
+const ProfilerPassStats* profiler_get_stats(ProfilerPass pass);
+void profiler_gui();
@@ -0,0 +1,300 @@
+#include "program_cache.h"
+#include "utility.h"
+
+#define PROGRAM_CACHE_MAGIC 0x50524742 // 'PRGB'
+#define PROGRAM_CACHE_VERSION 1
+#define PROGRAM_CACHE_TRACKED_MAX 512
+#define PROGRAM_CACHE_FORMATS_MAX 64
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+  float compile_ms; // what building this program from source cost
+} ProgramCacheHeader;
+
+typedef struct
+{
+  GLuint program;
+  uint64_t key;
+  Uint64 start;
+  float compile_ms; // from start to the build completing, once completed
+  int completed;
+  int binary;
+} ProgramCacheEntry;
+
+typedef struct
+{
+  int enabled;
+  char* dir;
+  uint64_t driver_hash;
+  GLint formats[PROGRAM_CACHE_FORMATS_MAX];
+  int formats_count;
+
+  ProgramCacheEntry entries[PROGRAM_CACHE_TRACKED_MAX];
+  int entries_count;
+
+  int hits;
+  int misses;
+  int stale;
+  float load_ms;
+  float saved_ms;
+} ProgramCache;
+
+static ProgramCache sCache;
+
+static float ms_since(Uint64 start) {
+  return (float)((double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+}
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const char* str) {
+  // hash the terminator too so "ab"+"c" and "a"+"bc" differ
+  return str ? hash_bytes(hash, str, strlen(str) + 1) : hash_bytes(hash, "", 1);
+}
+
+static uint64_t hash_file(uint64_t hash, const char* filename, int* err) {
+  unsigned char* contents;
+  size_t size;
+  if (utility_buffer_file(filename, &contents, &size)) {
+    *err = 1;
+    return hash;
+  }
+  hash = hash_bytes(hash, contents, size);
+  free(contents);
+  return hash;
+}
+
+static void entry_path(char* out, size_t out_size, uint64_t key) {
+  snprintf(out, out_size, "%s%016llx.bin", sCache.dir, (unsigned long long)key);
+}
+
+static int format_supported(GLint format) {
+  for (int i = 0; i < sCache.formats_count; i++) {
+    if (sCache.formats[i] == format)
+      return 1;
+  }
+  return 0;
+}
+
+static ProgramCacheEntry* find_entry(GLuint program) {
+  for (int i = 0; i < sCache.entries_count; i++) {
+    if (sCache.entries[i].program == program)
+      return &sCache.entries[i];
+  }
+  return NULL;
+}
+
+static ProgramCacheEntry* add_entry(GLuint program, uint64_t key) {
+  ProgramCacheEntry* entry = find_entry(program);
+  if (!entry) {
+    if (sCache.entries_count >= PROGRAM_CACHE_TRACKED_MAX)
+      return NULL;
+    entry = &sCache.entries[sCache.entries_count++];
+  }
+  memset(entry, 0, sizeof(ProgramCacheEntry));
+  entry->program = program;
+  entry->key = key;
+  return entry;
+}
+
+int program_cache_initialize() {
+  memset(&sCache, 0, sizeof(ProgramCache));
+
+  if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+    GLint formats_count = 0;
+    GL_WRAP(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats_count));
+    if (formats_count > 0 && formats_count <= PROGRAM_CACHE_FORMATS_MAX) {
+      GL_WRAP(glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, sCache.formats));
+      sCache.formats_count = formats_count;
+    }
+  }
+
+  if (sCache.formats_count > 0) {
+    sCache.dir = SDL_GetPrefPath("Deferred", "shader_cache");
+  }
+  sCache.enabled = sCache.dir != NULL;
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = hash_string(hash, (const char*)glGetString(GL_VENDOR));
+  hash = hash_string(hash, (const char*)glGetString(GL_RENDERER));
+  hash = hash_string(hash, (const char*)glGetString(GL_VERSION));
+  sCache.driver_hash = hash;
+
+  printf("Program Cache -- Enabled: %s Binary Formats: %i Path: %s\n"
+    , BOOL_TO_STRING(sCache.enabled), sCache.formats_count, sCache.dir ? sCache.dir : "none");
+  return 0;
+}
+
+int program_cache_enabled() {
+  return sCache.enabled;
+}
+
+uint64_t program_cache_key(const ProgramDesc* desc) {
+  if (!sCache.enabled)
+    return 0;
+
+  int err = 0;
+  uint64_t hash = sCache.driver_hash;
+  hash = hash_file(hash, desc->vert_filename, &err);
+  if (desc->frag_filename) hash = hash_file(hash, desc->frag_filename, &err);
+  if (desc->geom_filename) hash = hash_file(hash, desc->geom_filename, &err);
+  for (int i = 0; i < desc->defines_count; i++) {
+    hash = hash_string(hash, desc->defines[i]);
+  }
+  // the bindings are baked into the binary
+  for (int i = 0; i < desc->attribs_count; i++) {
+    hash = hash_string(hash, desc->attribs[i]);
+  }
+  for (int i = 0; i < desc->frag_outputs_count; i++) {
+    hash = hash_string(hash, desc->frag_outputs[i]);
+  }
+  for (int i = 0; i < desc->feedback_varyings_count; i++) {
+    hash = hash_string(hash, desc->feedback_varyings[i]);
+  }
+  if (err)
+    return 0;
+  return hash ? hash : 1;
+}
+
+GLuint program_cache_load(uint64_t key) {
+  if (!sCache.enabled || !key)
+    return 0;
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  char path[1024];
+  entry_path(path, sizeof(path), key);
+
+  unsigned char* contents;
+  size_t size;
+  if (utility_buffer_file(path, &contents, &size)) {
+    sCache.misses++;
+    return 0;
+  }
+
+  const ProgramCacheHeader* header = (const ProgramCacheHeader*)contents;
+  if (size < sizeof(ProgramCacheHeader)
+      || header->magic != PROGRAM_CACHE_MAGIC
+      || header->version != PROGRAM_CACHE_VERSION
+      || header->key != key
+      || size - sizeof(ProgramCacheHeader) != header->length
+      || !format_supported((GLint)header->format)) {
+    free(contents);
+    remove(path);
+    sCache.stale++;
+    sCache.misses++;
+    return 0;
+  }
+
+  GLuint program;
+  GL_WRAP(program = glCreateProgram());
+  GL_WRAP(glProgramBinary(program, (GLenum)header->format, contents + sizeof(ProgramCacheHeader), (GLsizei)header->length));
+  float compile_ms = header->compile_ms;
+  free(contents);
+
+  // the driver is free to reject a binary it no longer likes
+  GLint linked = GL_FALSE;
+  GL_WRAP(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+  if (linked != GL_TRUE) {
+    GL_WRAP(glDeleteProgram(program));
+    remove(path);
+    sCache.stale++;
+    sCache.misses++;
+    return 0;
+  }
+
+  ProgramCacheEntry* entry = add_entry(program, key);
+  if (entry) {
+    entry->binary = 1;
+  }
+
+  float load_ms = ms_since(start);
+  sCache.hits++;
+  sCache.load_ms += load_ms;
+  sCache.saved_ms += compile_ms - load_ms;
+  return program;
+}
+
+int program_cache_is_binary(GLuint program) {
+  const ProgramCacheEntry* entry = find_entry(program);
+  return entry && entry->binary;
+}
+
+void program_cache_track(GLuint program, uint64_t key, Uint64 start) {
+  if (!sCache.enabled)
+    return;
+
+  // program names are recycled, so drop whatever was recorded for this one
+  if (!key) {
+    ProgramCacheEntry* entry = find_entry(program);
+    if (entry)
+      entry->program = 0;
+    return;
+  }
+
+  ProgramCacheEntry* entry = add_entry(program, key);
+  if (!entry)
+    return;
+  entry->start = start;
+  GL_WRAP(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+}
+
+void program_cache_complete(GLuint program) {
+  ProgramCacheEntry* entry = find_entry(program);
+  if (entry && !entry->binary && !entry->completed) {
+    entry->compile_ms = ms_since(entry->start);
+    entry->completed = 1;
+  }
+}
+
+void program_cache_store(GLuint program) {
+  const ProgramCacheEntry* entry = find_entry(program);
+  if (!entry || entry->binary)
+    return;
+
+  GLint length = 0;
+  GL_WRAP(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+  if (length <= 0)
+    return;
+
+  unsigned char* buf = (unsigned char*)malloc(sizeof(ProgramCacheHeader) + length);
+  ProgramCacheHeader* header = (ProgramCacheHeader*)buf;
+  GLenum format = 0;
+  GL_WRAP(glGetProgramBinary(program, length, NULL, &format, buf + sizeof(ProgramCacheHeader)));
+  header->magic = PROGRAM_CACHE_MAGIC;
+  header->version = PROGRAM_CACHE_VERSION;
+  header->key = entry->key;
+  header->format = (uint32_t)format;
+  header->length = (uint32_t)length;
+  header->compile_ms = entry->completed ? entry->compile_ms : ms_since(entry->start);
+
+  char path[1024];
+  entry_path(path, sizeof(path), entry->key);
+  FILE* f = fopen(path, "wb");
+  if (f) {
+    fwrite(buf, 1, sizeof(ProgramCacheHeader) + length, f);
+    fclose(f);
+  } else {
+    printf("Unable to write program cache entry %s\n", path);
+  }
+  free(buf);
+}
+
+void program_cache_print_stats() {
+  int lookups = sCache.hits + sCache.misses;
+  float hit_rate = lookups ? 100.0f * (float)sCache.hits / (float)lookups : 0.0f;
+  printf("Program Cache -- Hits: %i Misses: %i (Stale: %i) Hit Rate: %.1f%% Load: %.2fms Saved: %.2fms\n"
+    , sCache.hits, sCache.misses, sCache.stale, hit_rate, sCache.load_ms, sCache.saved_ms);
+}
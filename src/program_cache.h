@@ -0,0 +1,28 @@
+#pragma once
+#include "common.h"
+
+// On-disk cache of linked program binaries (ARB_get_program_binary).
+// Entries are keyed by a hash of the shader sources, the defines and the
+// driver vendor/renderer/version strings, so a driver update simply misses.
+int program_cache_initialize();
+int program_cache_enabled();
+
+// Returns 0 when the cache is disabled or a source file can't be read
+uint64_t program_cache_key(const ProgramDesc* desc);
+
+// Creates a program from a cached binary, or returns 0 on a miss or a stale
+// entry. A program loaded this way is already linked with its final attribute
+// bindings; utility_link_program leaves it alone.
+GLuint program_cache_load(uint64_t key);
+int program_cache_is_binary(GLuint program);
+
+// Marks a program compiled from source (started at the given performance
+// counter value) to be written out each time it links. Completing records
+// the compile time the first time the build is seen done; a program stored
+// without it counts the time up to the store.
+void program_cache_track(GLuint program, uint64_t key, Uint64 start);
+void program_cache_complete(GLuint program);
+void program_cache_store(GLuint program);
+
+// Prints hits, misses and the compile time saved so far
+void program_cache_print_stats();
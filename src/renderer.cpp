@@ -1,58 +1,136 @@
 #include "renderer.h"
 
-int renderer_initialize(Renderer* r) {
+int renderer_initialize(Renderer* r, LoadingCallback update_loading_cb) {
   memset(r, 0, sizeof(Renderer));
   r->render_debug_lines = 1;
+  r->has_clip_control = GLEW_VERSION_4_5 || GLEW_ARB_clip_control;
+  r->has_parallel_shader_compile = GLEW_ARB_parallel_shader_compile;
+  printf("Renderer -- Clip Control: %s Parallel Shader Compile: %s\n"
+    , BOOL_TO_STRING(r->has_clip_control), BOOL_TO_STRING(r->has_parallel_shader_compile));
+
+  // let the driver use as many compiler threads as it likes
+  if (r->has_parallel_shader_compile) {
+    GL_WRAP(glMaxShaderCompilerThreadsARB(0xFFFFFFFF));
+  }
 
   int err = 0;
-  if ((err = deferred_initialize(&r->deferred))) {
-    printf("Deferred renderer init failed\n");
+  printf("<-- Initializing program cache... -->\n");
+  if ((err = program_cache_initialize())) {
+    printf("Program cache init failed\n");
     return err;
   }
 
-  printf("<-- Initializing forward renderer... -->\n");
-  if ((err = forward_initialize(&r->forward))) {
-    printf("Forward renderer init failed\n");
+  printf("<-- Initializing profiler... -->\n");
+  if ((err = profiler_initialize())) {
+    printf("Profiler init failed\n");
+    return err;
+  }
+
+  // the shadow map and debug line shaders are only requested here, so they
+  // build in the same batch as the deferred renderer's
+  printf("<-- Initializing shadow map... -->\n");
+  if ((err = shadow_map_initialize(&r->shadow_map, VIEWPORT_WIDTH, VIEWPORT_HEIGHT))) {
+    printf("Shadow map init failed\n");
     return err;
   }
 
   printf("<-- Initializing debug line renderer... -->\n");
-  if ((err = debug_lines_initialize())) {
+  int debug_lines_err = debug_lines_initialize();
+  if (debug_lines_err) {
     printf("Debug line renderer init failed\n");
   }
 
-  printf("<-- Initializing shadow map... -->\n");
-  if ((err = shadow_map_initialize(&r->shadow_map, VIEWPORT_WIDTH, VIEWPORT_HEIGHT))) {
+  if ((err = deferred_initialize(&r->deferred, update_loading_cb))) {
+    printf("Deferred renderer init failed\n");
+    return err;
+  }
+
+  printf("<-- Initializing forward renderer... -->\n");
+  if ((err = forward_initialize(&r->forward, update_loading_cb))) {
+    printf("Forward renderer init failed\n");
+    return err;
+  }
+  r->forward.g_buffer = &r->deferred.g_buffer;
+
+  if ((err = shadow_map_finish(&r->shadow_map))) {
     printf("Shadow map init failed\n");
     return err;
   }
+  if (!debug_lines_err && debug_lines_finish()) {
+    printf("Debug line renderer init failed\n");
+  }
 
   return 0;
 }
 
+static void set_depth_range_zero_to_one(const Renderer* r, int zero_to_one) {
+  if (r->has_clip_control) {
+    GL_WRAP(glClipControl(GL_LOWER_LEFT, zero_to_one ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE));
+  }
+}
+
 void renderer_render(Renderer* r, const Scene* scene) {
+  profiler_begin_frame();
+
   // clear backbuffer
   utility_set_clear_color(0, 0, 0);
   GL_WRAP(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 
-  // render offscreen shadowmap
+  // shading happens in linear space, writes to the sRGB output target are
+  // encoded (and blended) in hardware
+  GL_WRAP(glEnable(GL_FRAMEBUFFER_SRGB));
+
+  // render offscreen shadowmap, always with the default [-1, 1] depth range
+  set_depth_range_zero_to_one(r, 0);
+  profiler_begin_pass(PROFILER_PASS_SHADOW);
   shadow_map_render(&r->shadow_map, scene);
+  profiler_end_pass();
+
+  // camera passes use the reversed [0, 1] depth range when enabled
+  set_depth_range_zero_to_one(r, scene->camera.reverse_z);
 
   // render opaque objects
   deferred_render(&r->deferred, scene, &r->shadow_map);
 
+  // advance GPU simulated particles
+  profiler_begin_pass(PROFILER_PASS_PARTICLES);
+  forward_simulate(scene);
+  profiler_end_pass();
+
   // render transparent objects, particles, and billboarded icons
-  forward_render(&r->forward, scene);
+  profiler_begin_pass(PROFILER_PASS_FORWARD);
+  if (r->deferred.render_mode == RENDER_MODE_OVERDRAW) {
+    gbuffer_bind_overdraw(&r->deferred.g_buffer);
+    forward_render_overdraw(&r->forward, scene);
+  } else {
+    forward_render(&r->forward, scene);
+  }
+  profiler_end_pass();
+
+  // resolve the accumulated overdraw counts
+  if (r->deferred.render_mode == RENDER_MODE_OVERDRAW) {
+    deferred_render_heatmap(&r->deferred);
+  }
+
+  // debug colors are already display values
+  GL_WRAP(glDisable(GL_FRAMEBUFFER_SRGB));
 
   // render debug lines
   if (r->render_debug_lines) {
+    profiler_begin_pass(PROFILER_PASS_DEBUG);
     debug_lines_render(scene);
+    profiler_end_pass();
   }
 
+  // copy the output target into the viewport
+  gbuffer_blit_output(&r->deferred.g_buffer, VIEWPORT_X_OFFSET, 0);
+
   // render debug shadow map picture-in-picture
   if (r->debug_shadow_map) {
     const int width = 300;
     const int height = width * r->shadow_map.height/(float)r->shadow_map.width;
     shadow_map_render_debug(&r->shadow_map, VIEWPORT_X_OFFSET, VIEWPORT_HEIGHT - height, width, height);
   }
+
+  profiler_end_frame();
 }
@@ -4,6 +4,8 @@
 #include "deferred.h"
 #include "forward.h"
 #include "debug_lines.h"
+#include "profiler.h"
+#include "program_cache.h"
 
 typedef struct
 {
@@ -21,7 +23,13 @@ typedef struct
 
   // if set, draws debug lines
   int render_debug_lines;
+
+  // glClipControl is available, required for reverse-z
+  int has_clip_control;
+
+  // programs can be polled for completion while the driver compiles them
+  int has_parallel_shader_compile;
 } Renderer;
 
-int renderer_initialize(Renderer* r);
+int renderer_initialize(Renderer* r, LoadingCallback update_loading_cb);
 void renderer_render(Renderer* r, const Scene* scene);
@@ -1,4 +1,48 @@
 #include "scene.h"
+#include "jobs.h"
+#include "particles_gpu.h"
+
+// particles per update job, emitters larger than this are split up
+#define SCENE_UPDATE_RANGE 8192
+static_assert(SCENE_UPDATE_RANGE % PARTICLE_SIMD_WIDTH == 0, "ranges must start on SIMD blocks");
+
+// emitters projecting smaller than this many pixels across aren't drawn
+#define SCENE_EMITTER_MIN_PIXELS 0.5f
+
+// emitters covering less of the screen than this are stepped at
+// SCENE_FAR_STEP_INTERVAL, culled ones at SCENE_CULLED_STEP_INTERVAL
+#define SCENE_EMITTER_FAR_COVERAGE 0.001f
+#define SCENE_FAR_STEP_INTERVAL (1.0f / 20.0f)
+#define SCENE_CULLED_STEP_INTERVAL 0.25f
+
+// budget weight every emitter has on top of its coverage, so culled emitters
+// keep a trickle of particles for when they come back into view
+#define SCENE_BUDGET_BASE_WEIGHT 0.01f
+
+// One frame's emitter update, run as parallel fors: spawn per emitter,
+// update per particle range and join per emitter for the emitters stepped
+// this frame, then sort every visible sorted emitter once for this eye.
+typedef struct
+{
+  vec3 eye;
+  ParticleEmitter* emitters[SCENE_EMITTERS_MAX];
+  float dt[SCENE_EMITTERS_MAX];
+  int emitters_count;
+
+  // emitter i owns ranges [first_range[i], first_range[i+1])
+  int first_range[SCENE_EMITTERS_MAX + 1];
+  int* range_emitter;
+  int* range_alive;
+  ParticleBounds* range_bounds;
+  int ranges_count;
+  int ranges_max;
+
+  // visible emitters sorted on their own, stepped this frame or not
+  ParticleEmitter* sorted[SCENE_EMITTERS_MAX];
+  int sorted_count;
+} EmitterUpdate;
+
+static EmitterUpdate sEmitterUpdate;
 
 void camera_update(Camera* camera, float dt) {
   if (camera->auto_rotate) {
@@ -15,7 +59,11 @@ void camera_update(Camera* camera, float dt) {
   vec3_negate_in_place(camera->view[3]);
 
   // calculate view-projection matrix
-  mat4x4_perspective(camera->proj, camera->fovy * (float)M_PI/180.0f, (float)VIEWPORT_WIDTH/(float)VIEWPORT_HEIGHT, Z_NEAR, Z_FAR);
+  if (camera->reverse_z) {
+    mat4x4_inf_reverse_perspective(camera->proj, camera->fovy * (float)M_PI/180.0f, (float)VIEWPORT_WIDTH/(float)VIEWPORT_HEIGHT, Z_NEAR);
+  } else {
+    mat4x4_perspective(camera->proj, camera->fovy * (float)M_PI/180.0f, (float)VIEWPORT_WIDTH/(float)VIEWPORT_HEIGHT, Z_NEAR, Z_FAR);
+  }
   mat4x4_mul(camera->viewProj, camera->proj, camera->view);
 }
 
@@ -27,6 +75,12 @@ void camera_forward(const Camera* camera, vec3 out) {
   vec3_dup(out, temp);
 }
 
+void camera_eye(const Camera* camera, vec3 out) {
+  mat4x4 invView;
+  mat4x4_invert(invView, camera->view);
+  vec3_dup(out, invView[3]);
+}
+
 void camera_up(const Camera* camera, vec3 out) {
   vec4 temp;
   mat4x4 invView;
@@ -80,13 +134,238 @@ int scene_remove_model(Scene* scene, Model* m) {
   return 1;
 }
 
+int scene_emitter_sorted(const Scene* scene, const ParticleEmitter* emitter) {
+  const ParticleEmitterDesc* desc = emitter->desc;
+  if (!desc->depth_sort_alpha_blend)
+    return 0;
+  // weighted blended OIT is only resolved at full resolution
+  return !scene->particle_oit || desc->resolution != PARTICLE_RESOLUTION_FULL;
+}
+
+int scene_emitter_listable(const Scene* scene, const ParticleEmitter* emitter) {
+  return scene->particle_sorted_list && emitter->visible && scene_emitter_sorted(scene, emitter)
+    && emitter->desc->resolution == PARTICLE_RESOLUTION_FULL
+    && !particles_gpu_enabled(emitter) && !particle_emitter_analytic(emitter);
+}
+
+static void spawn_job(void* data, int index) {
+  EmitterUpdate* u = (EmitterUpdate*)data;
+  particle_emitter_spawn(u->emitters[index], u->dt[index]);
+}
+
+static void update_job(void* data, int index) {
+  EmitterUpdate* u = (EmitterUpdate*)data;
+  int e = u->range_emitter[index];
+  ParticleEmitter* emitter = u->emitters[e];
+  int first = (index - u->first_range[e]) * SCENE_UPDATE_RANGE;
+  int count = std::min(emitter->count - first, SCENE_UPDATE_RANGE);
+  u->range_alive[index] = particle_emitter_update_range(emitter, first, count, u->dt[e], &u->range_bounds[index]);
+}
+
+static void join_job(void* data, int index) {
+  EmitterUpdate* u = (EmitterUpdate*)data;
+  ParticleEmitter* emitter = u->emitters[index];
+  if (particle_emitter_analytic(emitter)) {
+    particle_emitter_expire(emitter);
+  } else {
+    int first = u->first_range[index];
+    particle_emitter_join_ranges(emitter, SCENE_UPDATE_RANGE, &u->range_alive[first], &u->range_bounds[first], u->first_range[index + 1] - first);
+  }
+}
+
+// sort here while we're parallel, the forward pass then finds them in order
+static void sort_job(void* data, int index) {
+  EmitterUpdate* u = (EmitterUpdate*)data;
+  ParticleEmitter* emitter = u->sorted[index];
+  vec3 local_eye;
+  particle_emitter_to_local(emitter, local_eye, u->eye);
+  particle_emitter_sort(emitter, local_eye);
+}
+
+static void split_ranges(EmitterUpdate* u) {
+  u->ranges_count = 0;
+  for (int i = 0; i < u->emitters_count; i++) {
+    u->first_range[i] = u->ranges_count;
+    // analytic emitters have nothing to integrate
+    ParticleEmitter* emitter = u->emitters[i];
+    int ranges = particle_emitter_analytic(emitter) ? 0 : (emitter->count + SCENE_UPDATE_RANGE - 1) / SCENE_UPDATE_RANGE;
+    if (u->ranges_count + ranges > u->ranges_max) {
+      u->ranges_max = std::max(u->ranges_count + ranges, u->ranges_max * 2);
+      u->range_emitter = (int*)realloc(u->range_emitter, u->ranges_max * sizeof(int));
+      u->range_alive = (int*)realloc(u->range_alive, u->ranges_max * sizeof(int));
+      u->range_bounds = (ParticleBounds*)realloc(u->range_bounds, u->ranges_max * sizeof(ParticleBounds));
+    }
+    for (int r = 0; r < ranges; r++) {
+      u->range_emitter[u->ranges_count++] = i;
+    }
+  }
+  u->first_range[u->emitters_count] = u->ranges_count;
+}
+
+// Fraction of the screen covered by the emitter's bounds, 0 when they are
+// outside the frustum or smaller than a pixel
+static float emitter_coverage(const ParticleEmitter* emitter, const Camera* camera, const vec3 eye, const vec4 planes[4]) {
+  for (int p = 0; p < 4; p++) {
+    // the box corner furthest along the plane normal
+    float d = planes[p][3];
+    for (int i = 0; i < 3; i++) {
+      d += planes[p][i] * (planes[p][i] > 0.0f ? emitter->bounds_max[i] : emitter->bounds_min[i]);
+    }
+    if (d < 0.0f)
+      return 0.0f;
+  }
+
+  vec3 center, extents, to_center;
+  for (int i = 0; i < 3; i++) {
+    center[i] = 0.5f * (emitter->bounds_min[i] + emitter->bounds_max[i]);
+    extents[i] = 0.5f * (emitter->bounds_max[i] - emitter->bounds_min[i]);
+  }
+  vec3_sub(to_center, center, eye);
+  float radius = vec3_len(extents);
+  float dist = vec3_len(to_center);
+  if (dist <= radius)
+    return 1.0f;
+
+  // projected radius of the bounding sphere
+  float pixels = 0.5f * (float)VIEWPORT_HEIGHT * radius / (dist * tanf(0.5f * DEG_TO_RAD(camera->fovy)));
+  if (2.0f * pixels < SCENE_EMITTER_MIN_PIXELS)
+    return 0.0f;
+  return std::min(1.0f, (float)M_PI * pixels * pixels / ((float)VIEWPORT_WIDTH * (float)VIEWPORT_HEIGHT));
+}
+
+// Sets visibility and coverage, and splits the budget between the emitters
+// by coverage and priority. Shares an emitter can't use go to the others.
+static void budget_emitters(Scene* scene, ParticleEmitter** emitters, int emitters_count) {
+  const Camera* camera = &scene->camera;
+  mat4x4 inv_view;
+  mat4x4_invert(inv_view, camera->view);
+
+  // side planes of the frustum, the far plane may be at infinity
+  vec4 planes[4];
+  for (int i = 0; i < 4; i++) {
+    float sign = (i & 1) ? -1.0f : 1.0f;
+    int row = i / 2;
+    for (int c = 0; c < 4; c++) {
+      planes[i][c] = camera->viewProj[c][3] + sign * camera->viewProj[c][row];
+    }
+  }
+
+  float weights[SCENE_EMITTERS_MAX];
+  int budgeted[SCENE_EMITTERS_MAX];
+  float weights_total = 0.0f;
+  int budgeted_count = 0;
+  for (int i = 0; i < emitters_count; i++) {
+    ParticleEmitter* emitter = emitters[i];
+    emitter->budget_max = emitter->max;
+    if (particles_gpu_enabled(emitter)) {
+      // never on the CPU, so no bounds to cull with
+      emitter->coverage = 1.0f;
+      emitter->visible = 1;
+      continue;
+    }
+
+    emitter->coverage = emitter_coverage(emitter, camera, inv_view[3], planes);
+    emitter->visible = emitter->coverage > 0.0f;
+    weights[i] = (1.0f + std::max(emitter->desc->priority, 0.0f)) * (emitter->coverage + SCENE_BUDGET_BASE_WEIGHT);
+    weights_total += weights[i];
+    budgeted[budgeted_count++] = i;
+  }
+
+  if (scene->particle_budget <= 0)
+    return;
+
+  // hand out shares by weight; an emitter capped at its max leaves the
+  // remainder to be shared again among the rest
+  int budget = scene->particle_budget;
+  int capped = 1;
+  while (capped && budgeted_count > 0 && weights_total > 0.0f) {
+    capped = 0;
+    for (int k = 0; k < budgeted_count; k++) {
+      ParticleEmitter* emitter = emitters[budgeted[k]];
+      if ((float)budget * weights[budgeted[k]] / weights_total >= (float)emitter->max) {
+        budget -= emitter->max;
+        weights_total -= weights[budgeted[k]];
+        budgeted[k--] = budgeted[--budgeted_count];
+        capped = 1;
+      }
+    }
+  }
+  // a share never drops below what one culled step spawns, or an emitter
+  // rounded down to nothing would never spawn and never earn coverage
+  for (int k = 0; k < budgeted_count; k++) {
+    ParticleEmitter* emitter = emitters[budgeted[k]];
+    int share = weights_total > 0.0f ? (int)((float)budget * weights[budgeted[k]] / weights_total) : 0;
+    int spawn_step = std::max(1, (int)ceilf(emitter->desc->spawn_rate * SCENE_CULLED_STEP_INTERVAL));
+    emitter->budget_max = std::max(share, std::min(spawn_step, emitter->max));
+  }
+}
+
 void scene_update(Scene* scene, float dt) {
   camera_update(&scene->camera, dt);
 
-  // update emitters
+  ParticleEmitter* emitters[SCENE_EMITTERS_MAX];
+  int emitters_count = 0;
   for (int i = 0; i < SCENE_EMITTERS_MAX; i++) {
     if (scene->emitters[i]) {
-      particle_emitter_update(scene->emitters[i], dt);
+      emitters[emitters_count++] = scene->emitters[i];
+    }
+  }
+  budget_emitters(scene, emitters, emitters_count);
+
+  // far and culled emitters bank their time and catch up in one bigger step
+  EmitterUpdate* u = &sEmitterUpdate;
+  camera_eye(&scene->camera, u->eye);
+  u->emitters_count = 0;
+  for (int i = 0; i < emitters_count; i++) {
+    ParticleEmitter* emitter = emitters[i];
+    emitter->catch_up_dt += dt;
+    float interval = 0.0f;
+    if (!emitter->visible) {
+      interval = SCENE_CULLED_STEP_INTERVAL;
+    } else if (emitter->coverage < SCENE_EMITTER_FAR_COVERAGE) {
+      interval = SCENE_FAR_STEP_INTERVAL;
+    }
+    if (emitter->catch_up_dt >= interval) {
+      u->emitters[u->emitters_count] = emitter;
+      u->dt[u->emitters_count++] = emitter->catch_up_dt;
+      emitter->catch_up_dt = 0.0f;
+    }
+  }
+
+  // update emitters
+  jobs_parallel_for(spawn_job, u, u->emitters_count);
+  split_ranges(u);
+  jobs_parallel_for(update_job, u, u->ranges_count);
+  jobs_parallel_for(join_job, u, u->emitters_count);
+
+  // the sorted transparency list takes the first listable emitters, the
+  // rest are sorted on their own
+  int listed_count = 0;
+  u->sorted_count = 0;
+  for (int i = 0; i < emitters_count; i++) {
+    ParticleEmitter* emitter = emitters[i];
+    emitter->listed = listed_count < SCENE_SORTED_LIST_MAX && scene_emitter_listable(scene, emitter);
+    listed_count += emitter->listed;
+    if (emitter->visible && !emitter->listed && !particles_gpu_enabled(emitter) && scene_emitter_sorted(scene, emitter)) {
+      u->sorted[u->sorted_count++] = emitter;
+    }
+  }
+  jobs_parallel_for(sort_job, u, u->sorted_count);
+
+  SceneParticleStats* stats = &scene->particle_stats;
+  memset(stats, 0, sizeof(SceneParticleStats));
+  stats->emitters = emitters_count;
+  stats->emitters_simulated = u->emitters_count;
+  for (int i = 0; i < u->emitters_count; i++) {
+    if (!particle_emitter_analytic(u->emitters[i])) {
+      stats->particles_simulated += u->emitters[i]->count;
+    }
+  }
+  for (int i = 0; i < emitters_count; i++) {
+    stats->particles += emitters[i]->count;
+    if (emitters[i]->visible) {
+      stats->emitters_visible++;
+      stats->particles_drawn += emitters[i]->count;
     }
   }
 }
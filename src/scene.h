@@ -10,6 +10,10 @@
 #define SCENE_MODELS_MAX 256
 #define SCENE_EMITTERS_MAX 256
 
+// emitters in the sorted transparency list, the forward renderer's batch
+// slots less the light icon's
+#define SCENE_SORTED_LIST_MAX 15
+
 struct OBB {
   vec3 center;
   vec3 extents;
@@ -42,12 +46,18 @@ typedef struct
   // if set, the camera rotates about the origin
   int auto_rotate;
 
+  // if set, projects with reversed [0, 1] depth and an infinite far plane
+  int reverse_z;
+
   // HDR Exposure. Defaults to 1.0f
   float exposure;
 } Camera;
 
 void camera_update(Camera* camera, float dt);
 void camera_forward(const Camera* camera, vec3 out);
+
+// world space eye position, pos is only the boom before rotation
+void camera_eye(const Camera* camera, vec3 out);
 void camera_up(const Camera* camera, vec3 out);
 
 typedef struct
@@ -74,6 +84,16 @@ typedef struct
 void model_initialize(Model *out, const Mesh *mesh, const Material *mat);
 void model_get_obb(const Model* model, OBB* out);
 
+typedef struct
+{
+  int emitters;
+  int emitters_simulated; // stepped this frame, the rest are catching up later
+  int emitters_visible;
+  int particles;
+  int particles_simulated;
+  int particles_drawn;
+} SceneParticleStats;
+
 typedef struct
 {
   // Main camera values
@@ -96,8 +116,30 @@ typedef struct
 
   // Particle emitters to render
   ParticleEmitter* emitters[SCENE_EMITTERS_MAX];
+
+  // Live particles shared by all CPU emitters, 0 for no limit
+  int particle_budget;
+
+  // if set, alpha blended full resolution emitters are resolved with
+  // weighted blended OIT instead of being depth sorted
+  int particle_oit;
+
+  // if set, alpha blended full resolution CPU emitters are marked listed and
+  // sorted together with the light icon by the forward renderer, instead of
+  // each being sorted on its own here
+  int particle_sorted_list;
+
+  // Emitter culling and budgeting results of the last update
+  SceneParticleStats particle_stats;
 } Scene;
 
 int scene_add_model(Scene* scene, Model* m);
 int scene_remove_model(Scene* scene, Model* m);
 void scene_update(Scene* scene, float dt);
+
+// true if the emitter's particles are drawn back to front
+int scene_emitter_sorted(const Scene* scene, const ParticleEmitter* emitter);
+
+// true if the emitter may join the sorted transparency list, the update
+// marks up to SCENE_SORTED_LIST_MAX of these as listed
+int scene_emitter_listable(const Scene* scene, const ParticleEmitter* emitter);
@@ -1,13 +1,40 @@
 #include "shadowmap.h"
 #include "utility.h"
+#include "imgui/imgui.h"
 
-static int load_depth_render_shader(DepthRenderShader* shader, const char** defines, int defines_count) {
-  if(!(shader->program = utility_create_program_defines("shaders/mesh.vert", "shaders/mesh.frag"
-                                , defines, defines_count))) {
-    return 1;
+DEFINE_ENUM(ShadowPcfKernel, shadow_pcf_kernel_strings, ENUM_ShadowPcfKernel);
+DEFINE_ENUM(ShadowTechnique, shadow_technique_strings, ENUM_ShadowTechnique);
+
+// Poisson disk in the unit circle, ordered so that any prefix is well distributed
+static const vec2 sPoissonDisk[SHADOW_PCF_TAPS_MAX] = {
+  { -0.9420f, -0.3991f }, {  0.9456f, -0.7689f }, { -0.0942f, -0.9294f }, {  0.3450f,  0.2939f },
+  { -0.9159f,  0.4577f }, { -0.8154f, -0.8791f }, { -0.3828f,  0.2768f }, {  0.9748f,  0.7565f },
+  {  0.4432f, -0.9751f }, {  0.5374f, -0.4737f }, { -0.2650f, -0.4189f }, {  0.7920f,  0.1909f },
+  { -0.2419f,  0.9971f }, { -0.8141f,  0.9144f }, {  0.1998f,  0.7864f }, {  0.1438f, -0.1410f },
+};
+
+static const int sPcfTapCounts[] = { 1, 4, 9, 16 };
+static const char* sPcfTapCountStrings[] = { "1", "4", "9", "16" };
+
+static const char* const sPositionAttribs[] = { "position" };
+
+static int request_shader(ProgramRequest* req, const char* vert_filename, const char* frag_filename
+                        , const char** defines, int defines_count, int bind_position) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = vert_filename;
+  desc.frag_filename = frag_filename;
+  desc.defines = defines;
+  desc.defines_count = defines_count;
+  if (bind_position) {
+    desc.attribs = sPositionAttribs;
+    desc.attribs_count = STATIC_ELEMENT_COUNT(sPositionAttribs);
   }
-  GL_WRAP(glBindAttribLocation(shader->program, 0, "position"));
-  if (utility_link_program(shader->program)) {
+  return utility_request_program(req, &desc);
+}
+
+static int resolve_depth_render_shader(DepthRenderShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
     return 1;
   }
   GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
@@ -16,35 +43,88 @@ static int load_depth_render_shader(DepthRenderShader* shader, const char** defi
   return 0;
 }
 
-static int load_debug_shader(ShadowDebugShader* shader, const char** defines, int defines_count) {
-  if (!(shader->program = utility_create_program_defines("shaders/passthrough.vert", "shaders/passthrough.frag"
-                                , defines, defines_count))) {
+static int resolve_debug_shader(ShadowDebugShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
     return 1;
   }
   GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
   GL_WRAP(shader->texcoord_loc = glGetAttribLocation(shader->program, "texcoord"));
   GL_WRAP(shader->render_map_loc = glGetUniformLocation(shader->program, "RenderMap"));
-  GL_WRAP(shader->depth_map_loc = glGetUniformLocation(shader->program, "DepthMap"));
   GL_WRAP(shader->z_near_loc = glGetUniformLocation(shader->program, "ZNear"));
   GL_WRAP(shader->z_far_loc = glGetUniformLocation(shader->program, "ZFar"));
   return 0;
 }
 
+static int resolve_blur_shader(ShadowBlurShader* shader, ProgramRequest* req) {
+  if (!(shader->program = utility_finish_program(req))) {
+    return 1;
+  }
+  GL_WRAP(shader->pos_loc = glGetAttribLocation(shader->program, "position"));
+  GL_WRAP(shader->texcoord_loc = glGetAttribLocation(shader->program, "texcoord"));
+  GL_WRAP(shader->source_map_loc = glGetUniformLocation(shader->program, "SourceMap"));
+  GL_WRAP(shader->blur_step_loc = glGetUniformLocation(shader->program, "BlurStep"));
+  GL_WRAP(shader->blur_radius_loc = glGetUniformLocation(shader->program, "BlurRadius"));
+  GL_WRAP(shader->exponents_loc = glGetUniformLocation(shader->program, "EvsmExponents"));
+  return 0;
+}
+
+static void cancel_shaders(ShadowMap* shadow_map) {
+  utility_cancel_program(&shadow_map->depth_render_req);
+  utility_cancel_program(&shadow_map->debug_req);
+  utility_cancel_program(&shadow_map->blur_req[0]);
+  utility_cancel_program(&shadow_map->blur_req[1]);
+}
+
+static GLuint initialize_moments_attachment(int width, int height, int mipmapped) {
+  GLuint buffer = 0;
+  GL_WRAP(glGenTextures(1, &buffer));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, buffer));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+  GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, 0));
+  if (mipmapped) {
+    GL_WRAP(glGenerateMipmap(GL_TEXTURE_2D));
+    if (GLEW_EXT_texture_filter_anisotropic) {
+      GLfloat max_anisotropy = 1.0f;
+      GL_WRAP(glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_anisotropy));
+      GL_WRAP(glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(max_anisotropy, 8.0f)));
+    }
+  }
+  GL_WRAP(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer, 0));
+  return buffer;
+}
+
 int shadow_map_initialize(ShadowMap* shadow_map, int width, int height) {
   memset(shadow_map, 0, sizeof(ShadowMap));
   shadow_map->width = width;
   shadow_map->height = height;
+  shadow_map->pcf_kernel = SHADOW_PCF_KERNEL_POISSON;
+  shadow_map->pcf_taps = 4;
+  shadow_map->pcf_radius = 1.5f;
+  shadow_map->pcf_rotate = 1;
+  shadow_map->technique = SHADOW_TECHNIQUE_PCF;
+  shadow_map->evsm_blur_radius = 3;
+  vec2_set(shadow_map->evsm_exponents, SHADOW_EVSM_EXPONENT_MAX, SHADOW_EVSM_EXPONENT_MAX);
+  shadow_map->evsm_light_bleed_reduction = 0.2f;
+  shadow_map->evsm_variance_bias = 0.01f;
 
-  if (load_depth_render_shader(&shadow_map->depth_render_shader, NULL, 0)) {
-    printf("Unable to load depth render shader\n");
-    return 1;
-  }
-
+  // the programs build alongside the other renderers', see shadow_map_finish
   const char* debug_linearize_defines[] ={
     "#define DEBUG_RENDER_LINEARIZE\n"
   };
-  if (load_debug_shader(&shadow_map->debug_shader, debug_linearize_defines, STATIC_ELEMENT_COUNT(debug_linearize_defines))) {
-    printf("Unable to load debug shader\n");
+  const char* blur_from_depth_defines[] ={
+    "#define EVSM_FROM_DEPTH\n"
+  };
+  if (request_shader(&shadow_map->depth_render_req, "shaders/mesh.vert", "shaders/mesh.frag", NULL, 0, 1)
+      || request_shader(&shadow_map->debug_req, "shaders/passthrough.vert", "shaders/passthrough.frag"
+                      , debug_linearize_defines, STATIC_ELEMENT_COUNT(debug_linearize_defines), 0)
+      || request_shader(&shadow_map->blur_req[0], "shaders/passthrough.vert", "shaders/shadow_evsm.frag"
+                      , blur_from_depth_defines, STATIC_ELEMENT_COUNT(blur_from_depth_defines), 1)
+      || request_shader(&shadow_map->blur_req[1], "shaders/passthrough.vert", "shaders/shadow_evsm.frag", NULL, 0, 1)) {
+    printf("Unable to load shadow map shaders\n");
+    cancel_shaders(shadow_map);
     return 1;
   }
 
@@ -59,8 +139,10 @@ int shadow_map_initialize(ShadowMap* shadow_map, int width, int height) {
   GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER));
   float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
   GL_WRAP(glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor));
-  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL));
   GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0));
 
   // Attach depth to fbo
@@ -72,6 +154,28 @@ int shadow_map_initialize(ShadowMap* shadow_map, int width, int height) {
   GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
   if (fbo_status != GL_FRAMEBUFFER_COMPLETE) {
     printf("glCheckFramebufferStatus failed\n");
+    cancel_shaders(shadow_map);
+    return 1;
+  }
+
+  // Init EVSM moments + blur targets
+  GL_WRAP(glGenFramebuffers(1, &shadow_map->moments_fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->moments_fbo));
+  shadow_map->moments_buffer = initialize_moments_attachment(width, height, 1);
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("glCheckFramebufferStatus failed\n");
+    cancel_shaders(shadow_map);
+    return 1;
+  }
+
+  GL_WRAP(glGenFramebuffers(1, &shadow_map->blur_fbo));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->blur_fbo));
+  shadow_map->blur_buffer = initialize_moments_attachment(width, height, 0);
+  GL_WRAP(fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (fbo_status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("glCheckFramebufferStatus failed\n");
+    cancel_shaders(shadow_map);
     return 1;
   }
 
@@ -80,6 +184,18 @@ int shadow_map_initialize(ShadowMap* shadow_map, int width, int height) {
   return 0;
 }
 
+int shadow_map_finish(ShadowMap* shadow_map) {
+  if (resolve_depth_render_shader(&shadow_map->depth_render_shader, &shadow_map->depth_render_req)
+      || resolve_debug_shader(&shadow_map->debug_shader, &shadow_map->debug_req)
+      || resolve_blur_shader(&shadow_map->blur_shader[0], &shadow_map->blur_req[0])
+      || resolve_blur_shader(&shadow_map->blur_shader[1], &shadow_map->blur_req[1])) {
+    printf("Unable to load shadow map shaders\n");
+    cancel_shaders(shadow_map);
+    return 1;
+  }
+  return 0;
+}
+
 static void render_geometry(ShadowMap *shadow_map, const Model* model) {
   if (!model->mesh->vertices)
     return;
@@ -130,6 +246,75 @@ void shadow_map_update_view_proj(ShadowMap *shadow_map, const Light* light) {
   mat4x4_mul(shadow_map->vp, shadow_map->proj, shadow_map->view);
 }
 
+static void update_pcf_kernel(ShadowMap *shadow_map) {
+  const float texel_x = shadow_map->pcf_radius / (float)shadow_map->width;
+  const float texel_y = shadow_map->pcf_radius / (float)shadow_map->height;
+  const int taps = shadow_map->pcf_taps;
+
+  switch (shadow_map->pcf_kernel) {
+    case SHADOW_PCF_KERNEL_ROTATED_GRID: {
+      // n x n grid in [-1, 1], rotated by atan(1/2) so no two taps share a row or column
+      const int n = (int)sqrtf((float)taps);
+      const float c = 0.8944f, s = 0.4472f;
+      for (int i = 0; i < taps; i++) {
+        float x = (n > 1) ? ((i % n) / (float)(n - 1)) * 2.0f - 1.0f : 0.0f;
+        float y = (n > 1) ? ((i / n) / (float)(n - 1)) * 2.0f - 1.0f : 0.0f;
+        vec2_set(shadow_map->pcf_offsets[i], (c*x - s*y) * texel_x, (s*x + c*y) * texel_y);
+      }
+      break;
+    }
+    case SHADOW_PCF_KERNEL_POISSON: {
+      for (int i = 0; i < taps; i++) {
+        vec2_set(shadow_map->pcf_offsets[i], sPoissonDisk[i][0] * texel_x, sPoissonDisk[i][1] * texel_y);
+      }
+      break;
+    }
+  }
+
+  // a single tap is just the hardware 2x2 filter at the center
+  if (taps == 1) {
+    vec2_zero(shadow_map->pcf_offsets[0]);
+  }
+}
+
+static void blur_pass(const ShadowMap *shadow_map, const ShadowBlurShader* shader, GLuint source, GLuint target_fbo, float step_x, float step_y) {
+  GL_WRAP(glUseProgram(shader->program));
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, target_fbo));
+
+  GL_WRAP(glActiveTexture(GL_TEXTURE0));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, source));
+  GL_WRAP(glUniform1i(shader->source_map_loc, 0));
+  GL_WRAP(glUniform2f(shader->blur_step_loc, step_x, step_y));
+  GL_WRAP(glUniform1i(shader->blur_radius_loc, shadow_map->evsm_blur_radius));
+  GL_WRAP(glUniform2fv(shader->exponents_loc, 1, shadow_map->evsm_exponents));
+
+  utility_draw_fullscreen_quad(shader->texcoord_loc, shader->pos_loc);
+}
+
+// Converts depth into exponentially warped moments, blurs them with a separable
+// gaussian and builds the mip chain, so lighting can filter with a single fetch
+static void render_moments(ShadowMap *shadow_map) {
+  GL_WRAP(glDisable(GL_DEPTH_TEST));
+
+  GL_WRAP(glActiveTexture(GL_TEXTURE0));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, shadow_map->depth_buffer));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE));
+
+  blur_pass(shadow_map, &shadow_map->blur_shader[0], shadow_map->depth_buffer, shadow_map->blur_fbo,
+      1.0f / shadow_map->width, 0.0f);
+
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, shadow_map->depth_buffer));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE));
+
+  blur_pass(shadow_map, &shadow_map->blur_shader[1], shadow_map->blur_buffer, shadow_map->moments_fbo,
+      0.0f, 1.0f / shadow_map->height);
+
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, shadow_map->moments_buffer));
+  GL_WRAP(glGenerateMipmap(GL_TEXTURE_2D));
+
+  GL_WRAP(glEnable(GL_DEPTH_TEST));
+}
+
 void shadow_map_render(ShadowMap *shadow_map, const Scene *s) {
   // Bind render target
   GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->fbo));
@@ -146,18 +331,31 @@ void shadow_map_render(ShadowMap *shadow_map, const Scene *s) {
   // Recalc view and projection matrices
   shadow_map_update_view_proj(shadow_map, s->light);
 
+  // Rebuild the filter kernel for the current settings
+  update_pcf_kernel(shadow_map);
+
   // Render geometry
   for (int i = 0; i < SCENE_MODELS_MAX; i++) {
     if (s->models[i] && !s->models[i]->hidden)
       render_geometry(shadow_map, s->models[i]);
   }
 
-  // Cleanup
   GL_WRAP(glCullFace(GL_BACK));
+
+  // Prefilter moments
+  if (shadow_map->technique == SHADOW_TECHNIQUE_EVSM) {
+    render_moments(shadow_map);
+  }
+
+  // Cleanup
   GL_WRAP(glEnable(GL_BLEND));
   GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 }
 
+GLuint shadow_map_get_texture(const ShadowMap* shadow_map) {
+  return (shadow_map->technique == SHADOW_TECHNIQUE_EVSM) ? shadow_map->moments_buffer : shadow_map->depth_buffer;
+}
+
 void shadow_map_render_debug(const ShadowMap *shadow_map, int x_off, int y_off, int width, int height) {
   GL_WRAP(glUseProgram(shadow_map->debug_shader.program));
   GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
@@ -165,16 +363,38 @@ void shadow_map_render_debug(const ShadowMap *shadow_map, int x_off, int y_off,
   GL_WRAP(glDisable(GL_BLEND));
   GL_WRAP(glDisable(GL_DEPTH_TEST));
 
+  // Read raw depth rather than comparison results
   GL_WRAP(glActiveTexture(GL_TEXTURE0));
   GL_WRAP(glBindTexture(GL_TEXTURE_2D, shadow_map->depth_buffer));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE));
   GL_WRAP(glUniform1i(shadow_map->debug_shader.render_map_loc, 0));
 
-  GL_WRAP(glActiveTexture(GL_TEXTURE1));
-  GL_WRAP(glBindTexture(GL_TEXTURE_2D, shadow_map->depth_buffer));
-  GL_WRAP(glUniform1i(shadow_map->debug_shader.depth_map_loc, 1));
-
   GL_WRAP(glUniform1f(shadow_map->debug_shader.z_near_loc, Z_NEAR));
   GL_WRAP(glUniform1f(shadow_map->debug_shader.z_far_loc, Z_FAR));
 
   utility_draw_fullscreen_quad(shadow_map->debug_shader.texcoord_loc, shadow_map->debug_shader.pos_loc);
+
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE));
+}
+
+void shadow_map_gui(ShadowMap* shadow_map) {
+  ImGui::Combo("Technique", (int*)&shadow_map->technique, shadow_technique_strings, shadow_technique_strings_count);
+  if (shadow_map->technique == SHADOW_TECHNIQUE_EVSM) {
+    ImGui::SliderInt("Blur Radius", &shadow_map->evsm_blur_radius, 0, 8);
+    ImGui::SliderFloat2("Exponents", shadow_map->evsm_exponents, 0.0f, SHADOW_EVSM_EXPONENT_MAX);
+    ImGui::SliderFloat("Light Bleed Reduction", &shadow_map->evsm_light_bleed_reduction, 0.0f, 0.99f);
+    ImGui::SliderFloat("Variance Bias", &shadow_map->evsm_variance_bias, 0.0f, 0.1f);
+    return;
+  }
+  ImGui::Combo("PCF Kernel", (int*)&shadow_map->pcf_kernel, shadow_pcf_kernel_strings, shadow_pcf_kernel_strings_count);
+  const int tap_counts = STATIC_ELEMENT_COUNT(sPcfTapCounts);
+  int tap_idx = 0;
+  for (int i = 0; i < tap_counts; i++) {
+    if (sPcfTapCounts[i] == shadow_map->pcf_taps) tap_idx = i;
+  }
+  if (ImGui::Combo("PCF Taps", &tap_idx, sPcfTapCountStrings, tap_counts)) {
+    shadow_map->pcf_taps = sPcfTapCounts[tap_idx];
+  }
+  ImGui::SliderFloat("PCF Radius", &shadow_map->pcf_radius, 0.0f, 8.0f);
+  ImGui::Checkbox("PCF Rotate Per Pixel", (bool*)&shadow_map->pcf_rotate);
 }
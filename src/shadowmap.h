@@ -2,6 +2,24 @@
 #include "common.h"
 #include "scene.h"
 
+#define SHADOW_PCF_TAPS_MAX 16
+
+// Largest exponent whose squared warp still fits in a half float
+#define SHADOW_EVSM_EXPONENT_MAX 5.54f
+
+#define ENUM_ShadowTechnique(D)             \
+  D(SHADOW_TECHNIQUE_PCF,   "Depth Compare (PCF)") \
+  D(SHADOW_TECHNIQUE_EVSM,  "EVSM")
+
+DECLARE_ENUM(ShadowTechnique, shadow_technique_strings, ENUM_ShadowTechnique);
+enum { SHADOW_TECHNIQUE_COUNT = 0 ENUM_ShadowTechnique(ENUM_COUNT_VALUE) };
+
+#define ENUM_ShadowPcfKernel(D)                      \
+  D(SHADOW_PCF_KERNEL_ROTATED_GRID, "Rotated Grid")  \
+  D(SHADOW_PCF_KERNEL_POISSON,      "Poisson Disk")
+
+DECLARE_ENUM(ShadowPcfKernel, shadow_pcf_kernel_strings, ENUM_ShadowPcfKernel);
+
 typedef struct
 {
   GLuint program;
@@ -20,11 +38,23 @@ struct ShadowDebugShader
   GLint pos_loc;
   GLint texcoord_loc;
   GLint render_map_loc;
-  GLint depth_map_loc;
   GLint z_near_loc;
   GLint z_far_loc;
 };
 
+struct ShadowBlurShader
+{
+  GLuint program;
+
+  // shader vars
+  GLint pos_loc;
+  GLint texcoord_loc;
+  GLint source_map_loc;
+  GLint blur_step_loc;
+  GLint blur_radius_loc;
+  GLint exponents_loc;
+};
+
 struct ShadowMap
 {
   // pixel dimensions
@@ -42,16 +72,51 @@ struct ShadowMap
   // frame buffer
   GLuint fbo;
 
-  // depth texture attachment
+  // depth texture attachment, sampled with hardware depth comparison
   GLuint depth_buffer;
 
+  // PCF kernel: each tap is a bilinear 2x2 compare in hardware
+  ShadowPcfKernel pcf_kernel;
+  int pcf_taps;
+  float pcf_radius;
+  int pcf_rotate;
+  vec2 pcf_offsets[SHADOW_PCF_TAPS_MAX];
+
+  // selects depth compare or filtered moments in the lighting pass
+  ShadowTechnique technique;
+
+  // EVSM moments (RGBA16F, mipmapped) and the separable blur intermediate
+  GLuint moments_fbo;
+  GLuint moments_buffer;
+  GLuint blur_fbo;
+  GLuint blur_buffer;
+
+  // EVSM settings
+  int evsm_blur_radius;
+  vec2 evsm_exponents;
+  float evsm_light_bleed_reduction;
+  float evsm_variance_bias;
+
   // Depth render shaders
   DepthRenderShader depth_render_shader;
 
   // Debug view shader
   ShadowDebugShader debug_shader;
+
+  // EVSM blur shaders: [0] converts depth and blurs horizontally, [1] blurs vertically
+  ShadowBlurShader blur_shader[2];
+
+  // the shaders' program builds, pending until shadow_map_finish
+  ProgramRequest depth_render_req;
+  ProgramRequest debug_req;
+  ProgramRequest blur_req[2];
 };
 
+// Creates the render targets and issues the shader builds, which join the
+// next utility_wait_programs; shadow_map_finish then resolves them
 int shadow_map_initialize(ShadowMap* shadow_map, int width, int height);
+int shadow_map_finish(ShadowMap* shadow_map);
 void shadow_map_render(ShadowMap* shadow_map, const Scene* s);
 void shadow_map_render_debug(const ShadowMap *shadow_map, int x_off, int y_off, int width, int height);
+GLuint shadow_map_get_texture(const ShadowMap* shadow_map);
+void shadow_map_gui(ShadowMap* shadow_map);
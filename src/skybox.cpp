@@ -2,18 +2,18 @@
 #include "skybox.h"
 
 int skybox_load(Skybox *out_skybox, const SkyboxDesc *desc) {
-  if(!(out_skybox->env_cubemap = utility_load_texture_dds(desc->env_path))) {
+  if(!(out_skybox->env_cubemap = utility_load_texture_dds(desc->env_path, 0))) {
     return 1;
   }
   if (desc->irr_path) {
-    if(!(out_skybox->irr_cubemap = utility_load_texture_dds(desc->irr_path))) {
+    if(!(out_skybox->irr_cubemap = utility_load_texture_dds(desc->irr_path, 0))) {
       return 1;
     }
   } else {
     out_skybox->irr_cubemap = out_skybox->env_cubemap;
   }
   if (desc->prefilter_path) {
-    if(!(out_skybox->prefilter_cubemap = utility_load_texture_dds(desc->prefilter_path))) {
+    if(!(out_skybox->prefilter_cubemap = utility_load_texture_dds(desc->prefilter_path, 0))) {
       return 1;
     }
   } else {
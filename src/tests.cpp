@@ -0,0 +1,75 @@
+#include "tests.h"
+#include "forward.h"
+
+// The sorted list must order by distance to the eye, which only matches
+// camera.pos while the camera is unrotated. A quarter turn puts the near
+// and far particles at the same distance from camera.pos.
+static int test_sorted_list_rotated_camera() {
+  Scene* scene = (Scene*)calloc(1, sizeof(Scene));
+  Forward* f = (Forward*)calloc(1, sizeof(Forward));
+  Light light;
+  ParticleEmitter emitter;
+  memset(&light, 0, sizeof(Light));
+  memset(&emitter, 0, sizeof(ParticleEmitter));
+
+  scene->camera.boom_len = 10.0f;
+  scene->camera.fovy = 72.0f;
+  scene->camera.rot[1] = (float)M_PI / 5.0f; // 90 degrees after camera_update's 2.5x
+  camera_update(&scene->camera, 0.0f);
+  vec3 eye;
+  camera_eye(&scene->camera, eye);
+
+  // scaled and moved, so the list has to bring the slot into world space
+  emitter.scale = 2.0f;
+  quat_identity(emitter.rot);
+  vec3_set(emitter.pos, 1.0f, 2.0f, 3.0f);
+  scene->emitters[0] = &emitter;
+  vec3_scale(light.position, eye, 2.0f);
+  scene->light = &light;
+
+  // color[0] holds each instance's expected place, farthest first
+  vec3 near_world, far_world;
+  vec3_scale(near_world, eye, 0.5f);
+  vec3_scale(far_world, eye, -0.5f);
+  ParticleInstance instances[3];
+  memset(instances, 0, sizeof(instances));
+  particle_emitter_to_local(&emitter, instances[0].pos, near_world);
+  instances[0].color[0] = 2.0f;
+  instances[0].batch[0] = 1.0f;
+  instances[1].color[0] = 1.0f; // the light icon, slot 0 at its position
+  particle_emitter_to_local(&emitter, instances[2].pos, far_world);
+  instances[2].color[0] = 0.0f;
+  instances[2].batch[0] = 1.0f;
+
+  f->instances = instances;
+  f->instances_count = STATIC_ELEMENT_COUNT(instances);
+  ParticleBatch* list = &f->sorted_list;
+  list->emitters[0] = -1;
+  list->emitters[1] = 0;
+  list->emitters_count = 2;
+  list->first = 0;
+  list->count = f->instances_count;
+  forward_sort_list(f, scene);
+
+  int failed = 0;
+  for (int i = 0; i < list->count; i++) {
+    if (instances[i].color[0] != (float)i) {
+      printf("Tests -- sorted list with a rotated camera: instance %i is %g, expected %i\n", i, instances[i].color[0], i);
+      failed = 1;
+    }
+  }
+
+  free(f->list_records);
+  free(f->list_scratch);
+  free(f->list_instances);
+  free(f);
+  free(scene);
+  return failed;
+}
+
+int tests_run() {
+  int failed = 0;
+  failed += test_sorted_list_rotated_camera();
+  printf("Tests -- %i failed\n", failed);
+  return failed;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "common.h"
+
+// Runs the self checks that need no GL context, printing each failure.
+// Returns the number of checks that failed.
+int tests_run();
@@ -1,5 +1,7 @@
 #include "utility.h"
 #include "scene.h"
+#include "profiler.h"
+#include "program_cache.h"
 
 #include "imgui/ImGuizmo.h"
 #include "gli/gli.hpp"
@@ -42,8 +44,9 @@ int utility_buffer_file(const char *filename, unsigned char **buf, size_t *size)
   return ret;
 }
 
+// Issues the compile without waiting on the result
 // one of GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER
-GLuint utility_create_shader(const char *filename, GLenum shader_type, const char** defines, int defines_count) {
+static GLuint issue_shader(const char *filename, GLenum shader_type, const char** defines, int defines_count) {
   if (defines_count > 30)
     return 0;
 
@@ -85,7 +88,10 @@ GLuint utility_create_shader(const char *filename, GLenum shader_type, const cha
   GL_WRAP(glShaderSource(shader, i+1, sources, lengths));
   GL_WRAP(glCompileShader(shader));
   free(file_contents);
+  return shader;
+}
 
+static int check_shader(GLuint shader, const char* filename) {
   GLint compiled_result;
   GL_WRAP(glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled_result));
   if (compiled_result != GL_TRUE) {
@@ -93,16 +99,12 @@ GLuint utility_create_shader(const char *filename, GLenum shader_type, const cha
     GLchar message[1024];
     GL_WRAP(glGetShaderInfoLog(shader, 1024, &log_length, message));
     printf("Shader '%s' Compile Error: %s\n", filename, message);
-    GL_WRAP(glDeleteShader(shader));
-    return 0;
+    return 1;
   }
-
-  return shader;
+  return 0;
 }
 
-GLuint utility_link_program(GLuint program) {
-  GL_WRAP(glLinkProgram(program));
-
+static int check_program(GLuint program) {
   GLint program_linked;
   GL_WRAP(glGetProgramiv(program, GL_LINK_STATUS, &program_linked));
   if (program_linked != GL_TRUE) {
@@ -115,36 +117,197 @@ GLuint utility_link_program(GLuint program) {
   return 0;
 }
 
+GLuint utility_create_shader(const char *filename, GLenum shader_type, const char** defines, int defines_count) {
+  GLuint shader;
+  if (!(shader = issue_shader(filename, shader_type, defines, defines_count)))
+    return 0;
+
+  if (check_shader(shader, filename)) {
+    GL_WRAP(glDeleteShader(shader));
+    return 0;
+  }
+  return shader;
+}
+
+GLuint utility_link_program(GLuint program) {
+  // binaries from the program cache were saved after their final link
+  if (program_cache_is_binary(program))
+    return 0;
+
+  GL_WRAP(glLinkProgram(program));
+  if (check_program(program))
+    return 1;
+  program_cache_store(program);
+  return 0;
+}
+
 GLuint utility_create_program(const char *vert_filename, const char *frag_filename) {
   return utility_create_program_defines(vert_filename , frag_filename, NULL, 0);
 }
 
 GLuint utility_create_program_defines(const char *vert_filename, const char *frag_filename, const char** defines, int defines_count ) {
-  GLint vert_shader;
-  if (!(vert_shader = utility_create_shader(vert_filename, GL_VERTEX_SHADER, defines, defines_count))) {
+  ProgramDesc desc;
+  memset(&desc, 0, sizeof(ProgramDesc));
+  desc.vert_filename = vert_filename;
+  desc.frag_filename = frag_filename;
+  desc.defines = defines;
+  desc.defines_count = defines_count;
+
+  ProgramRequest req;
+  if (utility_request_program(&req, &desc))
     return 0;
+  return utility_finish_program(&req);
+}
+
+#define PENDING_PROGRAMS_MAX 256
+static ProgramRequest* sPendingPrograms[PENDING_PROGRAMS_MAX];
+static int sPendingProgramsCount = 0;
+
+// only compares addresses, so any request may be looked up, issued or not
+static int remove_pending_program(const ProgramRequest* req) {
+  for (int i = 0; i < sPendingProgramsCount; i++) {
+    if (sPendingPrograms[i] == req) {
+      sPendingPrograms[i] = sPendingPrograms[--sPendingProgramsCount];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void add_pending_program(ProgramRequest* req) {
+  if (sPendingProgramsCount < PENDING_PROGRAMS_MAX) {
+    sPendingPrograms[sPendingProgramsCount++] = req;
   }
+}
 
-  GLint frag_shader;
-  if (!(frag_shader = utility_create_shader(frag_filename, GL_FRAGMENT_SHADER, defines, defines_count))) {
-    GL_WRAP(glDeleteShader(vert_shader));
+int utility_request_program(ProgramRequest* req, const ProgramDesc* desc) {
+  memset(req, 0, sizeof(ProgramRequest));
+  req->vert_filename = desc->vert_filename;
+  req->frag_filename = desc->frag_filename;
+  req->geom_filename = desc->geom_filename;
+  req->defines_count = desc->defines_count;
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  uint64_t cache_key = program_cache_key(desc);
+  if ((req->program = program_cache_load(cache_key))) {
+    req->cached = 1;
+    add_pending_program(req);
     return 0;
   }
 
-  GLuint program;
-  GL_WRAP(program = glCreateProgram());
-  GL_WRAP(glAttachShader(program, vert_shader));
-  GL_WRAP(glAttachShader(program, frag_shader));
-  if (utility_link_program(program)) {
-    GL_WRAP(glDeleteProgram(program));
-    program = 0;
+  if (!(req->vert_shader = issue_shader(desc->vert_filename, GL_VERTEX_SHADER, desc->defines, desc->defines_count))) {
+    return 1;
+  }
+  if (desc->frag_filename
+      && !(req->frag_shader = issue_shader(desc->frag_filename, GL_FRAGMENT_SHADER, desc->defines, desc->defines_count))) {
+    GL_WRAP(glDeleteShader(req->vert_shader));
+    return 1;
+  }
+  if (desc->geom_filename
+      && !(req->geom_shader = issue_shader(desc->geom_filename, GL_GEOMETRY_SHADER, desc->defines, desc->defines_count))) {
+    GL_WRAP(glDeleteShader(req->vert_shader));
+    if (req->frag_shader) GL_WRAP(glDeleteShader(req->frag_shader));
+    return 1;
+  }
+
+  // bind everything up front so the program links exactly once
+  GL_WRAP(req->program = glCreateProgram());
+  GL_WRAP(glAttachShader(req->program, req->vert_shader));
+  if (req->frag_shader) GL_WRAP(glAttachShader(req->program, req->frag_shader));
+  if (req->geom_shader) GL_WRAP(glAttachShader(req->program, req->geom_shader));
+  for (int i = 0; i < desc->attribs_count; i++) {
+    GL_WRAP(glBindAttribLocation(req->program, i, desc->attribs[i]));
+  }
+  for (int i = 0; i < desc->frag_outputs_count; i++) {
+    GL_WRAP(glBindFragDataLocation(req->program, i, desc->frag_outputs[i]));
+  }
+  if (desc->feedback_varyings_count > 0) {
+    GL_WRAP(glTransformFeedbackVaryings(req->program, desc->feedback_varyings_count, desc->feedback_varyings, GL_INTERLEAVED_ATTRIBS));
+  }
+  program_cache_track(req->program, cache_key, start);
+  GL_WRAP(glLinkProgram(req->program));
+
+  // without parallel compiles the driver builds inside the calls above
+  if (!GLEW_ARB_parallel_shader_compile) {
+    program_cache_complete(req->program);
+  }
+  add_pending_program(req);
+  return 0;
+}
+
+void utility_cancel_program(ProgramRequest* req) {
+  if (!remove_pending_program(req))
+    return;
+
+  if (req->vert_shader) GL_WRAP(glDeleteShader(req->vert_shader));
+  if (req->frag_shader) GL_WRAP(glDeleteShader(req->frag_shader));
+  if (req->geom_shader) GL_WRAP(glDeleteShader(req->geom_shader));
+  GL_WRAP(glDeleteProgram(req->program));
+  req->vert_shader = req->frag_shader = req->geom_shader = 0;
+  req->program = 0;
+}
+
+int utility_program_ready(const ProgramRequest* req) {
+  if (req->cached || !req->program)
+    return 1;
+
+  // without the extension the only way to know is to block on the status
+  if (!GLEW_ARB_parallel_shader_compile)
+    return 1;
+
+  GLint completed = GL_FALSE;
+  GL_WRAP(glGetProgramiv(req->program, GL_COMPLETION_STATUS_ARB, &completed));
+  return completed == GL_TRUE;
+}
+
+GLuint utility_finish_program(ProgramRequest* req) {
+  remove_pending_program(req);
+  if (req->cached) {
+    printf("Loaded Cached Program -- Vertex: '%s' Fragment: '%s' Defines: %i\n", req->vert_filename, req->frag_filename ? req->frag_filename : "none", req->defines_count);
+    return req->program;
+  }
+
+  int err = check_shader(req->vert_shader, req->vert_filename)
+    || (req->frag_shader && check_shader(req->frag_shader, req->frag_filename))
+    || (req->geom_shader && check_shader(req->geom_shader, req->geom_filename))
+    || check_program(req->program);
+  GL_WRAP(glDeleteShader(req->vert_shader));
+  if (req->frag_shader) GL_WRAP(glDeleteShader(req->frag_shader));
+  if (req->geom_shader) GL_WRAP(glDeleteShader(req->geom_shader));
+  req->vert_shader = req->frag_shader = req->geom_shader = 0;
+  if (err) {
+    GL_WRAP(glDeleteProgram(req->program));
+    req->program = 0;
+    return 0;
   }
 
-  GL_WRAP(glDeleteShader(vert_shader));
-  GL_WRAP(glDeleteShader(frag_shader));
+  program_cache_store(req->program);
+  printf("Loaded Program -- Vertex: '%s' Fragment: '%s' Defines: %i\n", req->vert_filename, req->frag_filename ? req->frag_filename : "none", req->defines_count);
+  return req->program;
+}
 
-  printf("Loaded Program -- Vertex: '%s' Fragment: '%s' Defines: %i\n", vert_filename, frag_filename, defines_count);
-  return program;
+void utility_wait_programs(const char* stage, LoadingCallback update_loading_cb) {
+  int total = sPendingProgramsCount;
+  for (;;) {
+    // time each program to when it's first seen done, not to the end of
+    // the batch
+    int ready = 0;
+    for (int i = 0; i < sPendingProgramsCount; i++) {
+      if (utility_program_ready(sPendingPrograms[i])) {
+        program_cache_complete(sPendingPrograms[i]->program);
+        ready++;
+      }
+    }
+    if (ready == sPendingProgramsCount)
+      break;
+
+    // keep the loading screen alive while the driver compiles
+    if (update_loading_cb) {
+      update_loading_cb(stage, "Compiling shaders", ready, total);
+    } else {
+      SDL_Delay(1);
+    }
+  }
 }
 
 GLuint utility_load_texture_constant(const vec4 value) {
@@ -252,6 +415,7 @@ void utility_draw_cube(GLint texcoord_loc, GLint normal_loc, GLint tangent_loc,
       glVertexAttrib3f(pos_loc, min, max, min);
     glEnd();
   );
+  profiler_count_draw(GL_QUADS, 24);
 }
 
 void utility_draw_fullscreen_quad(GLint texcoord_loc, GLint pos_loc) {
@@ -263,6 +427,7 @@ void utility_draw_fullscreen_quad(GLint texcoord_loc, GLint pos_loc) {
       glVertexAttrib2f(texcoord_loc, 0.0f, 0.0f); glVertexAttrib2f(pos_loc, -1.0f, -1.0f);
     glEnd();
   );
+  profiler_count_draw(GL_QUADS, 4);
 }
 
 void utility_draw_fullscreen_quad2(GLint texcoord_loc, GLint pos_loc) {
@@ -275,6 +440,7 @@ void utility_draw_fullscreen_quad2(GLint texcoord_loc, GLint pos_loc) {
       glVertexAttrib2f(pos_loc, -1.0f, -1.0f);
     glEnd()
   );
+  profiler_count_draw(GL_QUADS, 4);
 }
 
 static GLint components_to_gl_format(int components) {
@@ -286,6 +452,31 @@ static GLint components_to_gl_format(int components) {
   }
 }
 
+// single channel images have no core sRGB format and stay linear
+static GLint components_to_gl_internal_format(int components, int flags) {
+  int srgb = !(flags & TEXTURE_FLAG_LINEAR);
+  switch( components ) {
+    case 1: return GL_R8;
+    case 3: return srgb ? GL_SRGB8 : GL_RGB8;
+    case 4: return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    default: return 0;
+  }
+}
+
+// sRGB variant of an 8-bit unorm internal format, float formats are already linear
+static GLint srgb_internal_format(GLint internal) {
+  switch (internal) {
+    case GL_RGB8: return GL_SRGB8;
+    case GL_RGBA8: return GL_SRGB8_ALPHA8;
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    default: return internal;
+  }
+}
+
 // Keep in sync with CubeMapFaces enum
 static const GLenum gl_cubemap_targets[] = {
   GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
@@ -296,12 +487,13 @@ static const GLenum gl_cubemap_targets[] = {
   GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
 };
 
-GLuint utility_load_texture(GLenum target, const char *filepath) {
+GLuint utility_load_texture(GLenum target, const char *filepath, int flags) {
   int width, height;
   int components;
   unsigned char* data;
   GLuint texture_id;
   GLint format;
+  GLint internal_format;
 
   stbi_set_flip_vertically_on_load(1);
   if(!(data = stbi_load(filepath, &width, &height, &components, 0))) {
@@ -314,16 +506,22 @@ GLuint utility_load_texture(GLenum target, const char *filepath) {
     stbi_image_free(data);
     return 0;
   }
+  internal_format = components_to_gl_internal_format(components, flags);
 
   GL_WRAP(glGenTextures(1, &texture_id));
   GL_WRAP(glBindTexture(target, texture_id));
 
   GL_WRAP(glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT));
   GL_WRAP(glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT));
-  GL_WRAP(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
-  GL_WRAP(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  if (flags & TEXTURE_FLAG_POINT_SAMPLING) {
+    GL_WRAP(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST));
+    GL_WRAP(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+  } else {
+    GL_WRAP(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+    GL_WRAP(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  }
 
-  GL_WRAP(glTexImage2D(target, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data));
+  GL_WRAP(glTexImage2D(target, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, data));
   stbi_image_free(data);
 
   GL_WRAP(glGenerateMipmap(target));
@@ -332,12 +530,13 @@ GLuint utility_load_texture(GLenum target, const char *filepath) {
   glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &aniso);
   glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
 
-  printf("Loaded Image -- '%s' Width: %i Height %i Components %i\n", filepath, width, height, components);
+  printf("Loaded Image -- '%s' Width: %i Height %i Components %i sRGB: %s\n", filepath, width, height, components
+    , BOOL_TO_STRING(internal_format == GL_SRGB8 || internal_format == GL_SRGB8_ALPHA8));
 
   return texture_id;
 }
 
-GLuint utility_load_cubemap(const char* const* filepaths) {
+GLuint utility_load_cubemap(const char* const* filepaths, int flags) {
   GLuint texture_id;
   GL_WRAP(glGenTextures(1, &texture_id));
   GL_WRAP(glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id));
@@ -361,7 +560,8 @@ GLuint utility_load_cubemap(const char* const* filepaths) {
       return 0;
     }
 
-    GL_WRAP(glTexImage2D(gl_cubemap_targets[i], 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data));
+    GL_WRAP(glTexImage2D(gl_cubemap_targets[i], 0, components_to_gl_internal_format(components, flags)
+      , width, height, 0, format, GL_UNSIGNED_BYTE, data));
     stbi_image_free(data);
   }
 
@@ -379,6 +579,59 @@ GLuint utility_load_cubemap(const char* const* filepaths) {
   return texture_id;
 }
 
+GLuint utility_build_texture_array(const GLuint* textures, int count, int size) {
+  GLuint texture_id;
+  GL_WRAP(glGenTextures(1, &texture_id));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  GL_WRAP(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, size, size, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+
+  // blits decode sRGB sources and encode the layers with sRGB conversion on
+  GLboolean srgb;
+  GL_WRAP(srgb = glIsEnabled(GL_FRAMEBUFFER_SRGB));
+  GL_WRAP(glEnable(GL_FRAMEBUFFER_SRGB));
+
+  GLuint fbos[2];
+  GL_WRAP(glGenFramebuffers(2, fbos));
+  GL_WRAP(glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]));
+  GL_WRAP(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]));
+  for (int i = 0; i < count; i++) {
+    if (!textures[i])
+      continue;
+
+    GLint width, height;
+    GL_WRAP(glBindTexture(GL_TEXTURE_2D, textures[i]));
+    GL_WRAP(glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width));
+    GL_WRAP(glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height));
+    int level = 0;
+    while ((width >> (level + 1)) >= size && (height >> (level + 1)) >= size) {
+      level++;
+    }
+
+    GL_WRAP(glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], level));
+    GL_WRAP(glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture_id, 0, i));
+    GL_WRAP(glBlitFramebuffer(0, 0, width >> level, height >> level, 0, 0, size, size, GL_COLOR_BUFFER_BIT, GL_LINEAR));
+  }
+  GL_WRAP(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+  GL_WRAP(glDeleteFramebuffers(2, fbos));
+  if (!srgb) {
+    GL_WRAP(glDisable(GL_FRAMEBUFFER_SRGB));
+  }
+
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id));
+  GL_WRAP(glGenerateMipmap(GL_TEXTURE_2D_ARRAY));
+
+  float aniso = 0.0f;
+  glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &aniso);
+  glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+
+  printf("Built Texture Array -- Size: %i Layers: %i\n", size, count);
+  return texture_id;
+}
+
 void utility_set_clear_color(unsigned char r,  unsigned char g, unsigned b) {
   GL_WRAP(glClearColor(r/255.0f, g/255.0f, b/255.0f, 1.0f));
 }
@@ -391,23 +644,55 @@ float utility_mod_time(float modulus) {
   return fmodf(utility_secs_since_launch(), modulus); // in seconds
 }
 
+// Each thread draws from its own PCG32 stream, selected the first time the
+// thread asks for a number, so particles can spawn on any worker
+static uint64_t sRandomSeed = 0x853c49e6748fea9bull;
+static SDL_atomic_t sRandomStreams;
+static thread_local uint64_t tRandomState;
+static thread_local uint64_t tRandomIncrement; // odd once seeded
+
+static uint32_t random_step() {
+  uint64_t old = tRandomState;
+  tRandomState = old * 6364136223846793005ull + tRandomIncrement;
+  uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+  uint32_t rot = (uint32_t)(old >> 59u);
+  return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31u));
+}
+
+void utility_random_seed(uint64_t seed) {
+  sRandomSeed = seed;
+  tRandomIncrement = 0; // reseed this thread too
+}
+
+uint32_t utility_random_u32() {
+  if (!tRandomIncrement) {
+    uint64_t stream = (uint64_t)SDL_AtomicAdd(&sRandomStreams, 1);
+    tRandomIncrement = (stream << 1u) | 1u;
+    tRandomState = 0;
+    random_step();
+    tRandomState += sRandomSeed;
+    random_step();
+  }
+  return random_step();
+}
+
 int utility_random_bool() {
-  return rand() >= (float)RAND_MAX/2;
+  return utility_random_u32() >> 31;
 }
 
 float utility_random_real01() {
-  return (float)rand() / (float)RAND_MAX;
+  return (float)(utility_random_u32() >> 8) * (1.0f / 16777215.0f);
 }
 
 float utility_random_real11() {
-  return -1.0f + 2.0f * rand() / (float)RAND_MAX;
+  return -1.0f + 2.0f * utility_random_real01();
 }
 
 float utility_random_range(float min, float max) {
-  return min + rand() / (float)RAND_MAX * (max - min);
+  return min + utility_random_real01() * (max - min);
 }
 
-GLuint utility_load_texture_dds(const char* filepath) {
+GLuint utility_load_texture_dds(const char* filepath, int flags) {
   gli::texture Texture = gli::load(filepath);
   if (Texture.empty()) {
     return 0;
@@ -417,6 +702,7 @@ GLuint utility_load_texture_dds(const char* filepath) {
   gli::gl::format format = GL.translate(Texture.format(), Texture.swizzles());
   GLenum target = GL.translate(Texture.target());
   assert(Texture.extent().z == 1 || Texture.target() != gli::TARGET_2D);
+  GLint internal_format = (flags & TEXTURE_FLAG_LINEAR) ? (GLint)format.Internal : srgb_internal_format(format.Internal);
 
   GLuint texture_id = 0;
   GL_WRAP(glGenTextures(1, &texture_id));
@@ -447,7 +733,7 @@ GLuint utility_load_texture_dds(const char* filepath) {
         printf("\t\tCompressed Size: %lu\n", Texture.size(level));
         GL_WRAP(glCompressedTexImage2D(
           face_target, level,
-          format.Internal,
+          internal_format,
           level_extent.x, level_extent.y,
           0, Texture.size(level),
           Texture.data(0, face, level)
@@ -455,7 +741,7 @@ GLuint utility_load_texture_dds(const char* filepath) {
       } else {
         GL_WRAP(glTexImage2D(
            face_target, level,
-           format.Internal,
+           internal_format,
            level_extent.x, level_extent.y,
           0, format.External, format.Type,
            Texture.data(0, face, level)
@@ -12,6 +12,56 @@ GLuint utility_link_program(GLuint program);
 GLuint utility_create_program(const char *vert_filename, const char *frag_filename);
 GLuint utility_create_program_defines(const char *vert_filename, const char *frag_filename, const char** defines, int defines_count);
 
+typedef void(*LoadingCallback)(const char* stage, const char* asset, int index, int total);
+
+typedef struct
+{
+  const char* vert_filename;
+  const char* frag_filename; // optional for transform feedback only programs
+  const char* geom_filename; // optional
+  const char** defines;
+  int defines_count;
+
+  // bound to attribute location / fragment color number i before linking
+  const char* const* attribs;
+  int attribs_count;
+  const char* const* frag_outputs;
+  int frag_outputs_count;
+
+  // captured interleaved, in order, by transform feedback
+  const char* const* feedback_varyings;
+  int feedback_varyings_count;
+} ProgramDesc;
+
+typedef struct
+{
+  const char* vert_filename;
+  const char* frag_filename;
+  const char* geom_filename;
+  int defines_count;
+  GLuint program;
+  GLuint vert_shader;
+  GLuint frag_shader;
+  GLuint geom_shader;
+  int cached;
+} ProgramRequest;
+
+// Asynchronous program builds. utility_request_program issues the compile and
+// link without querying any status, so a batch of requests can be worked on by
+// the driver in parallel (ARB_parallel_shader_compile). utility_wait_programs
+// polls every outstanding request without blocking and keeps the loading screen
+// running; utility_finish_program then checks the result, blocking only if the
+// driver can't report completion. The request must stay alive until finished
+// or cancelled.
+int utility_request_program(ProgramRequest* req, const ProgramDesc* desc);
+int utility_program_ready(const ProgramRequest* req);
+GLuint utility_finish_program(ProgramRequest* req);
+
+// Drops a request that won't be finished, say when a later one in the same
+// batch failed. Does nothing for requests already finished or never issued.
+void utility_cancel_program(ProgramRequest* req);
+void utility_wait_programs(const char* stage, LoadingCallback update_loading_cb);
+
 void utility_draw_cube(GLint texcoord_loc, GLint normal_loc, GLint tangent_loc, GLint pos_loc, float min, float max);
 void utility_draw_fullscreen_quad(GLint texcoord_loc, GLint pos_loc);
 void utility_draw_fullscreen_quad2( GLint texcoord_loc, GLint pos_loc );
@@ -36,15 +86,31 @@ typedef enum
     folder "/negx" suffix																\
   }
 
+// 8-bit color images are stored as sRGB and decoded to linear by the sampler
+// unless TEXTURE_FLAG_LINEAR is set. Use it for data maps (normals, roughness,
+// metalness, lookup tables, ...) which are already linear.
+typedef enum
+{
+  TEXTURE_FLAG_LINEAR         = 1 << 0,
+  TEXTURE_FLAG_POINT_SAMPLING = 1 << 1
+} TextureFlags;
+
 GLuint utility_load_texture_constant(const vec4 value);
 GLuint utility_load_texture_unknown();
-GLuint utility_load_texture_dds( const char* filepath);
-GLuint utility_load_texture(GLenum target, const char *filepath);
-GLuint utility_load_cubemap(const char* const* filepaths);
+GLuint utility_load_texture_dds( const char* filepath, int flags);
+GLuint utility_load_texture(GLenum target, const char *filepath, int flags);
+GLuint utility_load_cubemap(const char* const* filepaths, int flags);
+// Copies each mipmapped 2D texture into a layer of a size x size sRGB array,
+// filtered down from its closest larger mip. Linear sources are encoded so
+// they sample back unchanged; a 0 texture leaves its layer undefined.
+GLuint utility_build_texture_array(const GLuint* textures, int count, int size);
 
 float utility_secs_since_launch();
 float utility_mod_time(float modulus);
 
+// thread safe, each thread gets its own stream
+void utility_random_seed(uint64_t seed);
+uint32_t utility_random_u32();
 int utility_random_bool();
 float utility_random_real01(); //[0, 1]
 float utility_random_real11(); //[-1, 1]
@@ -0,0 +1,141 @@
+#include "visibility.h"
+#include "profiler.h"
+
+typedef struct
+{
+  VisibilityMesh meshes[VISIBILITY_MESHES_MAX];
+  int meshes_count;
+} VisibilityCache;
+
+static VisibilityCache sCache;
+
+static unsigned int mesh_index(const Mesh* mesh, unsigned int i) {
+  return mesh->indices ? mesh->indices[i] : i;
+}
+
+// Splits quads into (0,1,2) (0,2,3), keeping the winding
+static unsigned int* build_triangles(const Mesh* mesh, unsigned int* out_count) {
+  unsigned int count = mesh->indices ? mesh->index_count : mesh->vertex_count;
+  unsigned int triangle_count;
+  switch (mesh->mode) {
+    case GL_TRIANGLES: triangle_count = count / 3; break;
+    case GL_QUADS:     triangle_count = (count / 4) * 2; break;
+    default: return NULL;
+  }
+  if (!triangle_count || triangle_count > VISIBILITY_TRIANGLES_MAX)
+    return NULL;
+
+  unsigned int* triangles = (unsigned int*)malloc(triangle_count * 3 * sizeof(unsigned int));
+  unsigned int* out = triangles;
+  if (mesh->mode == GL_QUADS) {
+    for (unsigned int i = 0; i + 3 < count; i += 4) {
+      *out++ = mesh_index(mesh, i);
+      *out++ = mesh_index(mesh, i+1);
+      *out++ = mesh_index(mesh, i+2);
+      *out++ = mesh_index(mesh, i);
+      *out++ = mesh_index(mesh, i+2);
+      *out++ = mesh_index(mesh, i+3);
+    }
+  } else {
+    for (unsigned int i = 0; i < triangle_count * 3; i++) {
+      *out++ = mesh_index(mesh, i);
+    }
+  }
+  *out_count = triangle_count;
+  return triangles;
+}
+
+static GLuint create_data_texture(GLenum internal_format, GLenum format, GLenum type, int width, int height, const void* data) {
+  GLint max_size = 0;
+  GL_WRAP(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size));
+  // the widths are fixed to match mesh.frag, so a small limit fails either way
+  if (width > max_size || height > max_size)
+    return 0;
+
+  GLuint tex;
+  GL_WRAP(glGenTextures(1, &tex));
+  GL_WRAP(glBindTexture(GL_TEXTURE_2D, tex));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+  GL_WRAP(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0));
+  GL_WRAP(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+  GL_WRAP(glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, data));
+  return tex;
+}
+
+static GLuint create_vertex_data(const Mesh* mesh) {
+  const unsigned int per_row = VISIBILITY_VERTEX_DATA_WIDTH / VISIBILITY_VERTEX_TEXELS;
+  const unsigned int rows = (mesh->vertex_count + per_row - 1) / per_row;
+  float* data = (float*)calloc((size_t)VISIBILITY_VERTEX_DATA_WIDTH * rows * 4, sizeof(float));
+  for (unsigned int v = 0; v < mesh->vertex_count; v++) {
+    float* texel = data + ((size_t)(v / per_row) * VISIBILITY_VERTEX_DATA_WIDTH + (v % per_row) * VISIBILITY_VERTEX_TEXELS) * 4;
+    memcpy(&texel[0], &mesh->vertices[v*3], 3 * sizeof(float));
+    if (mesh->normals) memcpy(&texel[4], &mesh->normals[v*3], 3 * sizeof(float));
+    if (mesh->texcoords) {
+      texel[3] = mesh->texcoords[v*2];
+      texel[7] = mesh->texcoords[v*2+1];
+    }
+    if (mesh->tangents) memcpy(&texel[8], &mesh->tangents[v*4], 4 * sizeof(float));
+  }
+  GLuint tex = create_data_texture(GL_RGBA32F, GL_RGBA, GL_FLOAT, VISIBILITY_VERTEX_DATA_WIDTH, rows, data);
+  free(data);
+  return tex;
+}
+
+static GLuint create_triangle_data(const unsigned int* triangles, unsigned int triangle_count) {
+  const unsigned int rows = (triangle_count + VISIBILITY_TRIANGLE_DATA_WIDTH - 1) / VISIBILITY_TRIANGLE_DATA_WIDTH;
+  unsigned int* data = (unsigned int*)calloc((size_t)VISIBILITY_TRIANGLE_DATA_WIDTH * rows * 3, sizeof(unsigned int));
+  memcpy(data, triangles, triangle_count * 3 * sizeof(unsigned int));
+  GLuint tex = create_data_texture(GL_RGB32UI, GL_RGB_INTEGER, GL_UNSIGNED_INT, VISIBILITY_TRIANGLE_DATA_WIDTH, rows, data);
+  free(data);
+  return tex;
+}
+
+const VisibilityMesh* visibility_get_mesh(const Mesh* mesh) {
+  for (int i = 0; i < sCache.meshes_count; i++) {
+    if (sCache.meshes[i].mesh == mesh)
+      return sCache.meshes[i].triangle_count ? &sCache.meshes[i] : NULL;
+  }
+  if (sCache.meshes_count >= VISIBILITY_MESHES_MAX)
+    return NULL;
+
+  // failures are cached too, as an entry without triangles
+  VisibilityMesh* vm = &sCache.meshes[sCache.meshes_count++];
+  memset(vm, 0, sizeof(VisibilityMesh));
+  vm->mesh = mesh;
+
+  unsigned int triangle_count = 0;
+  unsigned int* triangles = build_triangles(mesh, &triangle_count);
+  if (!triangles) {
+    printf("Unable to build visibility mesh for %s\n", mesh->desc ? mesh->desc->name : "procedural mesh");
+    return NULL;
+  }
+
+  vm->vertex_data_tex = create_vertex_data(mesh);
+  vm->triangle_data_tex = create_triangle_data(triangles, triangle_count);
+  if (!vm->vertex_data_tex || !vm->triangle_data_tex) {
+    printf("Visibility data for %s exceeds the max texture size\n", mesh->desc ? mesh->desc->name : "procedural mesh");
+    GL_WRAP(glDeleteTextures(1, &vm->vertex_data_tex));
+    GL_WRAP(glDeleteTextures(1, &vm->triangle_data_tex));
+    vm->vertex_data_tex = vm->triangle_data_tex = 0;
+    free(triangles);
+    return NULL;
+  }
+
+  vm->triangle_indices = triangles;
+  vm->triangle_count = triangle_count;
+  return vm;
+}
+
+void visibility_mesh_draw(const VisibilityMesh* vm, GLint pos_loc) {
+  assert(vm->mesh->vertices && pos_loc >= 0);
+  GL_WRAP(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_WRAP(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+  GL_WRAP(glEnableVertexAttribArray(pos_loc));
+  GL_WRAP(glVertexAttribPointer(pos_loc, 3, GL_FLOAT, GL_FALSE, 0, vm->mesh->vertices));
+
+  GL_WRAP(glDrawElements(GL_TRIANGLES, vm->triangle_count * 3, GL_UNSIGNED_INT, vm->triangle_indices));
+  profiler_count_draw(GL_TRIANGLES, vm->triangle_count * 3);
+
+  GL_WRAP(glDisableVertexAttribArray(pos_loc));
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+#include "mesh.h"
+
+// The visibility buffer stores (instance << VISIBILITY_TRIANGLE_BITS | triangle)
+// per pixel. Instance ids double as stencil values, so 0 stays free for the sky.
+#define VISIBILITY_TRIANGLE_BITS 24
+#define VISIBILITY_TRIANGLES_MAX (1u << VISIBILITY_TRIANGLE_BITS)
+#define VISIBILITY_INSTANCES_MAX 255
+#define VISIBILITY_MESHES_MAX 64
+
+// Data texture layouts, mirrored in mesh.frag
+#define VISIBILITY_VERTEX_TEXELS 3
+#define VISIBILITY_VERTEX_DATA_WIDTH 4095
+#define VISIBILITY_TRIANGLE_DATA_WIDTH 4096
+
+// Triangle-list copy of a mesh. The id pass draws these so gl_PrimitiveID is
+// a triangle index whatever the source primitive mode; the resolve pass reads
+// the triangle's vertices back out of the two data textures.
+typedef struct
+{
+  const Mesh* mesh;
+  unsigned int* triangle_indices; // 3 per triangle
+  unsigned int triangle_count;
+
+  GLuint vertex_data_tex;   // RGBA32F, per vertex: (position, u) (normal, v) (tangent)
+  GLuint triangle_data_tex; // RGB32UI, per triangle: its three vertex indices
+} VisibilityMesh;
+
+// Returns the visibility copy of a mesh, building it on first use. NULL if
+// the mesh can't be represented.
+const VisibilityMesh* visibility_get_mesh(const Mesh* mesh);
+void visibility_mesh_draw(const VisibilityMesh* vm, GLint pos_loc);